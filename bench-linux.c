@@ -0,0 +1,410 @@
+/**
+ * @file  bench-linux.c
+ * @brief cfgpath.h benchmarks for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Usage: bench-linux [threads [iterations]]
+ *
+ * Each function is timed in a number of situations, reporting the average
+ * time, number of system calls and number of heap allocations per call.  Only
+ * the system calls made by cfgpath.h itself are counted, by redirecting them
+ * through counting wrappers in the same way test-linux.c fakes them.  Every
+ * filesystem and user database call it makes is wrapped, but not the locking
+ * and thread calls, which only reach the kernel under contention.
+ *
+ * The first row of each table is a baseline: get_user_config_folder() done
+ * the simple way cfgpath.h originally did it, reading the environment and
+ * calling mkdir() for each folder every time.  It shows what the other
+ * functions cost compared to that.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define mkdir bench_mkdir
+#define mkdirat bench_mkdirat
+#define open bench_open
+#define openat bench_openat
+#define close bench_close
+#define malloc bench_malloc
+/* Function-like, so struct stat is left alone */
+#define stat(path, st) bench_stat(path, st)
+#define fstat(fd, st) bench_fstat(fd, st)
+#define fstatat(dirfd, path, st, flags) bench_fstatat(dirfd, path, st, flags)
+#define access(path, mode) bench_access(path, mode)
+#define fchmod(fd, mode) bench_fchmod(fd, mode)
+#define getpwuid_r(uid, pwd, buf, len, result) \
+	bench_getpwuid_r(uid, pwd, buf, len, result)
+#include "cfgpath.h"
+#undef mkdir
+#undef mkdirat
+#undef open
+#undef openat
+#undef close
+#undef malloc
+#undef stat
+#undef fstat
+#undef fstatat
+#undef access
+#undef fchmod
+#undef getpwuid_r
+
+#include <stdarg.h>
+
+/* The headers above declared the bench_* names, so declare the real ones */
+int mkdir(const char *path, mode_t mode);
+int mkdirat(int dirfd, const char *path, mode_t mode);
+int open(const char *path, int flags, ...);
+int openat(int dirfd, const char *path, int flags, ...);
+int close(int fd);
+void *malloc(size_t size);
+int stat(const char *path, struct stat *st);
+int fstat(int fd, struct stat *st);
+int fstatat(int dirfd, const char *path, struct stat *st, int flags);
+int access(const char *path, int mode);
+int fchmod(int fd, mode_t mode);
+int getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t len,
+	struct passwd **result);
+
+#define DEFAULT_ITERATIONS 100000
+#define COLD_ITERATIONS 2000
+
+static unsigned long count_syscalls;
+static unsigned long count_allocs;
+
+int bench_mkdir(const char *path, mode_t mode)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return mkdir(path, mode);
+}
+
+int bench_mkdirat(int dirfd, const char *path, mode_t mode)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return mkdirat(dirfd, path, mode);
+}
+
+int bench_open(const char *path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return open(path, flags, mode);
+}
+
+int bench_openat(int dirfd, const char *path, int flags, ...)
+{
+	va_list ap;
+	va_start(ap, flags);
+	mode_t mode = va_arg(ap, int);
+	va_end(ap);
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return openat(dirfd, path, flags, mode);
+}
+
+int bench_close(int fd)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return close(fd);
+}
+
+int bench_stat(const char *path, struct stat *st)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return stat(path, st);
+}
+
+int bench_fstat(int fd, struct stat *st)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return fstat(fd, st);
+}
+
+int bench_fstatat(int dirfd, const char *path, struct stat *st, int flags)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return fstatat(dirfd, path, st, flags);
+}
+
+int bench_access(const char *path, int mode)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return access(path, mode);
+}
+
+int bench_fchmod(int fd, mode_t mode)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return fchmod(fd, mode);
+}
+
+/* Reads the user database, which may be a file or a network service, so counts
+ * as one call however many it really makes */
+int bench_getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t len,
+	struct passwd **result)
+{
+	__atomic_fetch_add(&count_syscalls, 1, __ATOMIC_RELAXED);
+	return getpwuid_r(uid, pwd, buf, len, result);
+}
+
+void *bench_malloc(size_t size)
+{
+	__atomic_fetch_add(&count_allocs, 1, __ATOMIC_RELAXED);
+	return malloc(size);
+}
+
+/* Functions with other signatures, wrapped to look like the main ones */
+typedef void (*cfgpath_func)(char *out, unsigned int maxlen, const char *appname);
+
+/* The baseline: get_user_config_folder() as cfgpath.h first implemented it */
+static void baseline(char *out, unsigned int maxlen, const char *appname)
+{
+	const char *home = getenv("XDG_CONFIG_HOME");
+	const char *config = "";
+	if (!home) {
+		home = getenv("HOME");
+		config = "/.config";
+	}
+	if (!home || (snprintf(out, maxlen, "%s%s/%s/", home, config, appname)
+		>= (int)maxlen)
+	) {
+		out[0] = 0;
+		return;
+	}
+	char *slash = out + strlen(home) + strlen(config);
+	if (config[0]) {
+		*slash = 0;
+		bench_mkdir(out, 0755);
+		*slash = '/';
+	}
+	bench_mkdir(out, 0755);
+}
+
+static void resolve_all(char *out, unsigned int maxlen, const char *appname)
+{
+	(void)maxlen;
+	struct cfgpath_all all;
+	cfgpath_resolve_all(&all, appname);
+	strcpy(out, all.config_file);
+}
+
+static void cache_folder_fd(char *out, unsigned int maxlen, const char *appname)
+{
+	(void)maxlen;
+	out[0] = get_user_cache_folder_fd(appname) >= 0;
+}
+
+static void config_file_uid(char *out, unsigned int maxlen, const char *appname)
+{
+	get_user_config_file_uid(out, maxlen, appname, getuid());
+}
+
+static void config_file_env(char *out, unsigned int maxlen, const char *appname)
+{
+	get_user_config_file_env(out, maxlen, appname, cfgpath_envp_getenv, environ);
+}
+
+static void config_folder_deferred(char *out, unsigned int maxlen, const char *appname)
+{
+	cfgpath_get_ex(CFGPATH_CONFIG_FOLDER, out, maxlen, appname, CFGPATH_CREATE_DEFERRED);
+}
+
+static const struct {
+	const char *name;
+	cfgpath_func func;
+} funcs[] = {
+#define FUNC(f) { #f, f }
+	FUNC(baseline),
+	FUNC(get_user_config_file),
+	FUNC(get_user_config_folder),
+	FUNC(get_user_data_folder),
+	FUNC(get_user_cache_folder),
+	{ "cfgpath_resolve_all", resolve_all },
+	{ "get_user_cache_folder_fd", cache_folder_fd },
+	{ "get_user_config_file_uid", config_file_uid },
+	{ "get_user_config_file_env", config_file_env },
+	{ "cfgpath_get_ex(DEFERRED)", config_folder_deferred },
+#undef FUNC
+};
+#define NUM_FUNCS (sizeof(funcs) / sizeof(funcs[0]))
+
+struct result {
+	double ns;
+	double syscalls;
+	double allocs;
+};
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+struct thread_arg {
+	cfgpath_func func;
+	long iterations;
+};
+
+static void *bench_thread(void *arg)
+{
+	struct thread_arg *t = (struct thread_arg *)arg;
+	char buffer[MAX_PATH];
+	long i;
+	for (i = 0; i < t->iterations; i++) {
+		t->func(buffer, sizeof(buffer), "bench-linux");
+	}
+	return NULL;
+}
+
+/* Time repeated calls for the same appname, so folders already exist */
+static struct result bench_warm(cfgpath_func func, int nthreads, long iterations)
+{
+	struct thread_arg arg = { func, iterations };
+	struct thread_arg once = { func, 1 };
+	pthread_t thread[nthreads];
+	struct result r;
+	int i;
+
+	/* Make sure the folders exist before timing starts */
+	bench_thread(&once);
+
+	count_syscalls = count_allocs = 0;
+	double start = now_ns();
+	for (i = 0; i < nthreads; i++) {
+		pthread_create(&thread[i], NULL, bench_thread, &arg);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	double calls = (double)iterations * nthreads;
+	/* Wall time divided by calls across all threads, i.e. 1/throughput */
+	r.ns = (now_ns() - start) / calls;
+	/* Deferred work is not timed, but its system calls still count */
+	cfgpath_flush();
+	r.syscalls = count_syscalls / calls;
+	r.allocs = count_allocs / calls;
+	return r;
+}
+
+/* Time calls for a new appname each time, so the folder has to be created */
+static struct result bench_cold(cfgpath_func func, long iterations)
+{
+	static int run = 0;
+	char buffer[MAX_PATH], appname[32];
+	struct result r;
+	double total = 0;
+	long i;
+
+	run++;
+	count_syscalls = count_allocs = 0;
+	for (i = 0; i < iterations; i++) {
+		snprintf(appname, sizeof(appname), "cold-%d-%ld", run, i);
+		double start = now_ns();
+		func(buffer, sizeof(buffer), appname);
+		total += now_ns() - start;
+	}
+	r.ns = total / iterations;
+	cfgpath_flush();
+	r.syscalls = (double)count_syscalls / iterations;
+	r.allocs = (double)count_allocs / iterations;
+	return r;
+}
+
+static void print_header(const char *scenario)
+{
+	printf("\n%s\n", scenario);
+	printf("  %-28s %10s %14s %12s\n", "function", "ns/call", "syscalls/call",
+		"allocs/call");
+}
+
+static void print_result(const char *name, struct result r)
+{
+	printf("  %-28s %10.1f %14.2f %12.2f\n", name, r.ns, r.syscalls, r.allocs);
+}
+
+static void set_xdg(const char *home, int set)
+{
+	static const char *var[] = { "XDG_CONFIG_HOME", "XDG_DATA_HOME", "XDG_CACHE_HOME" };
+	static const char *dir[] = { "xdg-config", "xdg-data", "xdg-cache" };
+	char path[MAX_PATH];
+	unsigned int i;
+	for (i = 0; i < 3; i++) {
+		if (set) {
+			snprintf(path, sizeof(path), "%s/%s", home, dir[i]);
+			setenv(var[i], path, 1);
+		} else {
+			unsetenv(var[i]);
+		}
+	}
+}
+
+static void bench_all_warm(const char *scenario, int nthreads, long iterations)
+{
+	unsigned int f;
+	print_header(scenario);
+	for (f = 0; f < NUM_FUNCS; f++) {
+		print_result(funcs[f].name, bench_warm(funcs[f].func, nthreads, iterations));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	char home[] = "/tmp/cfgpath-bench-XXXXXX";
+	char scenario[80];
+	unsigned int f;
+
+	int nthreads = (argc > 1) ? atoi(argv[1]) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1) nthreads = 1;
+	long iterations = (argc > 2) ? atol(argv[2]) : DEFAULT_ITERATIONS;
+	if (iterations < 1) iterations = 1;
+
+	if (!mkdtemp(home)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("HOME", home, 1);
+	set_xdg(home, 0);
+
+	bench_all_warm("Warm folders, $HOME only", 1, iterations);
+
+	set_xdg(home, 1);
+	bench_all_warm("Warm folders, $XDG_*_HOME set", 1, iterations);
+	set_xdg(home, 0);
+
+	print_header("Cold folders, new appname each call");
+	for (f = 0; f < NUM_FUNCS; f++) {
+		print_result(funcs[f].name, bench_cold(funcs[f].func, COLD_ITERATIONS));
+	}
+	cfgpath_close_folder_fds();
+
+	cfgpath_env_refresh();
+	cfgpath_cache_enable(1);
+	bench_all_warm("Warm folders, cache and environment snapshot", 1, iterations);
+	cfgpath_cache_enable(0);
+	cfgpath_env_release();
+
+	snprintf(scenario, sizeof(scenario), "Warm folders, %d threads", nthreads);
+	bench_all_warm(scenario, nthreads, iterations);
+
+	cfgpath_env_refresh();
+	cfgpath_cache_enable(1);
+	snprintf(scenario, sizeof(scenario),
+		"Warm folders, %d threads, cache and environment snapshot", nthreads);
+	bench_all_warm(scenario, nthreads, iterations);
+	cfgpath_cache_enable(0);
+	cfgpath_env_release();
+
+	cfgpath_close_folder_fds();
+	char cmd[64 + sizeof(home)];
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", home);
+	return system(cmd);
+}
@@ -0,0 +1,419 @@
+/**
+ * @file  cfgpath-blob.h
+ * @brief Store files in the cache folder by the hash of their contents.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use:
+ *
+ * struct cfgpath_blob_store store;
+ * char key[CFGPATH_BLOB_KEY_LEN + 1];
+ * struct cfgpath_view view;
+ *
+ * cfgpath_blob_open_app(&store, "myapp");
+ * cfgpath_blob_put(&store, data, len, key);
+ * ...
+ * if (cfgpath_blob_get(&store, key, &view, NULL, 0) == 0) {
+ *     use(view.data, view.len);
+ *     cfgpath_view_release(&view);
+ * }
+ * cfgpath_blob_close(&store);
+ *
+ * Each blob is named by the SHA-256 hash of its contents in hex, so storing
+ * the same contents twice only keeps one copy.  Putting millions of files in
+ * one folder makes every lookup slow, so the blobs are spread over two levels
+ * of folders named after the first four hex digits of the hash, e.g.
+ * 3a/7f/3a7f....  With 65536 folders, each holds few enough files that a
+ * lookup takes the same time however big the store grows.  The folders are
+ * only created when the first blob goes into them.
+ *
+ * Blobs are written with cfgpath_write_begin() and cfgpath_write_commit(), so
+ * a blob either exists with its full contents or not at all.  They are read
+ * with cfgpath_map_fd(), so large blobs are mapped rather than copied.
+ *
+ * This is only available under Linux.
+ */
+
+#ifndef CFGPATH_BLOB_H_
+#define CFGPATH_BLOB_H_
+
+#include "cfgpath-file.h"
+#include <stdint.h>
+
+/* Length of a key, which is a SHA-256 hash in hex. */
+#define CFGPATH_BLOB_KEY_LEN 64
+
+/* Length of a blob's path relative to the store, e.g. "3a/7f/3a7f..." */
+#define CFGPATH_BLOB_NAME_LEN (6 + CFGPATH_BLOB_KEY_LEN)
+
+/** A folder of blobs, see cfgpath_blob_open(). */
+struct cfgpath_blob_store {
+	char *path;      /* Folder, ending in a slash */
+	size_t len;      /* Length of path */
+	int dir_fd;
+};
+
+/* Process one 64 byte block of a SHA-256 hash. */
+static inline void cfgpath_sha256_block(uint32_t *h, const unsigned char *p)
+{
+	static const uint32_t k[64] = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+		0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+		0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+		0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+		0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+		0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+		0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+		0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+	uint32_t w[64];
+	uint32_t v[8];
+	int i;
+#define CFGPATH_ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+	for (i = 0; i < 16; i++) {
+		w[i] = ((uint32_t)p[i * 4] << 24) | ((uint32_t)p[i * 4 + 1] << 16)
+			| ((uint32_t)p[i * 4 + 2] << 8) | p[i * 4 + 3];
+	}
+	for (i = 16; i < 64; i++) {
+		uint32_t s0 = CFGPATH_ROR(w[i - 15], 7) ^ CFGPATH_ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1 = CFGPATH_ROR(w[i - 2], 17) ^ CFGPATH_ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+	for (i = 0; i < 8; i++) v[i] = h[i];
+	for (i = 0; i < 64; i++) {
+		uint32_t s1 = CFGPATH_ROR(v[4], 6) ^ CFGPATH_ROR(v[4], 11) ^ CFGPATH_ROR(v[4], 25);
+		uint32_t ch = (v[4] & v[5]) ^ (~v[4] & v[6]);
+		uint32_t t1 = v[7] + s1 + ch + k[i] + w[i];
+		uint32_t s0 = CFGPATH_ROR(v[0], 2) ^ CFGPATH_ROR(v[0], 13) ^ CFGPATH_ROR(v[0], 22);
+		uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		memmove(v + 1, v, 7 * sizeof(uint32_t));
+		v[4] += t1;
+		v[0] = t1 + s0 + maj;
+	}
+#undef CFGPATH_ROR
+	for (i = 0; i < 8; i++) h[i] += v[i];
+}
+
+/** Get the key for some contents.
+ *
+ * This is the SHA-256 hash of the contents, in lowercase hex.
+ *
+ * @param data
+ *   Contents of the blob.
+ *
+ * @param len
+ *   Length of data in bytes.
+ *
+ * @param key
+ *   Set to the key, followed by a terminating null.
+ */
+static inline void cfgpath_blob_key(const void *data, size_t len,
+	char key[CFGPATH_BLOB_KEY_LEN + 1])
+{
+	uint32_t h[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	const unsigned char *p = (const unsigned char *)data;
+	size_t left = len;
+	for (; left >= 64; left -= 64, p += 64) cfgpath_sha256_block(h, p);
+
+	/* The rest, a 1 bit, and the length in bits, padded to whole blocks */
+	unsigned char tail[128];
+	size_t tail_len = (left < 56) ? 64 : 128;
+	memset(tail, 0, sizeof(tail));
+	if (left) memcpy(tail, p, left);
+	tail[left] = 0x80;
+	uint64_t bits = (uint64_t)len * 8;
+	int i;
+	for (i = 0; i < 8; i++) tail[tail_len - 1 - i] = bits >> (i * 8);
+	cfgpath_sha256_block(h, tail);
+	if (tail_len == 128) cfgpath_sha256_block(h, tail + 64);
+
+	static const char hex[] = "0123456789abcdef";
+	for (i = 0; i < 32; i++) {
+		unsigned char b = h[i / 4] >> (24 - (i % 4) * 8);
+		key[i * 2] = hex[b >> 4];
+		key[i * 2 + 1] = hex[b & 15];
+	}
+	key[CFGPATH_BLOB_KEY_LEN] = 0;
+}
+
+/** Get the path of a blob relative to the store.
+ *
+ * This is for use with other code that manages the files in the store, such
+ * as cfgpath-lru.h.
+ *
+ * @param key
+ *   Key of the blob.
+ *
+ * @param name
+ *   Set to the path, e.g. "3a/7f/3a7f...", followed by a terminating null.
+ *
+ * @return 0 on success, or -1 if key is not a valid key.
+ */
+static inline int cfgpath_blob_name(const char *key,
+	char name[CFGPATH_BLOB_NAME_LEN + 1])
+{
+	int i;
+	for (i = 0; i < CFGPATH_BLOB_KEY_LEN; i++) {
+		if (!(((key[i] >= '0') && (key[i] <= '9'))
+			|| ((key[i] >= 'a') && (key[i] <= 'f')))
+		) {
+			return -1;
+		}
+	}
+	if (key[CFGPATH_BLOB_KEY_LEN]) return -1;
+	name[0] = key[0];
+	name[1] = key[1];
+	name[2] = '/';
+	name[3] = key[2];
+	name[4] = key[3];
+	name[5] = '/';
+	memcpy(name + 6, key, CFGPATH_BLOB_KEY_LEN + 1);
+	return 0;
+}
+
+/** Open a folder of blobs.
+ *
+ * @param store
+ *   Store to set up.  Pass it to cfgpath_blob_close() when no longer needed.
+ *
+ * @param folder
+ *   Folder to keep the blobs in.  It is created if needed.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOSYS on other
+ *   platforms).
+ */
+static inline int cfgpath_blob_open(struct cfgpath_blob_store *store,
+	const char *folder)
+{
+	store->path = NULL;
+	store->dir_fd = -1;
+#ifdef CFGPATH_LINUX
+	size_t len = strlen(folder);
+	int slash = (len == 0) || (folder[len - 1] != '/');
+	store->path = (char *)malloc(len + slash + 1);
+	if (!store->path) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(store->path, folder, len);
+	if (slash) store->path[len++] = '/';
+	store->path[len] = 0;
+	store->len = len;
+	/* Synced into its parent, so blobs put in it survive a crash */
+	if (cfgpath_mkdir_p_ex(store->path, len, 0755, 1) == 0) {
+		store->dir_fd = open(store->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	}
+	if (store->dir_fd < 0) {
+		int err = errno;
+		free(store->path);
+		store->path = NULL;
+		errno = err;
+		return -1;
+	}
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Open the blob store in an application's cache folder.
+ *
+ * This is the "blobs" folder in the folder from get_user_cache_folder().
+ *
+ * @param appname
+ *   Short name of the application, as for get_user_cache_folder().
+ *
+ * See cfgpath_blob_open() for the other parameters and the return value.
+ * errno is set to ENOENT if the user's home folder cannot be found.
+ */
+static inline int cfgpath_blob_open_app(struct cfgpath_blob_store *store,
+	const char *appname)
+{
+	char folder[MAX_PATH];
+	int len = cfgpath_get(CFGPATH_CACHE_FOLDER, folder, sizeof(folder), appname);
+	if ((len <= 0) || (len + sizeof("blobs/") > sizeof(folder))) {
+		store->path = NULL;
+		store->dir_fd = -1;
+		errno = (len <= 0) ? ENOENT : ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(folder + len, "blobs/");
+	return cfgpath_blob_open(store, folder);
+}
+
+/** Add a blob to the store.
+ *
+ * If a blob with the same contents is already there, nothing is written.
+ *
+ * @param data
+ *   Contents of the blob.
+ *
+ * @param len
+ *   Length of data in bytes.
+ *
+ * @param key
+ *   Set to the key of the blob, followed by a terminating null, or NULL if
+ *   not needed.
+ *
+ * @return 0 if the blob was added, 1 if it was already there, or -1 on error
+ *   with errno set.
+ *
+ * @post The blob is on disk, with all its contents, even if the system crashes.
+ */
+static inline int cfgpath_blob_put(struct cfgpath_blob_store *store,
+	const void *data, size_t len, char *key)
+{
+#ifdef CFGPATH_LINUX
+	char own_key[CFGPATH_BLOB_KEY_LEN + 1];
+	char stack_path[MAX_PATH];
+	char *path = stack_path;
+	if (!key) key = own_key;
+	cfgpath_blob_key(data, len, key);
+	if (store->len + CFGPATH_BLOB_NAME_LEN + 1 > sizeof(stack_path)) {
+		path = (char *)malloc(store->len + CFGPATH_BLOB_NAME_LEN + 1);
+		if (!path) {
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	memcpy(path, store->path, store->len);
+	cfgpath_blob_name(key, path + store->len);
+
+	struct stat st;
+	int ret = 1;
+	if (fstatat(store->dir_fd, path + store->len, &st, 0) == 0) {
+		if (path != stack_path) free(path);
+		return ret;
+	}
+
+	/* Creates the two folders the first time one of their blobs is stored */
+	struct cfgpath_writer w;
+	ret = cfgpath_write_begin(&w, path);
+	if (ret == 0) {
+		if (cfgpath_write(&w, data, len) == 0) {
+			ret = cfgpath_write_commit(&w);
+		} else {
+			int err = errno;
+			cfgpath_write_abort(&w);
+			errno = err;
+			ret = -1;
+		}
+	}
+	if (path != stack_path) {
+		int err = errno;
+		free(path);
+		errno = err;
+	}
+	return ret;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Get the contents of a blob.
+ *
+ * @param key
+ *   Key of the blob, as from cfgpath_blob_put().
+ *
+ * @param view
+ *   Set to the contents of the blob, as for cfgpath_map_file().  Release it
+ *   with cfgpath_view_release().
+ *
+ * @param buf
+ *   Buffer for small blobs, or NULL to always map the blob.
+ *
+ * @param buflen
+ *   Length of buf.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOENT if there is no
+ *   such blob, EINVAL if key is not a valid key).
+ */
+static inline int cfgpath_blob_get(struct cfgpath_blob_store *store,
+	const char *key, struct cfgpath_view *view, char *buf, size_t buflen)
+{
+	view->data = NULL;
+	view->len = 0;
+	view->map = NULL;
+	view->map_len = 0;
+#ifdef CFGPATH_LINUX
+	char name[CFGPATH_BLOB_NAME_LEN + 1];
+	if (cfgpath_blob_name(key, name) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	int fd = openat(store->dir_fd, name, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	int ret = cfgpath_map_fd(fd, view, buf, buflen);
+	int err = errno;
+	close(fd);
+	errno = err;
+	return ret;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Check whether a blob is in the store.
+ *
+ * @return 1 if it is, 0 if not.
+ */
+static inline int cfgpath_blob_exists(struct cfgpath_blob_store *store,
+	const char *key)
+{
+#ifdef CFGPATH_LINUX
+	char name[CFGPATH_BLOB_NAME_LEN + 1];
+	struct stat st;
+	return (cfgpath_blob_name(key, name) == 0)
+		&& (fstatat(store->dir_fd, name, &st, 0) == 0);
+#else
+	return 0;
+#endif
+}
+
+/** Remove a blob from the store.
+ *
+ * Views of the blob that are still open stay valid.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOENT if there is no
+ *   such blob).
+ */
+static inline int cfgpath_blob_remove(struct cfgpath_blob_store *store,
+	const char *key)
+{
+#ifdef CFGPATH_LINUX
+	char name[CFGPATH_BLOB_NAME_LEN + 1];
+	if (cfgpath_blob_name(key, name) != 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return unlinkat(store->dir_fd, name, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Close a blob store. */
+static inline void cfgpath_blob_close(struct cfgpath_blob_store *store)
+{
+#ifdef CFGPATH_LINUX
+	if (store->dir_fd >= 0) close(store->dir_fd);
+#endif
+	free(store->path);
+	store->path = NULL;
+	store->dir_fd = -1;
+}
+
+#endif /* CFGPATH_BLOB_H_ */
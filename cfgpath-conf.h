@@ -0,0 +1,352 @@
+/**
+ * @file  cfgpath-conf.h
+ * @brief Look up settings in the .conf/.ini files named by cfgpath.h.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use, with cfgpath-file.h:
+ *
+ * struct cfgpath_view view;
+ * struct cfgpath_conf conf;
+ * char value[256];
+ * if ((cfgpath_map_config_file("myapp", &view, NULL, 0) == 0)
+ *     && (cfgpath_conf_parse(&conf, view.data, view.len) == 0)) {
+ *     if (cfgpath_conf_get(&conf, "window", "title", value, sizeof(value)) >= 0)
+ *         set_title(value);
+ *     cfgpath_conf_free(&conf);
+ *     cfgpath_view_release(&view);
+ * }
+ *
+ * The file format is the usual one:
+ *
+ * # Comment, ';' works too
+ * global = value before any section
+ * [section]
+ * key = value
+ * quoted = "  keeps spaces, and \"escapes\"\n"
+ *
+ * Parsing only builds an index of where each key and value is in the file, in
+ * one flat allocation, so nothing is copied.  Each lookup is then one hash
+ * probe, and a value is only decoded when it is asked for.  The index points
+ * into the parsed text, which must therefore stay valid (e.g. by not calling
+ * cfgpath_view_release()) until cfgpath_conf_free() is called.
+ *
+ * Section and key names are case sensitive.  If a key appears more than once
+ * in a section, the last value is used.
+ */
+
+#ifndef CFGPATH_CONF_H_
+#define CFGPATH_CONF_H_
+
+#include "cfgpath.h"
+
+#include <stdint.h>
+
+/** Location of one key and its value in the parsed text. */
+struct cfgpath_conf_entry {
+	uint32_t hash;         /**< Hash of section and key */
+	uint32_t section;      /**< Offset of section name */
+	uint32_t key;          /**< Offset of key name */
+	uint32_t value;        /**< Offset of raw value */
+	uint16_t section_len;  /**< Length of section name */
+	uint16_t key_len;      /**< Length of key name */
+	uint32_t value_len;    /**< Length of raw value */
+};
+
+/** Index of a parsed file, see cfgpath_conf_parse(). */
+struct cfgpath_conf {
+	const char *data;                  /**< Text that was parsed */
+	struct cfgpath_conf_entry *entry;  /**< Keys in the order they appear */
+	unsigned int count;                /**< Number of entries */
+	uint32_t *slot;                    /**< Hash table, entry index + 1 or 0 */
+	uint32_t mask;                     /**< Number of slots - 1 */
+};
+
+/* FNV-1a over the section, a separator that can't appear in a name, and key */
+static inline uint32_t cfgpath_conf_hash(const char *section,
+	unsigned int section_len, const char *key, unsigned int key_len)
+{
+	uint32_t h = 2166136261u;
+	unsigned int i;
+	for (i = 0; i < section_len; i++) h = (h ^ (unsigned char)section[i]) * 16777619u;
+	h = (h ^ ']') * 16777619u;
+	for (i = 0; i < key_len; i++) h = (h ^ (unsigned char)key[i]) * 16777619u;
+	return h;
+}
+
+static inline int cfgpath_conf_space(char c)
+{
+	return (c == ' ') || (c == '\t') || (c == '\r');
+}
+
+/* Find the slot for a key, which is either empty or holds that key */
+static inline uint32_t *cfgpath_conf_slot(const struct cfgpath_conf *conf,
+	uint32_t hash, const char *section, unsigned int section_len,
+	const char *key, unsigned int key_len)
+{
+	uint32_t i = hash & conf->mask;
+	for (;;) {
+		uint32_t *slot = &conf->slot[i];
+		if (*slot == 0) return slot;
+		const struct cfgpath_conf_entry *e = &conf->entry[*slot - 1];
+		if ((e->hash == hash)
+			&& (e->section_len == section_len) && (e->key_len == key_len)
+			&& (memcmp(conf->data + e->key, key, key_len) == 0)
+			&& (memcmp(conf->data + e->section, section, section_len) == 0)
+		) {
+			return slot;
+		}
+		i = (i + 1) & conf->mask;
+	}
+}
+
+/** Index the keys in a .conf or .ini file.
+ *
+ * @param conf
+ *   Set to the index.  Must be passed to cfgpath_conf_free() afterwards, even
+ *   if there were no keys.
+ *
+ * @param data
+ *   Text of the file, which need not be null terminated.  It is not copied, so
+ *   must stay valid until cfgpath_conf_free() is called.
+ *
+ * @param len
+ *   Length of data.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOMEM, or EFBIG if the
+ *   file is 4GB or larger).  Lines that can't be understood are skipped rather
+ *   than being treated as errors.
+ */
+static inline int cfgpath_conf_parse(struct cfgpath_conf *conf,
+	const char *data, size_t len)
+{
+	conf->data = data;
+	conf->entry = NULL;
+	conf->count = 0;
+	conf->slot = NULL;
+	conf->mask = 0;
+	if (len >= UINT32_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	/* Every key has an '=', so counting them sizes the index in one go */
+	size_t max = 0, i;
+	for (i = 0; i < len; i++) if (data[i] == '=') max++;
+	if (max == 0) return 0;
+	uint32_t slots = 8;
+	while (slots < max * 2) slots *= 2;
+	conf->entry = (struct cfgpath_conf_entry *)malloc(
+		max * sizeof(struct cfgpath_conf_entry) + slots * sizeof(uint32_t));
+	if (!conf->entry) {
+		errno = ENOMEM;
+		return -1;
+	}
+	conf->slot = (uint32_t *)(conf->entry + max);
+	conf->mask = slots - 1;
+	memset(conf->slot, 0, slots * sizeof(uint32_t));
+
+	uint32_t section = 0, section_len = 0;
+	size_t pos = 0;
+	while (pos < len) {
+		const char *nl = (const char *)memchr(data + pos, '\n', len - pos);
+		size_t end = nl ? (size_t)(nl - data) : len;
+		size_t next = end + 1;
+		while ((pos < end) && cfgpath_conf_space(data[pos])) pos++;
+		while ((end > pos) && cfgpath_conf_space(data[end - 1])) end--;
+		if ((pos == end) || (data[pos] == '#') || (data[pos] == ';')) {
+			/* Blank line or comment */
+		} else if (data[pos] == '[') {
+			const char *close = (const char *)memchr(data + pos, ']', end - pos);
+			if (close) {
+				size_t s = pos + 1, e = close - data;
+				while ((s < e) && cfgpath_conf_space(data[s])) s++;
+				while ((e > s) && cfgpath_conf_space(data[e - 1])) e--;
+				if (e - s <= UINT16_MAX) {
+					section = s;
+					section_len = e - s;
+				}
+			}
+		} else {
+			const char *eq = (const char *)memchr(data + pos, '=', end - pos);
+			if (eq) {
+				size_t key_end = eq - data, value = key_end + 1;
+				while ((key_end > pos) && cfgpath_conf_space(data[key_end - 1])) key_end--;
+				while ((value < end) && cfgpath_conf_space(data[value])) value++;
+				if ((key_end > pos) && (key_end - pos <= UINT16_MAX)) {
+					struct cfgpath_conf_entry *e = &conf->entry[conf->count];
+					e->hash = cfgpath_conf_hash(data + section, section_len,
+						data + pos, key_end - pos);
+					e->section = section;
+					e->section_len = section_len;
+					e->key = pos;
+					e->key_len = key_end - pos;
+					e->value = value;
+					e->value_len = end - value;
+					/* A repeated key replaces the earlier one */
+					*cfgpath_conf_slot(conf, e->hash, data + section, section_len,
+						data + pos, key_end - pos) = ++conf->count;
+				}
+			}
+		}
+		pos = next;
+	}
+	return 0;
+}
+
+/** Free the index created by cfgpath_conf_parse().
+ *
+ * @post The text that was parsed may be released.
+ */
+static inline void cfgpath_conf_free(struct cfgpath_conf *conf)
+{
+	free(conf->entry);
+	conf->entry = NULL;
+	conf->count = 0;
+	conf->slot = NULL;
+	conf->mask = 0;
+}
+
+/** Find a key.
+ *
+ * @param conf
+ *   Index from cfgpath_conf_parse().
+ *
+ * @param section
+ *   Section name, or NULL or "" for keys before the first section.
+ *
+ * @param key
+ *   Key name.
+ *
+ * @return The key's entry, or NULL if it is not in the file.
+ */
+static inline const struct cfgpath_conf_entry *cfgpath_conf_find(
+	const struct cfgpath_conf *conf, const char *section, const char *key)
+{
+	if (conf->count == 0) return NULL;
+	if (!section) section = "";
+	unsigned int section_len = strlen(section), key_len = strlen(key);
+	uint32_t hash = cfgpath_conf_hash(section, section_len, key, key_len);
+	uint32_t *slot = cfgpath_conf_slot(conf, hash, section, section_len, key,
+		key_len);
+	return *slot ? &conf->entry[*slot - 1] : NULL;
+}
+
+/** Get a value without decoding it.
+ *
+ * @param conf
+ *   Index from cfgpath_conf_parse().
+ *
+ * @param entry
+ *   Key from cfgpath_conf_find().
+ *
+ * @param len
+ *   Set to the length of the value.
+ *
+ * @return Pointer to the value within the parsed text, exactly as it appears
+ *   there (e.g. still with any quotes.)  It is not null terminated.
+ */
+static inline const char *cfgpath_conf_raw(const struct cfgpath_conf *conf,
+	const struct cfgpath_conf_entry *entry, unsigned int *len)
+{
+	*len = entry->value_len;
+	return conf->data + entry->value;
+}
+
+/** Decode a value.
+ *
+ * A value in double quotes has the quotes removed and the escapes \", \\, \n
+ * and \t replaced.  Any other value is used as is.
+ *
+ * @param conf
+ *   Index from cfgpath_conf_parse().
+ *
+ * @param entry
+ *   Key from cfgpath_conf_find().
+ *
+ * @param out
+ *   Buffer to write the value into, or NULL if maxlen is 0.
+ *
+ * @param maxlen
+ *   Length of out.
+ *
+ * @return Length of the decoded value.  As with snprintf(), if this is
+ *   maxlen or more the value did not fit and out is set to an empty string.
+ */
+static inline int cfgpath_conf_value(const struct cfgpath_conf *conf,
+	const struct cfgpath_conf_entry *entry, char *out, unsigned int maxlen)
+{
+	const char *raw = conf->data + entry->value;
+	uint32_t raw_len = entry->value_len, i;
+	int len = 0;
+	if ((raw_len < 2) || (raw[0] != '"') || (raw[raw_len - 1] != '"')) {
+		if (raw_len < maxlen) {
+			memcpy(out, raw, raw_len);
+			out[raw_len] = 0;
+		} else if (maxlen) {
+			out[0] = 0;
+		}
+		return raw_len;
+	}
+	for (i = 1; i < raw_len - 1; i++) {
+		char c = raw[i];
+		if ((c == '\\') && (i + 1 < raw_len - 1)) {
+			c = raw[++i];
+			if (c == 'n') c = '\n';
+			else if (c == 't') c = '\t';
+		}
+		if ((unsigned int)len + 1 < maxlen) out[len] = c;
+		len++;
+	}
+	if ((unsigned int)len < maxlen) {
+		out[len] = 0;
+	} else if (maxlen) {
+		out[0] = 0;
+	}
+	return len;
+}
+
+/** Look up and decode a value.
+ *
+ * This is cfgpath_conf_find() followed by cfgpath_conf_value().
+ *
+ * @return Length of the value as for cfgpath_conf_value(), or
+ *   CFGPATH_ERR_NOTFOUND if the key is not in the file, in which case out is
+ *   set to an empty string.
+ */
+static inline int cfgpath_conf_get(const struct cfgpath_conf *conf,
+	const char *section, const char *key, char *out, unsigned int maxlen)
+{
+	const struct cfgpath_conf_entry *entry = cfgpath_conf_find(conf, section, key);
+	if (!entry) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_NOTFOUND;
+	}
+	return cfgpath_conf_value(conf, entry, out, maxlen);
+}
+
+/** Look up a value as a number.
+ *
+ * Decimal, hex (0x) and octal (leading 0) values are accepted.
+ *
+ * @param def
+ *   Value to return if the key is not in the file or is not a number.
+ *
+ * @return The value, or def.
+ */
+static inline long cfgpath_conf_get_long(const struct cfgpath_conf *conf,
+	const char *section, const char *key, long def)
+{
+	char buf[32], *end;
+	int len = cfgpath_conf_get(conf, section, key, buf, sizeof(buf));
+	if ((len <= 0) || (len >= (int)sizeof(buf))) return def;
+	errno = 0;
+	long value = strtol(buf, &end, 0);
+	if ((*end != 0) || (errno != 0)) return def;
+	return value;
+}
+
+#endif /* CFGPATH_CONF_H_ */
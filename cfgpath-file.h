@@ -0,0 +1,614 @@
+/**
+ * @file  cfgpath-file.h
+ * @brief Read the files found by cfgpath.h without copying them.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use:
+ *
+ * char small[4096];
+ * struct cfgpath_view view;
+ * if (cfgpath_map_config_file("myapp", &view, small, sizeof(small)) == 0) {
+ *     parse(view.data, view.len);
+ *     cfgpath_view_release(&view);
+ * }
+ *
+ * Large files are mapped into memory read-only, so they are never copied.
+ * Files that fit in the caller's buffer are read into it with a single read()
+ * instead, as for a few kilobytes setting up a mapping costs more than the
+ * copy it saves.
+ */
+
+#ifndef CFGPATH_FILE_H_
+#define CFGPATH_FILE_H_
+
+#include "cfgpath.h"
+
+#include <stdio.h>
+#ifdef CFGPATH_LINUX
+#include <sys/mman.h>
+#endif
+
+/* O_TMPFILE is only declared with _GNU_SOURCE, but glibc always has the value */
+#if defined(O_TMPFILE)
+#define CFGPATH_O_TMPFILE O_TMPFILE
+#elif defined(__O_TMPFILE)
+#define CFGPATH_O_TMPFILE __O_TMPFILE
+#endif
+
+/* sync_file_range() is also only declared with _GNU_SOURCE, so without it the
+ * system call is made directly where the offsets fit in one register.
+ * SYNC_FILE_RANGE_WRITE is 2. */
+#if defined(SYNC_FILE_RANGE_WRITE)
+#define CFGPATH_SYNC_FILE_RANGE(fd) sync_file_range((fd), 0, 0, SYNC_FILE_RANGE_WRITE)
+#elif defined(__linux__) && defined(__LP64__)
+#include <sys/syscall.h>
+#ifdef SYS_sync_file_range
+#define CFGPATH_SYNC_FILE_RANGE(fd) syscall(SYS_sync_file_range, (fd), 0L, 0L, 2U)
+#endif
+#endif
+
+/** The contents of a file, see cfgpath_map_file(). */
+struct cfgpath_view {
+	const char *data;  /**< Contents of the file, not null terminated */
+	size_t len;        /**< Length of data in bytes */
+	void *map;         /**< Mapping or heap block to release, or NULL */
+	size_t map_len;    /**< Length of map */
+};
+
+#ifdef CFGPATH_LINUX
+/* Read or map an open file, see cfgpath_map_file().  The caller closes fd. */
+static inline int cfgpath_map_fd(int fd, struct cfgpath_view *view, char *buf,
+	size_t buflen)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0) return -1;
+	if (!S_ISREG(st.st_mode)) {
+		errno = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+		return -1;
+	}
+	size_t size = st.st_size;
+	if (buf && (size < buflen)) {
+		/* Ask for the whole buffer, to notice if the file has grown */
+		size_t got = 0;
+		for (;;) {
+			ssize_t n = read(fd, buf + got, buflen - got);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				return -1;
+			}
+			if (n == 0) break;
+			got += n;
+			if (got == buflen) break;
+		}
+		if (got < buflen) {
+			view->data = buf;
+			view->len = got;
+			return 0;
+		}
+		/* Grew past the buffer since fstat(), so map it after all */
+		if (fstat(fd, &st) != 0) return -1;
+		size = st.st_size;
+	}
+	if (size == 0) {
+		/* mmap() can't map nothing */
+		view->data = "";
+		return 0;
+	}
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return -1;
+	madvise(map, size, MADV_SEQUENTIAL);
+	view->data = (const char *)map;
+	view->len = size;
+	view->map = map;
+	view->map_len = size;
+	return 0;
+}
+#endif
+
+/** Get the contents of a file, without copying it if possible.
+ *
+ * If the file fits in buf it is read into it, otherwise it is mapped into
+ * memory read-only.  Either way view->data and view->len describe the
+ * contents, which stay valid until cfgpath_view_release() is called.
+ *
+ * If the file is truncated by another process while it is mapped, accessing
+ * the missing part will raise SIGBUS.  Files should therefore be replaced
+ * (e.g. with cfgpath_write_begin() and cfgpath_write_commit()) rather than
+ * being rewritten in place.
+ *
+ * On platforms without mmap() the file is read into a heap block instead.
+ *
+ * @param path
+ *   File to read.
+ *
+ * @param view
+ *   Set to the contents of the file.
+ *
+ * @param buf
+ *   Buffer for small files, or NULL to always map the file.
+ *
+ * @param buflen
+ *   Length of buf.
+ *
+ * @return 0 on success, or -1 on error with errno set (e.g. ENOENT if the file
+ *   does not exist).
+ */
+static inline int cfgpath_map_file(const char *path, struct cfgpath_view *view,
+	char *buf, size_t buflen)
+{
+	view->data = NULL;
+	view->len = 0;
+	view->map = NULL;
+	view->map_len = 0;
+#ifdef CFGPATH_LINUX
+	int fd = cfgpath_fs_openat(AT_FDCWD, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	int ret = cfgpath_map_fd(fd, view, buf, buflen);
+	int err = errno;
+	close(fd);
+	errno = err;
+	return ret;
+#else
+	FILE *f = fopen(path, "rb");
+	if (!f) return -1;
+	if (buf) {
+		size_t got = fread(buf, 1, buflen, f);
+		if (got < buflen) {
+			fclose(f);
+			view->data = buf;
+			view->len = got;
+			return 0;
+		}
+		rewind(f);
+	}
+	size_t cap = buflen ? buflen * 2 : 65536, got = 0;
+	char *data = NULL;
+	for (;;) {
+		char *grown = (char *)realloc(data, cap);
+		if (!grown) {
+			free(data);
+			fclose(f);
+			errno = ENOMEM;
+			return -1;
+		}
+		data = grown;
+		got += fread(data + got, 1, cap - got, f);
+		if (got < cap) break;
+		cap *= 2;
+	}
+	fclose(f);
+	view->data = data;
+	view->len = got;
+	view->map = data;
+	view->map_len = cap;
+	return 0;
+#endif
+}
+
+/** Release the contents of a file returned by cfgpath_map_file().
+ *
+ * @post view->data is no longer valid, unless it pointed to the caller's
+ *   buffer.
+ */
+static inline void cfgpath_view_release(struct cfgpath_view *view)
+{
+	if (view->map) {
+#ifdef CFGPATH_LINUX
+		munmap(view->map, view->map_len);
+#else
+		free(view->map);
+#endif
+	}
+	view->data = NULL;
+	view->len = 0;
+	view->map = NULL;
+	view->map_len = 0;
+}
+
+/** Get the contents of the user's configuration file for an application.
+ *
+ * This reads the file named by get_user_config_file(), as cfgpath_map_file().
+ * No folders are created, as there is nothing to read if they don't exist.
+ *
+ * @param appname
+ *   Short name of the application, as for get_user_config_file().
+ *
+ * See cfgpath_map_file() for the other parameters and the return value.
+ * errno is set to ENOENT if the user's home folder cannot be found.
+ */
+static inline int cfgpath_map_config_file(const char *appname,
+	struct cfgpath_view *view, char *buf, size_t buflen)
+{
+	char stack_path[MAX_PATH];
+	char *path = stack_path;
+	view->data = NULL;
+	view->len = 0;
+	view->map = NULL;
+	view->map_len = 0;
+	int len = cfgpath_get_ex(CFGPATH_CONFIG_FILE, path, sizeof(stack_path),
+		appname, CFGPATH_CREATE_NONE);
+	if (len >= (int)sizeof(stack_path)) {
+		path = (char *)malloc(len + 1);
+		if (!path) return -1;
+		cfgpath_get_ex(CFGPATH_CONFIG_FILE, path, len + 1, appname,
+			CFGPATH_CREATE_NONE);
+	}
+	int ret;
+	if (len <= 0) {
+		errno = ENOENT;
+		ret = -1;
+	} else {
+		ret = cfgpath_map_file(path, view, buf, buflen);
+	}
+	if (path != stack_path) {
+		int err = errno;
+		free(path);
+		errno = err;
+	}
+	return ret;
+}
+
+/** A file being replaced, see cfgpath_write_begin(). */
+struct cfgpath_writer {
+	int fd;             /**< Write the new contents to this */
+	int dir_fd;         /* Folder the file is going into */
+	int anonymous;      /* Opened with O_TMPFILE, so not yet in the folder */
+	char *name;         /* Final name, followed by space for a temporary one */
+	char *tmp_name;
+};
+
+#ifdef CFGPATH_LINUX
+/* Pick an unused temporary name next to the file, e.g. ".myapp.conf.3f9a2c".
+ * With a mode given the file is created, otherwise the name is only checked. */
+static inline int cfgpath_write_tmp_name(struct cfgpath_writer *w, mode_t mode)
+{
+	static unsigned int counter;
+	unsigned int attempt;
+	/* tmp_name follows name in the same allocation, so build it by hand */
+	size_t len = w->tmp_name - w->name - 1;
+	w->tmp_name[0] = '.';
+	memcpy(w->tmp_name + 1, w->name, len);
+	for (attempt = 0; attempt < 100; attempt++) {
+		unsigned int n = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+		n = (n * 2654435761u) ^ (unsigned int)getpid() ^ (unsigned int)time(NULL);
+		snprintf(w->tmp_name + 1 + len, 8, ".%06x", n & 0xFFFFFF);
+		if (mode) {
+			int fd = openat(w->dir_fd, w->tmp_name,
+				O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+			if (fd >= 0) return fd;
+		} else {
+			struct stat st;
+			if (fstatat(w->dir_fd, w->tmp_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+				if (errno == ENOENT) return 0;
+				return -1;
+			}
+			errno = EEXIST;
+		}
+		if (errno != EEXIST) return -1;
+	}
+	return -1;
+}
+
+/* Give the new file its final name, replacing any old file. */
+static inline int cfgpath_write_publish(struct cfgpath_writer *w)
+{
+	if (!w->anonymous) return renameat(w->dir_fd, w->tmp_name, w->dir_fd, w->name);
+
+	char proc[32];
+	sprintf(proc, "/proc/self/fd/%d", w->fd);
+	if (linkat(AT_FDCWD, proc, w->dir_fd, w->name, AT_SYMLINK_FOLLOW) == 0) return 0;
+	if (errno != EEXIST) return -1;
+	/* linkat() won't replace a file, so link it alongside and rename it over */
+	for (;;) {
+		if (cfgpath_write_tmp_name(w, 0) != 0) return -1;
+		if (linkat(AT_FDCWD, proc, w->dir_fd, w->tmp_name, AT_SYMLINK_FOLLOW) == 0) break;
+		if (errno != EEXIST) return -1;
+	}
+	if (renameat(w->dir_fd, w->tmp_name, w->dir_fd, w->name) != 0) {
+		int err = errno;
+		unlinkat(w->dir_fd, w->tmp_name, 0);
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
+
+/* Give the new file the owner and permissions of the file it replaces.  Only
+ * root can give a file away, so failing to change the owner is not an error. */
+static inline int cfgpath_write_keep_mode(int fd, const struct stat *st)
+{
+	if ((fchown(fd, st->st_uid, st->st_gid) != 0) && (errno == EPERM)) {
+		/* The group can still be kept if we are a member of it */
+		if ((fchown(fd, (uid_t)-1, st->st_gid) != 0) && (errno != EPERM)) return -1;
+	}
+	return fchmod(fd, st->st_mode & 07777);
+}
+
+/* Close everything, removing the temporary file unless it was renamed. */
+static inline void cfgpath_write_close(struct cfgpath_writer *w, int committed)
+{
+	if (w->fd >= 0) close(w->fd);
+	if (!committed && !w->anonymous && w->name && w->tmp_name[0]) {
+		unlinkat(w->dir_fd, w->tmp_name, 0);
+	}
+	if (w->dir_fd >= 0) close(w->dir_fd);
+	free(w->name);
+	w->fd = -1;
+	w->dir_fd = -1;
+	w->name = NULL;
+	w->tmp_name = NULL;
+}
+#endif
+
+/** Start replacing a file, so that it is never seen half written.
+ *
+ * The new contents are written to a file with no name (using O_TMPFILE) or a
+ * hidden temporary name, which only replaces the old file when
+ * cfgpath_write_commit() is called.  Until then, and if the program crashes,
+ * the old file is left untouched.  The folder is created if needed, so this
+ * works with paths from cfgpath_get_ex() and CFGPATH_CREATE_LAZY.  Any folders
+ * created are synced into their parents, so they survive a crash along with
+ * the committed file.
+ *
+ * Example use:
+ *
+ * struct cfgpath_writer w;
+ * if (cfgpath_write_begin(&w, path) == 0) {
+ *     if (cfgpath_write(&w, text, len) == 0) {
+ *         cfgpath_write_commit(&w);
+ *     } else {
+ *         cfgpath_write_abort(&w);
+ *     }
+ * }
+ *
+ * This is currently only implemented for Linux and BSD.
+ *
+ * @param w
+ *   Set up for writing.  New contents can be written to w->fd or with
+ *   cfgpath_write().  Must be passed to cfgpath_write_commit() or
+ *   cfgpath_write_abort() afterwards.
+ *
+ * @param path
+ *   File to replace.  It does not need to exist yet.  If it does, the new
+ *   file keeps its permissions, and its owner and group where allowed.
+ *   Otherwise it is created with the same permissions fopen() would use.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOSYS on other
+ *   platforms).
+ */
+static inline int cfgpath_write_begin(struct cfgpath_writer *w, const char *path)
+{
+	w->fd = -1;
+	w->dir_fd = -1;
+	w->anonymous = 0;
+	w->name = NULL;
+	w->tmp_name = NULL;
+#ifdef CFGPATH_LINUX
+	const char *slash = strrchr(path, '/');
+	const char *base = slash ? slash + 1 : path;
+	size_t base_len = strlen(base);
+	if (base_len == 0) {
+		errno = EISDIR;
+		return -1;
+	}
+	/* The temporary name is '.', the name, '.' and six hex digits */
+	w->name = (char *)malloc(base_len * 2 + 10);
+	if (!w->name) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(w->name, base, base_len + 1);
+	w->tmp_name = w->name + base_len + 1;
+	w->tmp_name[0] = 0;
+
+	char stack_dir[MAX_PATH];
+	char *dir = stack_dir;
+	size_t dir_len = slash ? (size_t)(slash - path) : 0;
+	if (dir_len + 2 > sizeof(stack_dir)) {
+		dir = (char *)malloc(dir_len + 2);
+		if (!dir) {
+			cfgpath_write_close(w, 0);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	if (!slash) {
+		strcpy(dir, ".");
+	} else if (dir_len == 0) {
+		strcpy(dir, "/");
+	} else {
+		memcpy(dir, path, dir_len);
+		dir[dir_len] = 0;
+	}
+	int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+	w->dir_fd = cfgpath_fs_openat(AT_FDCWD, dir, flags);
+	/* Folders created here are synced into their parents, as the commit only
+	 * syncs the folder the file goes into */
+	if ((w->dir_fd < 0) && (errno == ENOENT)
+		&& (cfgpath_mkdir_p_ex(dir, strlen(dir), 0755, 1) == 0)
+	) {
+		w->dir_fd = cfgpath_fs_openat(AT_FDCWD, dir, flags);
+	}
+	if (dir != stack_dir) {
+		int err = errno;
+		free(dir);
+		errno = err;
+	}
+	if (w->dir_fd < 0) {
+		cfgpath_write_close(w, 0);
+		return -1;
+	}
+
+	/* Until its permissions are copied over, only we can read a replacement */
+	struct stat old;
+	int replacing = (fstatat(w->dir_fd, w->name, &old, 0) == 0) && S_ISREG(old.st_mode);
+	mode_t mode = replacing ? 0600 : 0666;
+
+#ifdef CFGPATH_O_TMPFILE
+	/* Only worth using if it can be given a name through /proc later.  If the
+	 * filesystem doesn't support it, it fails with EOPNOTSUPP or EISDIR. */
+	static int have_proc = -1;
+	if (have_proc < 0) have_proc = (access("/proc/self/fd", X_OK) == 0);
+	if (have_proc) {
+		w->fd = openat(w->dir_fd, ".", CFGPATH_O_TMPFILE | O_WRONLY | O_CLOEXEC,
+			mode);
+		if (w->fd >= 0) w->anonymous = 1;
+	}
+	if (!w->anonymous)
+#endif
+	{
+		w->fd = cfgpath_write_tmp_name(w, mode);
+		if (w->fd < 0) {
+			int err = errno;
+			w->tmp_name[0] = 0;  /* Not created, so nothing to remove */
+			cfgpath_write_close(w, 0);
+			errno = err;
+			return -1;
+		}
+	}
+	if (replacing && (cfgpath_write_keep_mode(w->fd, &old) != 0)) {
+		int err = errno;
+		cfgpath_write_close(w, 0);
+		errno = err;
+		return -1;
+	}
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Write some of the new contents of a file.
+ *
+ * @return 0 if everything was written, or -1 on error with errno set.
+ */
+static inline int cfgpath_write(struct cfgpath_writer *w, const void *data,
+	size_t len)
+{
+#ifdef CFGPATH_LINUX
+	const char *p = (const char *)data;
+	while (len) {
+		ssize_t n = write(w->fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Abandon the new contents of a file, leaving the old file untouched. */
+static inline void cfgpath_write_abort(struct cfgpath_writer *w)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_write_close(w, 0);
+#endif
+}
+
+/** Replace several files at once, safely and with as few waits as possible.
+ *
+ * Replacing a file safely means waiting for its contents to reach the disk
+ * before renaming it over the old file, and then waiting for the rename to
+ * reach the disk as well.  Doing this for one file after another waits twice
+ * per file.  Here the contents of every file are sent to the disk together,
+ * so the filesystem can commit them all in one go, then all the files are
+ * renamed and each folder is synced only once.
+ *
+ * @param w
+ *   Array of files started with cfgpath_write_begin().
+ *
+ * @param count
+ *   Number of files in the array.
+ *
+ * @return 0 if every file was replaced, or -1 on error with errno set.  If any
+ *   contents could not be written out, no files are replaced.  If renaming a
+ *   file fails, the ones before it have already been replaced and the rest
+ *   are abandoned.
+ *
+ * @post Every writer has been committed or abandoned, and must not be used
+ *   again.
+ */
+static inline int cfgpath_write_commit_batch(struct cfgpath_writer *w,
+	unsigned int count)
+{
+#ifdef CFGPATH_LINUX
+	unsigned int i, j;
+	int ret = 0, err = 0;
+#ifdef CFGPATH_SYNC_FILE_RANGE
+	/* Start writing every file out, so that the waits below overlap */
+	for (i = 0; i < count; i++) CFGPATH_SYNC_FILE_RANGE(w[i].fd);
+#endif
+	for (i = 0; i < count; i++) {
+		if (fdatasync(w[i].fd) != 0) {
+			err = errno;
+			for (j = 0; j < count; j++) cfgpath_write_close(&w[j], 0);
+			errno = err;
+			return -1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (cfgpath_write_publish(&w[i]) != 0) {
+			err = errno;
+			ret = -1;
+			for (j = i; j < count; j++) cfgpath_write_close(&w[j], 0);
+			/* The folder sync below still covers the files already renamed */
+			count = i;
+			break;
+		}
+	}
+	/* Sync each folder once, however many files went into it */
+	for (i = 0; i < count; i++) {
+		struct stat st;
+		int seen = 0;
+		if (fstat(w[i].dir_fd, &st) == 0) {
+			for (j = 0; j < i; j++) {
+				struct stat prev;
+				if ((fstat(w[j].dir_fd, &prev) == 0) && (prev.st_dev == st.st_dev)
+					&& (prev.st_ino == st.st_ino)
+				) {
+					seen = 1;
+					break;
+				}
+			}
+		}
+		if (!seen && (fsync(w[i].dir_fd) != 0) && (ret == 0)) {
+			err = errno;
+			ret = -1;
+		}
+	}
+	for (i = 0; i < count; i++) cfgpath_write_close(&w[i], 1);
+	errno = err;
+	return ret;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/** Replace a file with the new contents.
+ *
+ * This is cfgpath_write_commit_batch() for a single file.  When saving many
+ * files at once, use that instead so the waits for the disk are shared.
+ *
+ * @return 0 on success, or -1 on error with errno set, in which case the old
+ *   file is left untouched.
+ *
+ * @post w has been committed or abandoned, and must not be used again.
+ */
+static inline int cfgpath_write_commit(struct cfgpath_writer *w)
+{
+	return cfgpath_write_commit_batch(w, 1);
+}
+
+#endif /* CFGPATH_FILE_H_ */
@@ -0,0 +1,815 @@
+/**
+ * @file  cfgpath-lru.h
+ * @brief Keep the folder from get_user_cache_folder() within a size limit,
+ *        removing the least recently used files first.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use:
+ *
+ * static struct cfgpath_lru cache;
+ * cfgpath_lru_open_app(&cache, "myapp", 500 * 1024 * 1024, 100000);
+ *
+ * // After writing a file into the cache folder
+ * cfgpath_lru_insert(&cache, "thumbs/1234.png", size);
+ *
+ * // After reading a file from it
+ * cfgpath_lru_touch(&cache, "thumbs/1234.png");
+ *
+ * cfgpath_lru_close(&cache);
+ *
+ * The program tells the cache about each file it adds and uses, so the folder
+ * never needs to be scanned, however many files it holds.  This is recorded in
+ * an index file in the folder, which is only appended to, except when it has
+ * grown well beyond the number of files and is rewritten to shrink it.  Uses
+ * are only recorded in the index once every CFGPATH_LRU_TOUCH_SECS, so reading
+ * the same file often costs nothing.  The folder is only scanned if the index
+ * is missing or damaged.
+ *
+ * When an insert takes the folder over either limit, the least recently used
+ * files are removed on a background thread until it is back under 90% of both
+ * limits.
+ *
+ * Only one process can use a cache folder at a time.  This is only available
+ * under Linux.
+ */
+
+#ifndef CFGPATH_LRU_H_
+#define CFGPATH_LRU_H_
+
+#include "cfgpath-file.h"
+#include <stdint.h>
+
+#ifdef CFGPATH_LINUX
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/file.h>
+#endif
+
+/* How often the use of a file is written to the index, in seconds. */
+#ifndef CFGPATH_LRU_TOUCH_SECS
+#define CFGPATH_LRU_TOUCH_SECS 60
+#endif
+
+/* Name of the index file in the cache folder. */
+#define CFGPATH_LRU_INDEX ".cfgpath-lru"
+
+#define CFGPATH_LRU_MAGIC "CFGLRU1\n"
+#define CFGPATH_LRU_NONE UINT32_MAX
+
+/* Index operations, see struct cfgpath_lru_record */
+#define CFGPATH_LRU_OP_SET 1
+#define CFGPATH_LRU_OP_REMOVE 2
+
+/* One entry in the index file, followed by the name.  The file starts with
+ * CFGPATH_LRU_MAGIC, then has one of these for each change, oldest first. */
+struct cfgpath_lru_record {
+	uint32_t op;
+	uint32_t name_len;
+	uint64_t size;
+	int64_t atime;
+};
+
+struct cfgpath_lru_entry {
+	char *name;              /* Relative to the cache folder, or NULL if free */
+	uint64_t size;
+	int64_t atime;           /* Last used, in seconds since 1970 */
+	int64_t logged;          /* atime last written to the index */
+	uint32_t hash;
+	uint32_t hash_next;      /* Next entry in the same hash bucket */
+	uint32_t prev, next;     /* Neighbours in least to most recently used order */
+};
+
+/** A cache folder, see cfgpath_lru_open(). */
+struct cfgpath_lru {
+#ifdef CFGPATH_LINUX
+	pthread_mutex_t lock;
+#endif
+	char *folder;
+	int dir_fd;                      /* folder, locked with flock() */
+	int log_fd;                      /* Index file, opened for appending */
+	uint64_t max_bytes;
+	uint64_t max_entries;
+	uint64_t bytes;                  /* Total size of the files */
+	uint64_t count;                  /* Number of files */
+	uint64_t records;                /* Records in the index file */
+	struct cfgpath_lru_entry *entry;
+	uint32_t entry_size;             /* Allocated length of entry */
+	uint32_t free_list;              /* Unused entries, linked by next */
+	uint32_t oldest, newest;
+	uint32_t *bucket;
+	uint32_t bucket_mask;
+	int evict_queued;                /* Background eviction is pending */
+	int compacting;                  /* The index is being rewritten */
+	char *pending;                   /* Records logged while compacting */
+	size_t pending_len, pending_size;
+	uint64_t pending_records;        /* Records in pending, or UINT64_MAX if
+	                                    one could not be kept */
+};
+
+#ifdef CFGPATH_LINUX
+static inline uint32_t cfgpath_lru_hash(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+	for (i = 0; i < len; i++) h = (h ^ (unsigned char)name[i]) * 16777619u;
+	return h;
+}
+
+static inline struct cfgpath_lru_entry *cfgpath_lru_find(struct cfgpath_lru *c,
+	const char *name, size_t len, uint32_t hash)
+{
+	uint32_t i = c->bucket[hash & c->bucket_mask];
+	while (i != CFGPATH_LRU_NONE) {
+		struct cfgpath_lru_entry *e = &c->entry[i];
+		if ((e->hash == hash) && !strncmp(e->name, name, len) && !e->name[len]) {
+			return e;
+		}
+		i = e->hash_next;
+	}
+	return NULL;
+}
+
+/* Take an entry out of the least to most recently used list. */
+static inline void cfgpath_lru_unlink(struct cfgpath_lru *c, uint32_t i)
+{
+	struct cfgpath_lru_entry *e = &c->entry[i];
+	if (e->prev != CFGPATH_LRU_NONE) c->entry[e->prev].next = e->next;
+	else c->oldest = e->next;
+	if (e->next != CFGPATH_LRU_NONE) c->entry[e->next].prev = e->prev;
+	else c->newest = e->prev;
+}
+
+/* Put an entry at the most recently used end of the list. */
+static inline void cfgpath_lru_append(struct cfgpath_lru *c, uint32_t i)
+{
+	struct cfgpath_lru_entry *e = &c->entry[i];
+	e->prev = c->newest;
+	e->next = CFGPATH_LRU_NONE;
+	if (c->newest != CFGPATH_LRU_NONE) c->entry[c->newest].next = i;
+	else c->oldest = i;
+	c->newest = i;
+}
+
+/* Double the number of hash buckets. */
+static inline int cfgpath_lru_rehash(struct cfgpath_lru *c)
+{
+	uint32_t buckets = c->bucket_mask ? (c->bucket_mask + 1) * 2 : 1024;
+	uint32_t *bucket = (uint32_t *)malloc(buckets * sizeof(uint32_t));
+	if (!bucket) return -1;
+	memset(bucket, 0xFF, buckets * sizeof(uint32_t));
+	uint32_t i;
+	for (i = 0; i < c->entry_size; i++) {
+		struct cfgpath_lru_entry *e = &c->entry[i];
+		if (!e->name) continue;
+		e->hash_next = bucket[e->hash & (buckets - 1)];
+		bucket[e->hash & (buckets - 1)] = i;
+	}
+	free(c->bucket);
+	c->bucket = bucket;
+	c->bucket_mask = buckets - 1;
+	return 0;
+}
+
+/* Add or update an entry in memory, making it the most recently used. */
+static inline struct cfgpath_lru_entry *cfgpath_lru_set(struct cfgpath_lru *c,
+	const char *name, size_t len, uint64_t size, int64_t atime)
+{
+	uint32_t hash = cfgpath_lru_hash(name, len);
+	struct cfgpath_lru_entry *e = cfgpath_lru_find(c, name, len, hash);
+	uint32_t i;
+	if (e) {
+		i = e - c->entry;
+		c->bytes -= e->size;
+		cfgpath_lru_unlink(c, i);
+	} else {
+		if ((c->count + 1 > c->bucket_mask) && (cfgpath_lru_rehash(c) != 0)) return NULL;
+		if (c->free_list == CFGPATH_LRU_NONE) {
+			uint32_t size = c->entry_size ? c->entry_size * 2 : 1024;
+			struct cfgpath_lru_entry *grown = (struct cfgpath_lru_entry *)realloc(
+				c->entry, size * sizeof(struct cfgpath_lru_entry));
+			if (!grown) return NULL;
+			c->entry = grown;
+			for (i = size; i > c->entry_size; i--) {
+				grown[i - 1].name = NULL;
+				grown[i - 1].next = c->free_list;
+				c->free_list = i - 1;
+			}
+			c->entry_size = size;
+		}
+		i = c->free_list;
+		e = &c->entry[i];
+		e->name = (char *)malloc(len + 1);
+		if (!e->name) return NULL;
+		c->free_list = e->next;
+		memcpy(e->name, name, len);
+		e->name[len] = 0;
+		e->hash = hash;
+		e->hash_next = c->bucket[hash & c->bucket_mask];
+		c->bucket[hash & c->bucket_mask] = i;
+		e->logged = 0;
+		c->count++;
+	}
+	e->size = size;
+	e->atime = atime;
+	c->bytes += size;
+	cfgpath_lru_append(c, i);
+	return e;
+}
+
+/* Remove an entry from memory. */
+static inline void cfgpath_lru_drop(struct cfgpath_lru *c, struct cfgpath_lru_entry *e)
+{
+	uint32_t i = e - c->entry;
+	uint32_t *link = &c->bucket[e->hash & c->bucket_mask];
+	while (*link != i) link = &c->entry[*link].hash_next;
+	*link = e->hash_next;
+	cfgpath_lru_unlink(c, i);
+	c->bytes -= e->size;
+	c->count--;
+	free(e->name);
+	e->name = NULL;
+	e->next = c->free_list;
+	c->free_list = i;
+}
+
+/* Append a change to the index file.  Failing to is not an error, as the
+ * index will be rebuilt if it is found to be damaged. */
+static inline void cfgpath_lru_log(struct cfgpath_lru *c, uint32_t op,
+	const struct cfgpath_lru_entry *e)
+{
+	char buf[sizeof(struct cfgpath_lru_record) + 256];
+	size_t len = strlen(e->name);
+	size_t total = sizeof(struct cfgpath_lru_record) + len;
+	char *p = (total <= sizeof(buf)) ? buf : (char *)malloc(total);
+	if (!p) return;
+	struct cfgpath_lru_record r;
+	r.op = op;
+	r.name_len = len;
+	r.size = e->size;
+	r.atime = e->atime;
+	memcpy(p, &r, sizeof(r));
+	memcpy(p + sizeof(r), e->name, len);
+	/* A single write, so a crash can only leave the last record incomplete */
+	if (write(c->log_fd, p, total) == (ssize_t)total) c->records++;
+	if (c->compacting && (c->pending_records != UINT64_MAX)) {
+		/* Kept to be added to the rewritten index, which won't have it */
+		if (c->pending_len + total > c->pending_size) {
+			size_t size = (c->pending_len + total) * 2;
+			char *grown = (char *)realloc(c->pending, size);
+			if (grown) {
+				c->pending = grown;
+				c->pending_size = size;
+			}
+		}
+		if (c->pending_len + total <= c->pending_size) {
+			memcpy(c->pending + c->pending_len, p, total);
+			c->pending_len += total;
+			c->pending_records++;
+		} else {
+			c->pending_records = UINT64_MAX;
+		}
+	}
+	if (p != buf) free(p);
+}
+
+/* Load the index file.  Returns 0 on success, or -1 if it is missing or
+ * damaged.  An incomplete record at the end (from a crash while appending)
+ * is ignored. */
+static inline int cfgpath_lru_load(struct cfgpath_lru *c)
+{
+	struct cfgpath_view view;
+	memset(&view, 0, sizeof(view));
+	int fd = openat(c->dir_fd, CFGPATH_LRU_INDEX, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return -1;
+	int ret = cfgpath_map_fd(fd, &view, NULL, 0);
+	close(fd);
+	if (ret != 0) return -1;
+	if ((view.len < sizeof(CFGPATH_LRU_MAGIC) - 1)
+		|| memcmp(view.data, CFGPATH_LRU_MAGIC, sizeof(CFGPATH_LRU_MAGIC) - 1)
+	) {
+		cfgpath_view_release(&view);
+		return -1;
+	}
+	size_t pos = sizeof(CFGPATH_LRU_MAGIC) - 1;
+	while (pos + sizeof(struct cfgpath_lru_record) <= view.len) {
+		struct cfgpath_lru_record r;
+		memcpy(&r, view.data + pos, sizeof(r));
+		pos += sizeof(r);
+		if (r.name_len > view.len - pos) break;
+		const char *name = view.data + pos;
+		pos += r.name_len;
+		c->records++;
+		if (r.op == CFGPATH_LRU_OP_SET) {
+			struct cfgpath_lru_entry *e = cfgpath_lru_set(c, name, r.name_len,
+				r.size, r.atime);
+			if (!e) {
+				ret = -1;
+				break;
+			}
+			e->logged = r.atime;
+		} else if (r.op == CFGPATH_LRU_OP_REMOVE) {
+			struct cfgpath_lru_entry *e = cfgpath_lru_find(c, name, r.name_len,
+				cfgpath_lru_hash(name, r.name_len));
+			if (e) cfgpath_lru_drop(c, e);
+		} else {
+			ret = -1;
+			break;
+		}
+	}
+	cfgpath_view_release(&view);
+	return ret;
+}
+
+/* Add every file below a folder, for when there is no usable index.  prefix
+ * is the folder's path relative to the cache folder, e.g. "thumbs/". */
+static inline void cfgpath_lru_scan(struct cfgpath_lru *c, int dir_fd,
+	const char *prefix)
+{
+	DIR *dir = fdopendir(dir_fd);
+	if (!dir) {
+		close(dir_fd);
+		return;
+	}
+	size_t prefix_len = strlen(prefix);
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+		if (!prefix_len && !strncmp(de->d_name, CFGPATH_LRU_INDEX,
+			sizeof(CFGPATH_LRU_INDEX) - 1)
+		) {
+			continue;
+		}
+		struct stat st;
+		if (fstatat(dirfd(dir), de->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+		size_t name_len = strlen(de->d_name);
+		char *path = (char *)malloc(prefix_len + name_len + 2);
+		if (!path) continue;
+		memcpy(path, prefix, prefix_len);
+		memcpy(path + prefix_len, de->d_name, name_len + 1);
+		if (S_ISDIR(st.st_mode)) {
+			int sub = openat(dirfd(dir), de->d_name, O_RDONLY | O_DIRECTORY
+				| O_NOFOLLOW | O_CLOEXEC);
+			if (sub >= 0) {
+				strcat(path, "/");
+				cfgpath_lru_scan(c, sub, path);
+			}
+		} else if (S_ISREG(st.st_mode)) {
+			/* Access times are often not kept, so use whichever is later */
+			int64_t atime = (st.st_atime > st.st_mtime) ? st.st_atime : st.st_mtime;
+			cfgpath_lru_set(c, path, prefix_len + name_len, st.st_size, atime);
+		}
+		free(path);
+	}
+	closedir(dir);
+}
+
+/* Rewrite the index file with one record per file, oldest first.  The cache
+ * must not be locked, as it is only held to take a copy of the records and
+ * to switch to the new file.  Changes made while the file is written are
+ * kept in c->pending and added to the end of it. */
+static inline int cfgpath_lru_compact(struct cfgpath_lru *c)
+{
+	pthread_mutex_lock(&c->lock);
+	if (c->compacting) {
+		pthread_mutex_unlock(&c->lock);
+		return 0;
+	}
+	size_t used = sizeof(CFGPATH_LRU_MAGIC) - 1;
+	uint32_t i;
+	for (i = c->oldest; i != CFGPATH_LRU_NONE; i = c->entry[i].next) {
+		used += sizeof(struct cfgpath_lru_record) + strlen(c->entry[i].name);
+	}
+	char *buf = (char *)malloc(used);
+	if (!buf) {
+		pthread_mutex_unlock(&c->lock);
+		errno = ENOMEM;
+		return -1;
+	}
+	used = sizeof(CFGPATH_LRU_MAGIC) - 1;
+	memcpy(buf, CFGPATH_LRU_MAGIC, used);
+	uint64_t records = 0;
+	for (i = c->oldest; i != CFGPATH_LRU_NONE; i = c->entry[i].next) {
+		struct cfgpath_lru_entry *e = &c->entry[i];
+		struct cfgpath_lru_record r;
+		size_t len = strlen(e->name);
+		r.op = CFGPATH_LRU_OP_SET;
+		r.name_len = len;
+		r.size = e->size;
+		r.atime = e->atime;
+		memcpy(buf + used, &r, sizeof(r));
+		memcpy(buf + used + sizeof(r), e->name, len);
+		used += sizeof(r) + len;
+		e->logged = e->atime;
+		records++;
+	}
+	c->compacting = 1;
+	c->pending_len = 0;
+	c->pending_records = 0;
+	pthread_mutex_unlock(&c->lock);
+
+	struct cfgpath_writer w;
+	size_t folder_len = strlen(c->folder);
+	char *path = (char *)malloc(folder_len + sizeof(CFGPATH_LRU_INDEX) + 1);
+	int ret = -1;
+	if (path) {
+		memcpy(path, c->folder, folder_len);
+		path[folder_len] = '/';
+		memcpy(path + folder_len + 1, CFGPATH_LRU_INDEX, sizeof(CFGPATH_LRU_INDEX));
+		ret = cfgpath_write_begin(&w, path);
+		free(path);
+	}
+	if (ret == 0) {
+		if (cfgpath_write(&w, buf, used) == 0) {
+			ret = cfgpath_write_commit(&w);
+		} else {
+			cfgpath_write_abort(&w);
+			ret = -1;
+		}
+	}
+	free(buf);
+	int fd = -1;
+	if (ret == 0) {
+		fd = openat(c->dir_fd, CFGPATH_LRU_INDEX, O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (fd < 0) ret = -1;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	if (fd >= 0) {
+		/* Until now changes went to the old file, so copy them over.  If one was
+		 * lost, spoil the new file so the folder is scanned on the next open. */
+		if (c->pending_records == UINT64_MAX) {
+			errno = ENOMEM;
+			ret = -1;
+		} else if (c->pending_len
+			&& (write(fd, c->pending, c->pending_len) != (ssize_t)c->pending_len)
+		) {
+			ret = -1;
+		}
+		if (ret != 0) {
+			int err = errno;
+			(void)!ftruncate(fd, 0);
+			errno = err;
+		}
+		if (c->log_fd >= 0) close(c->log_fd);
+		c->log_fd = fd;
+		c->records = records + c->pending_records;
+	}
+	int err = errno;
+	c->compacting = 0;
+	free(c->pending);
+	c->pending = NULL;
+	c->pending_len = c->pending_size = 0;
+	pthread_mutex_unlock(&c->lock);
+	errno = err;
+	return ret;
+}
+
+/* Is the index file big enough to be worth rewriting? */
+static inline int cfgpath_lru_bloated(const struct cfgpath_lru *c)
+{
+	return c->records > c->count * 2 + 1024;
+}
+
+static inline int cfgpath_lru_over(const struct cfgpath_lru *c, uint64_t bytes,
+	uint64_t entries)
+{
+	return (c->bytes > bytes) || (c->count > entries);
+}
+
+/* 90% of a limit, rounded down. */
+static inline uint64_t cfgpath_lru_low(uint64_t max)
+{
+	return max - max / 10 - (max % 10 != 0);
+}
+
+/* Remove the least recently used files until under 90% of both limits, and
+ * shrink the index if needed.  The files are chosen with the cache locked,
+ * but deleted after unlocking it, so other threads can carry on using the
+ * cache meanwhile. */
+static inline void cfgpath_lru_evict(struct cfgpath_lru *c)
+{
+	char **victim = NULL;
+	size_t count = 0, size = 0, i;
+	pthread_mutex_lock(&c->lock);
+	uint64_t bytes = cfgpath_lru_low(c->max_bytes);
+	uint64_t entries = cfgpath_lru_low(c->max_entries);
+	while (cfgpath_lru_over(c, bytes, entries) && (c->oldest != CFGPATH_LRU_NONE)) {
+		struct cfgpath_lru_entry *e = &c->entry[c->oldest];
+		if (count == size) {
+			size_t grown_size = size ? size * 2 : 64;
+			char **grown = (char **)realloc(victim, grown_size * sizeof(char *));
+			if (!grown) break;
+			victim = grown;
+			size = grown_size;
+		}
+		cfgpath_lru_log(c, CFGPATH_LRU_OP_REMOVE, e);
+		/* Keep the name, cfgpath_lru_drop() won't free it now */
+		victim[count++] = e->name;
+		e->name = NULL;
+		cfgpath_lru_drop(c, e);
+	}
+	int bloated = cfgpath_lru_bloated(c);
+	pthread_mutex_unlock(&c->lock);
+
+	for (i = 0; i < count; i++) unlinkat(c->dir_fd, victim[i], 0);
+
+	/* A file written again and inserted while it was being evicted may have
+	 * been deleted anyway, so forget it if it is gone */
+	pthread_mutex_lock(&c->lock);
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(victim[i]);
+		struct cfgpath_lru_entry *e = cfgpath_lru_find(c, victim[i], len,
+			cfgpath_lru_hash(victim[i], len));
+		struct stat st;
+		if (e && (fstatat(c->dir_fd, victim[i], &st, AT_SYMLINK_NOFOLLOW) != 0)) {
+			cfgpath_lru_log(c, CFGPATH_LRU_OP_REMOVE, e);
+			cfgpath_lru_drop(c, e);
+		}
+		free(victim[i]);
+	}
+	pthread_mutex_unlock(&c->lock);
+	free(victim);
+
+	if (bloated) cfgpath_lru_compact(c);
+}
+
+/* Eviction queued by cfgpath_lru_insert(). */
+struct cfgpath_lru_task {
+	struct cfgpath_task task;  /* Must be first */
+	struct cfgpath_lru *c;
+};
+
+static void cfgpath_lru_task_run(struct cfgpath_task *task)
+{
+	struct cfgpath_lru_task *t = (struct cfgpath_lru_task *)task;
+	__atomic_store_n(&t->c->evict_queued, 0, __ATOMIC_SEQ_CST);
+	cfgpath_lru_evict(t->c);
+	free(t);
+}
+
+/* Start evicting on the background thread, unless it already will be. */
+static inline void cfgpath_lru_evict_async(struct cfgpath_lru *c)
+{
+	if (__atomic_exchange_n(&c->evict_queued, 1, __ATOMIC_SEQ_CST)) return;
+	struct cfgpath_lru_task *t = (struct cfgpath_lru_task *)malloc(
+		sizeof(struct cfgpath_lru_task));
+	if (t) {
+		t->task.run = cfgpath_lru_task_run;
+		t->c = c;
+		cfgpath_worker_submit(&t->task);
+		return;
+	}
+	__atomic_store_n(&c->evict_queued, 0, __ATOMIC_SEQ_CST);
+	cfgpath_lru_evict(c);
+}
+#endif /* CFGPATH_LINUX */
+
+/** Start managing a cache folder.
+ *
+ * @param c
+ *   Cache to set up.  It must not be moved afterwards, and must be passed to
+ *   cfgpath_lru_close() when no longer needed.
+ *
+ * @param folder
+ *   Folder holding the cached files, which must exist.
+ *
+ * @param max_bytes
+ *   Largest total size of the files.
+ *
+ * @param max_entries
+ *   Largest number of files.
+ *
+ * @return 0 on success, or -1 on error with errno set (EWOULDBLOCK if another
+ *   process is using the folder, ENOSYS on other platforms).
+ */
+static inline int cfgpath_lru_open(struct cfgpath_lru *c, const char *folder,
+	uint64_t max_bytes, uint64_t max_entries)
+{
+#ifndef CFGPATH_LINUX
+	errno = ENOSYS;
+	return -1;
+#else
+	memset(c, 0, sizeof(*c));
+	pthread_mutex_init(&c->lock, NULL);
+	c->log_fd = -1;
+	c->free_list = c->oldest = c->newest = CFGPATH_LRU_NONE;
+	c->max_bytes = max_bytes;
+	c->max_entries = max_entries;
+	c->dir_fd = open(folder, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (c->dir_fd < 0) return -1;
+	int err = 0;
+	c->folder = strdup(folder);
+	if (!c->folder) {
+		err = ENOMEM;
+	} else if (flock(c->dir_fd, LOCK_EX | LOCK_NB) != 0) {
+		err = errno;
+	} else if (cfgpath_lru_rehash(c) != 0) {
+		err = ENOMEM;
+	} else if (cfgpath_lru_load(c) != 0) {
+		/* Start again from what is actually in the folder */
+		uint32_t i;
+		for (i = 0; i < c->entry_size; i++) {
+			if (c->entry[i].name) cfgpath_lru_drop(c, &c->entry[i]);
+		}
+		c->records = 0;
+		int scan_fd = openat(c->dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (scan_fd >= 0) cfgpath_lru_scan(c, scan_fd, "");
+		if (cfgpath_lru_compact(c) != 0) err = errno;
+	} else {
+		c->log_fd = openat(c->dir_fd, CFGPATH_LRU_INDEX,
+			O_WRONLY | O_APPEND | O_CLOEXEC);
+		if (c->log_fd < 0) err = errno;
+	}
+	if (err) {
+		/* cfgpath_lru_close() without writing anything */
+		uint32_t i;
+		for (i = 0; i < c->entry_size; i++) free(c->entry[i].name);
+		free(c->entry);
+		free(c->bucket);
+		free(c->folder);
+		if (c->log_fd >= 0) close(c->log_fd);
+		close(c->dir_fd);
+		pthread_mutex_destroy(&c->lock);
+		errno = err;
+		return -1;
+	}
+	if (cfgpath_lru_over(c, max_bytes, max_entries)) cfgpath_lru_evict_async(c);
+	return 0;
+#endif
+}
+
+/** Start managing an application's cache folder.
+ *
+ * This manages the folder from get_user_cache_folder(), creating it if needed.
+ *
+ * @param appname
+ *   Short name of the application, as for get_user_cache_folder().
+ *
+ * See cfgpath_lru_open() for the other parameters and the return value.
+ * errno is set to ENOENT if the user's home folder cannot be found.
+ */
+static inline int cfgpath_lru_open_app(struct cfgpath_lru *c, const char *appname,
+	uint64_t max_bytes, uint64_t max_entries)
+{
+	char folder[MAX_PATH];
+	if (cfgpath_get(CFGPATH_CACHE_FOLDER, folder, sizeof(folder), appname) <= 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return cfgpath_lru_open(c, folder, max_bytes, max_entries);
+}
+
+/** Record that a file has been added to the cache folder, or replaced.
+ *
+ * If this takes the cache over either limit, the least recently used files
+ * are removed in the background.  The file just added is the most recently
+ * used, so it is only removed if it alone is over a limit.
+ *
+ * @param name
+ *   Path of the file relative to the cache folder, e.g. "thumbs/1234.png".
+ *
+ * @param size
+ *   Size of the file in bytes.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOMEM).
+ */
+static inline int cfgpath_lru_insert(struct cfgpath_lru *c, const char *name,
+	uint64_t size)
+{
+#ifndef CFGPATH_LINUX
+	errno = ENOSYS;
+	return -1;
+#else
+	pthread_mutex_lock(&c->lock);
+	struct cfgpath_lru_entry *e = cfgpath_lru_set(c, name, strlen(name), size,
+		time(NULL));
+	if (e) {
+		cfgpath_lru_log(c, CFGPATH_LRU_OP_SET, e);
+		e->logged = e->atime;
+	}
+	int over = cfgpath_lru_over(c, c->max_bytes, c->max_entries)
+		|| cfgpath_lru_bloated(c);
+	pthread_mutex_unlock(&c->lock);
+	if (!e) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if (over) cfgpath_lru_evict_async(c);
+	return 0;
+#endif
+}
+
+/** Record that a file in the cache folder has been used.
+ *
+ * This makes it the most recently used file, so the last to be removed.
+ *
+ * @param name
+ *   Path of the file relative to the cache folder.
+ *
+ * @return 0 on success, or -1 if the file is not in the cache.
+ */
+static inline int cfgpath_lru_touch(struct cfgpath_lru *c, const char *name)
+{
+#ifndef CFGPATH_LINUX
+	return -1;
+#else
+	size_t len = strlen(name);
+	int64_t now = time(NULL);
+	pthread_mutex_lock(&c->lock);
+	struct cfgpath_lru_entry *e = cfgpath_lru_find(c, name, len,
+		cfgpath_lru_hash(name, len));
+	if (e) {
+		uint32_t i = e - c->entry;
+		cfgpath_lru_unlink(c, i);
+		cfgpath_lru_append(c, i);
+		e->atime = now;
+		if (now - e->logged >= CFGPATH_LRU_TOUCH_SECS) {
+			cfgpath_lru_log(c, CFGPATH_LRU_OP_SET, e);
+			e->logged = now;
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	return e ? 0 : -1;
+#endif
+}
+
+/** Remove a file from the cache folder.
+ *
+ * @param name
+ *   Path of the file relative to the cache folder.
+ *
+ * @return 0 on success, or -1 if the file is not in the cache.
+ */
+static inline int cfgpath_lru_remove(struct cfgpath_lru *c, const char *name)
+{
+#ifndef CFGPATH_LINUX
+	return -1;
+#else
+	size_t len = strlen(name);
+	pthread_mutex_lock(&c->lock);
+	struct cfgpath_lru_entry *e = cfgpath_lru_find(c, name, len,
+		cfgpath_lru_hash(name, len));
+	if (e) {
+		unlinkat(c->dir_fd, e->name, 0);
+		cfgpath_lru_log(c, CFGPATH_LRU_OP_REMOVE, e);
+		cfgpath_lru_drop(c, e);
+	}
+	pthread_mutex_unlock(&c->lock);
+	return e ? 0 : -1;
+#endif
+}
+
+/** Get the current size of the cache.
+ *
+ * @param bytes
+ *   Set to the total size of the files, or NULL.
+ *
+ * @param entries
+ *   Set to the number of files, or NULL.
+ */
+static inline void cfgpath_lru_usage(struct cfgpath_lru *c, uint64_t *bytes,
+	uint64_t *entries)
+{
+#ifdef CFGPATH_LINUX
+	pthread_mutex_lock(&c->lock);
+	if (bytes) *bytes = c->bytes;
+	if (entries) *entries = c->count;
+	pthread_mutex_unlock(&c->lock);
+#endif
+}
+
+/** Stop managing a cache folder.
+ *
+ * This waits for any eviction in progress (see cfgpath_flush()), and shrinks
+ * the index file if needed.
+ */
+static inline void cfgpath_lru_close(struct cfgpath_lru *c)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_flush();
+	pthread_mutex_lock(&c->lock);
+	int bloated = cfgpath_lru_bloated(c);
+	pthread_mutex_unlock(&c->lock);
+	if (bloated) cfgpath_lru_compact(c);
+	pthread_mutex_lock(&c->lock);
+	uint32_t i;
+	for (i = 0; i < c->entry_size; i++) free(c->entry[i].name);
+	free(c->entry);
+	free(c->bucket);
+	free(c->folder);
+	c->entry = NULL;
+	c->bucket = NULL;
+	c->folder = NULL;
+	if (c->log_fd >= 0) close(c->log_fd);
+	close(c->dir_fd);
+	c->log_fd = c->dir_fd = -1;
+	pthread_mutex_unlock(&c->lock);
+	pthread_mutex_destroy(&c->lock);
+#endif
+}
+
+#endif /* CFGPATH_LRU_H_ */
@@ -0,0 +1,445 @@
+/**
+ * @file  cfgpath-overlay.h
+ * @brief Merge the system and user configuration files into one snapshot that
+ *        can be read from any thread without locking.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use:
+ *
+ * static struct cfgpath_overlay settings;
+ * cfgpath_overlay_init(&settings, "myapp");
+ *
+ * // Any thread, as often as needed
+ * unsigned int token = cfgpath_overlay_enter(&settings);
+ * const struct cfgpath_snapshot *s = cfgpath_overlay_current(&settings);
+ * long width = cfgpath_conf_get_long(&s->conf, "window", "width", 640);
+ * cfgpath_overlay_leave(&settings, token);
+ *
+ * // When the files have changed
+ * cfgpath_overlay_reload_async(&settings);
+ *
+ * The files are merged in this order, with later files overriding settings in
+ * earlier ones:
+ *
+ *   1. <dir>/myapp.conf for each folder in cfgpath_get_system_dirs(), starting
+ *      with the least important (e.g. /etc/xdg/myapp.conf)
+ *   2. The user's file from get_user_config_file()
+ *
+ * Each file is followed by any *.conf files in a folder of the same name with
+ * ".d" appended (e.g. /etc/xdg/myapp.conf.d/10-local.conf), in alphabetical
+ * order.  Only the user's file is used on Windows and Mac.
+ *
+ * A snapshot is never changed once it has been built.  A reload builds a new
+ * one and swaps it in, so readers see either the old settings or the new ones
+ * but never a mix.  Entering and leaving is a single atomic increment or
+ * decrement on a counter shared with only a few other threads, and the old
+ * snapshot is freed once every reader that might be using it has left.
+ */
+
+#ifndef CFGPATH_OVERLAY_H_
+#define CFGPATH_OVERLAY_H_
+
+#include "cfgpath-conf.h"
+#include "cfgpath-file.h"
+
+#include <stdio.h>
+
+#ifdef CFGPATH_WINDOWS
+/* SwitchToThread() comes from <windows.h>, already included by <shlobj.h> */
+#else
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+/* Number of reader counters.  Threads are spread across them so that readers
+ * on different cores rarely write to the same cache line. */
+#ifndef CFGPATH_OVERLAY_STRIPES
+#define CFGPATH_OVERLAY_STRIPES 16
+#endif
+
+/** Settings merged from every file, see cfgpath_overlay_current(). */
+struct cfgpath_snapshot {
+	struct cfgpath_conf conf;   /**< Merged settings, for cfgpath_conf_get() */
+	unsigned long generation;   /**< 1 for the first snapshot, +1 per reload */
+	unsigned int files;         /**< Number of files that were read */
+};
+
+struct cfgpath_overlay_stripe {
+	unsigned long readers[2];   /* Readers that entered during each epoch */
+	char pad[64 - 2 * sizeof(unsigned long)];
+};
+
+/** Overlay of configuration files, see cfgpath_overlay_init(). */
+struct cfgpath_overlay {
+	struct cfgpath_overlay_stripe stripe[CFGPATH_OVERLAY_STRIPES];
+	struct cfgpath_snapshot *current;
+	unsigned int epoch;         /* Low bit picks the readers[] to use */
+	int reloading;              /* Held while a reload replaces current */
+	int reload_queued;          /* cfgpath_overlay_reload_async() is pending */
+	char *appname;
+};
+
+/* Text being assembled from the files, after space for the snapshot itself. */
+struct cfgpath_overlay_text {
+	char *buf;
+	size_t len;
+	size_t size;
+	unsigned int files;
+};
+
+/* Append one file, with a "[]" line first so its keys before any section are
+ * not taken to be in the previous file's last section.  Missing or unreadable
+ * files are skipped. */
+static inline int cfgpath_overlay_add_file(struct cfgpath_overlay_text *text,
+	const char *path)
+{
+	static const char reset[] = "\n[]\n";
+	char small[4096];
+	struct cfgpath_view view;
+	if (cfgpath_map_file(path, &view, small, sizeof(small)) != 0) {
+		return (errno == ENOMEM) ? -1 : 0;
+	}
+	size_t need = text->len + sizeof(reset) - 1 + view.len;
+	if (need > text->size) {
+		size_t size = text->size * 2;
+		while (size < need) size *= 2;
+		char *grown = (char *)realloc(text->buf, size);
+		if (!grown) {
+			cfgpath_view_release(&view);
+			errno = ENOMEM;
+			return -1;
+		}
+		text->buf = grown;
+		text->size = size;
+	}
+	memcpy(text->buf + text->len, reset, sizeof(reset) - 1);
+	text->len += sizeof(reset) - 1;
+	memcpy(text->buf + text->len, view.data, view.len);
+	text->len += view.len;
+	text->files++;
+	cfgpath_view_release(&view);
+	return 0;
+}
+
+#ifndef CFGPATH_WINDOWS
+static int cfgpath_overlay_name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+#endif
+
+/* Append a file and then the fragments in its .d folder. */
+static inline int cfgpath_overlay_add_layer(struct cfgpath_overlay_text *text,
+	const char *path)
+{
+	if (cfgpath_overlay_add_file(text, path) != 0) return -1;
+#ifndef CFGPATH_WINDOWS
+	char dir_path[MAX_PATH];
+	int dir_len = snprintf(dir_path, sizeof(dir_path), "%s.d", path);
+	if ((dir_len < 0) || (dir_len >= (int)sizeof(dir_path))) return 0;
+	DIR *dir = opendir(dir_path);
+	if (!dir) return 0;
+
+	char **name = NULL;
+	unsigned int count = 0, size = 0, i;
+	int ret = 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		size_t len = strlen(de->d_name);
+		if ((de->d_name[0] == '.') || (len < 6)
+			|| (strcmp(de->d_name + len - 5, ".conf") != 0)
+		) {
+			continue;
+		}
+		if (count == size) {
+			size = size ? size * 2 : 16;
+			char **grown = (char **)realloc(name, size * sizeof(char *));
+			if (!grown) {
+				ret = -1;
+				break;
+			}
+			name = grown;
+		}
+		name[count] = (char *)malloc(len + 1);
+		if (!name[count]) {
+			ret = -1;
+			break;
+		}
+		memcpy(name[count++], de->d_name, len + 1);
+	}
+	closedir(dir);
+
+	if (count) qsort(name, count, sizeof(char *), cfgpath_overlay_name_cmp);
+	for (i = 0; i < count; i++) {
+		char frag_path[MAX_PATH];
+		int frag_len = snprintf(frag_path, sizeof(frag_path), "%s/%s", dir_path,
+			name[i]);
+		if ((ret == 0) && (frag_len > 0) && (frag_len < (int)sizeof(frag_path))) {
+			ret = cfgpath_overlay_add_file(text, frag_path);
+		}
+		free(name[i]);
+	}
+	free(name);
+	if (ret != 0) errno = ENOMEM;
+	return ret;
+#else
+	return 0;
+#endif
+}
+
+/* Read and merge every file into a new snapshot. */
+static inline struct cfgpath_snapshot *cfgpath_overlay_build(const char *appname,
+	unsigned long generation)
+{
+	struct cfgpath_overlay_text text;
+	text.size = sizeof(struct cfgpath_snapshot) + 4096;
+	text.len = sizeof(struct cfgpath_snapshot);
+	text.files = 0;
+	text.buf = (char *)malloc(text.size);
+	if (!text.buf) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	char path[MAX_PATH];
+	int ret = 0;
+#ifdef CFGPATH_LINUX
+	const struct cfgpath_dirs *dirs = cfgpath_get_system_dirs(CFGPATH_SEARCH_CONFIG);
+	unsigned int i;
+	for (i = dirs ? dirs->count : 0; (ret == 0) && (i > 0); i--) {
+		int len = snprintf(path, sizeof(path), "%s%s.conf", dirs->dir[i - 1],
+			appname);
+		if ((len > 0) && (len < (int)sizeof(path))) {
+			ret = cfgpath_overlay_add_layer(&text, path);
+		}
+	}
+#endif
+	if ((ret == 0) && (cfgpath_get_ex(CFGPATH_CONFIG_FILE, path, sizeof(path),
+		appname, CFGPATH_CREATE_NONE) > 0)
+	) {
+		ret = cfgpath_overlay_add_layer(&text, path);
+	}
+
+	struct cfgpath_snapshot *snap = (struct cfgpath_snapshot *)text.buf;
+	if ((ret != 0) || (cfgpath_conf_parse(&snap->conf,
+		text.buf + sizeof(struct cfgpath_snapshot),
+		text.len - sizeof(struct cfgpath_snapshot)) != 0)
+	) {
+		free(text.buf);
+		errno = ENOMEM;
+		return NULL;
+	}
+	snap->generation = generation;
+	snap->files = text.files;
+	return snap;
+}
+
+static inline void cfgpath_snapshot_free(struct cfgpath_snapshot *snap)
+{
+	if (!snap) return;
+	cfgpath_conf_free(&snap->conf);
+	free(snap);
+}
+
+static inline void cfgpath_overlay_yield(void)
+{
+#ifdef CFGPATH_WINDOWS
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+/* Pick the reader counter for this thread, spreading threads across them. */
+static inline unsigned int cfgpath_overlay_stripe_id(void)
+{
+	static CFGPATH_THREAD_LOCAL unsigned int id;  /* Stripe + 1, or 0 if not yet picked */
+	static unsigned int next;
+	if (!id) {
+		id = CFGPATH_ATOMIC_FETCH_ADD(&next, 1, __ATOMIC_RELAXED)
+			% CFGPATH_OVERLAY_STRIPES + 1;
+	}
+	return id - 1;
+}
+
+/* Wait until no reader can still be using a snapshot that was replaced
+ * before this was called.
+ *
+ * Such a reader incremented one of the two counters before the snapshot was
+ * replaced, but it may have read the epoch long before that and so be on
+ * either counter.  Flipping the epoch sends new readers to the other counter,
+ * so after each flip the old counter drains and can be waited on.  Doing this
+ * for both counters covers every reader. */
+static inline void cfgpath_overlay_synchronize(struct cfgpath_overlay *ov)
+{
+	int flip;
+	for (flip = 0; flip < 2; flip++) {
+		unsigned int old = CFGPATH_ATOMIC_FETCH_ADD(&ov->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+		unsigned int i;
+		for (i = 0; i < CFGPATH_OVERLAY_STRIPES; i++) {
+			while (CFGPATH_ATOMIC_LOAD(&ov->stripe[i].readers[old], __ATOMIC_SEQ_CST)) {
+				cfgpath_overlay_yield();
+			}
+		}
+	}
+}
+
+/** Load the configuration files for an application.
+ *
+ * Missing files are not an error, they just don't contribute any settings.
+ *
+ * @param ov
+ *   Overlay to set up.  It must not be moved afterwards, and must be passed to
+ *   cfgpath_overlay_free() when no longer needed.
+ *
+ * @param appname
+ *   Short name of the application, as for get_user_config_file().
+ *
+ * @return 0 on success, or -1 on error with errno set (e.g. ENOMEM).
+ */
+static inline int cfgpath_overlay_init(struct cfgpath_overlay *ov,
+	const char *appname)
+{
+	memset(ov, 0, sizeof(*ov));
+	size_t len = strlen(appname);
+	ov->appname = (char *)malloc(len + 1);
+	if (!ov->appname) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(ov->appname, appname, len + 1);
+	ov->current = cfgpath_overlay_build(appname, 1);
+	if (!ov->current) {
+		free(ov->appname);
+		ov->appname = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/** Free an overlay set up by cfgpath_overlay_init().
+ *
+ * There must be no readers left, and no cfgpath_overlay_reload_async() still
+ * pending (see cfgpath_flush()).
+ */
+static inline void cfgpath_overlay_free(struct cfgpath_overlay *ov)
+{
+	cfgpath_snapshot_free(ov->current);
+	ov->current = NULL;
+	free(ov->appname);
+	ov->appname = NULL;
+}
+
+/** Start reading the settings.
+ *
+ * This does not block, even while a reload is in progress.
+ *
+ * @return Token to pass to cfgpath_overlay_leave().
+ */
+static inline unsigned int cfgpath_overlay_enter(struct cfgpath_overlay *ov)
+{
+	unsigned int s = cfgpath_overlay_stripe_id();
+	unsigned int e = CFGPATH_ATOMIC_LOAD(&ov->epoch, __ATOMIC_SEQ_CST) & 1;
+	CFGPATH_ATOMIC_FETCH_ADD(&ov->stripe[s].readers[e], 1, __ATOMIC_SEQ_CST);
+	return s * 2 + e;
+}
+
+/** Get the current settings.
+ *
+ * Must be called between cfgpath_overlay_enter() and cfgpath_overlay_leave().
+ * Calling it twice may return different snapshots if there was a reload in
+ * between, so get it once and keep using it for settings that must agree.
+ *
+ * @return The snapshot, valid until cfgpath_overlay_leave().
+ */
+static inline const struct cfgpath_snapshot *cfgpath_overlay_current(
+	struct cfgpath_overlay *ov)
+{
+	return (const struct cfgpath_snapshot *)CFGPATH_ATOMIC_LOAD_PTR(&ov->current,
+		__ATOMIC_SEQ_CST);
+}
+
+/** Finish reading the settings.
+ *
+ * @post The snapshot from cfgpath_overlay_current() may no longer be used.
+ */
+static inline void cfgpath_overlay_leave(struct cfgpath_overlay *ov,
+	unsigned int token)
+{
+	CFGPATH_ATOMIC_FETCH_SUB(&ov->stripe[token / 2].readers[token & 1], 1,
+		__ATOMIC_RELEASE);
+}
+
+/** Read the files again and replace the current snapshot.
+ *
+ * Readers are never blocked.  This waits until every reader still using the
+ * old snapshot has left, so must not be called between cfgpath_overlay_enter()
+ * and cfgpath_overlay_leave() on the same thread.
+ *
+ * @return 0 on success, or -1 on error with errno set, in which case the old
+ *   snapshot is kept.
+ */
+static inline int cfgpath_overlay_reload(struct cfgpath_overlay *ov)
+{
+	while (CFGPATH_ATOMIC_EXCHANGE(&ov->reloading, 1, __ATOMIC_ACQUIRE)) {
+		cfgpath_overlay_yield();
+	}
+	struct cfgpath_snapshot *snap = cfgpath_overlay_build(ov->appname,
+		ov->current->generation + 1);
+	if (!snap) {
+		CFGPATH_ATOMIC_STORE(&ov->reloading, 0, __ATOMIC_RELEASE);
+		return -1;
+	}
+	struct cfgpath_snapshot *old = (struct cfgpath_snapshot *)
+		CFGPATH_ATOMIC_EXCHANGE_PTR(&ov->current, snap, __ATOMIC_SEQ_CST);
+	cfgpath_overlay_synchronize(ov);
+	CFGPATH_ATOMIC_STORE(&ov->reloading, 0, __ATOMIC_RELEASE);
+	cfgpath_snapshot_free(old);
+	return 0;
+}
+
+#ifdef CFGPATH_LINUX
+/* Reload queued by cfgpath_overlay_reload_async(). */
+struct cfgpath_overlay_task {
+	struct cfgpath_task task;  /* Must be first */
+	struct cfgpath_overlay *ov;
+};
+
+static void cfgpath_overlay_task_run(struct cfgpath_task *task)
+{
+	struct cfgpath_overlay_task *t = (struct cfgpath_overlay_task *)task;
+	/* Cleared first, so changes made during the reload queue another one */
+	CFGPATH_ATOMIC_STORE(&t->ov->reload_queued, 0, __ATOMIC_SEQ_CST);
+	cfgpath_overlay_reload(t->ov);
+	free(t);
+}
+#endif
+
+/** Reload the files on a background thread.
+ *
+ * Calls made while a reload is already queued are merged into it.  Use
+ * cfgpath_flush() to wait for the reload to finish.  Platforms without a
+ * background thread reload immediately instead.
+ */
+static inline void cfgpath_overlay_reload_async(struct cfgpath_overlay *ov)
+{
+#ifdef CFGPATH_LINUX
+	if (CFGPATH_ATOMIC_EXCHANGE(&ov->reload_queued, 1, __ATOMIC_SEQ_CST)) return;
+	struct cfgpath_overlay_task *t = (struct cfgpath_overlay_task *)malloc(
+		sizeof(struct cfgpath_overlay_task));
+	if (t) {
+		t->task.run = cfgpath_overlay_task_run;
+		t->ov = ov;
+		cfgpath_worker_submit(&t->task);
+		return;
+	}
+	CFGPATH_ATOMIC_STORE(&ov->reload_queued, 0, __ATOMIC_SEQ_CST);
+#endif
+	cfgpath_overlay_reload(ov);
+}
+
+#endif /* CFGPATH_OVERLAY_H_ */
@@ -0,0 +1,485 @@
+/**
+ * @file  cfgpath-probe.h
+ * @brief Find which of several candidate paths exist, in as few round trips
+ *        as possible.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use:
+ *
+ * char user[MAX_PATH];
+ * get_user_config_file(user, sizeof(user), "myapp");
+ * const char *candidates[] = { user, "/etc/xdg/myapp.conf", "/etc/myapp.conf" };
+ * int i = cfgpath_probe_first(candidates, 3);
+ * if (i >= 0) load_config(candidates[i]);
+ *
+ * Under Linux all the candidates are checked with a single io_uring batch of
+ * statx() calls, so the wait is one round trip rather than one per candidate.
+ * This matters when some candidates are on a slow network filesystem.  If
+ * io_uring is not available (old kernel, or blocked by a container's seccomp
+ * policy), or CFGPATH_NO_IO_URING is defined, the candidates are checked in
+ * parallel by a small pool of threads instead.  Other platforms check them
+ * one at a time.
+ */
+
+#ifndef CFGPATH_PROBE_H_
+#define CFGPATH_PROBE_H_
+
+#include "cfgpath.h"
+
+#include <sys/stat.h>
+#ifdef CFGPATH_LINUX
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifndef CFGPATH_NO_IO_URING
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#endif
+#endif
+
+/* Number of candidates submitted to io_uring at once.  Longer lists are split
+ * into several batches. */
+#ifndef CFGPATH_PROBE_BATCH
+#define CFGPATH_PROBE_BATCH 32
+#endif
+
+/* Number of threads used to check candidates when io_uring is unavailable,
+ * not counting the calling thread. */
+#ifndef CFGPATH_PROBE_THREADS
+#define CFGPATH_PROBE_THREADS 3
+#endif
+
+#ifdef CFGPATH_LINUX
+#ifndef CFGPATH_NO_IO_URING
+/* A ring set up with io_uring_setup(), shared by all threads.  A thread that
+ * finds it in use goes to the thread pool rather than waiting for it. */
+struct cfgpath_uring {
+	int state;             /* 0 = not set up yet, 1 = usable, -1 = unavailable */
+	int fd;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_size, cq_size;
+	unsigned int *sq_tail, *sq_head, *sq_mask, *sq_array;
+	unsigned int *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	struct io_uring_cqe *cqes;
+	/* Written by the kernel.  If a batch fails part way through, requests still
+	 * in flight can write here after the probe has returned, so these must not
+	 * live on the stack. */
+	struct statx stx[CFGPATH_PROBE_BATCH];
+};
+
+static struct cfgpath_uring cfgpath_uring;
+
+/* Held while cfgpath_uring is in use */
+static pthread_mutex_t cfgpath_uring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Map the rings of a newly created io_uring instance.  Returns 0 on success or
+ * -1 on error, in which case nothing is left open. */
+static inline int cfgpath_uring_setup(struct cfgpath_uring *r)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, CFGPATH_PROBE_BATCH, &p);
+	if (r->fd < 0) return -1;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_size > r->sq_size) r->sq_size = r->cq_size;
+		r->cq_size = r->sq_size;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) goto fail_fd;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED) goto fail_sq;
+	}
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_size,
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) goto fail_cq;
+
+	sq = (char *)r->sq_ptr;
+	cq = (char *)r->cq_ptr;
+	r->sq_head = (unsigned int *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned int *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned int *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned int *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+
+fail_cq:
+	if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+fail_sq:
+	munmap(r->sq_ptr, r->sq_size);
+fail_fd:
+	close(r->fd);
+	return -1;
+}
+
+static inline void cfgpath_uring_teardown(struct cfgpath_uring *r)
+{
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != r->sq_ptr) munmap(r->cq_ptr, r->cq_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+}
+
+/* A child process shares the ring with its parent, so it must set up its own.
+ * The lock may also have been held by another thread when fork() was
+ * called. */
+static void cfgpath_uring_atfork_child(void)
+{
+	struct cfgpath_uring *r = &cfgpath_uring;
+	pthread_mutex_t init = PTHREAD_MUTEX_INITIALIZER;
+	if (r->state == 1) cfgpath_uring_teardown(r);
+	r->state = 0;
+	memcpy(&cfgpath_uring_lock, &init, sizeof(init));
+}
+
+/* Check up to CFGPATH_PROBE_BATCH candidates with one io_uring_enter() call.
+ * The ring must be locked.  Returns 0 on success, or -1 if io_uring can't be
+ * used, in which case exists is left untouched. */
+static inline int cfgpath_uring_probe(struct cfgpath_uring *r,
+	const char *const *paths, unsigned int count, int *exists)
+{
+	unsigned long long start = 0;
+	unsigned int tail = *r->sq_tail;
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		unsigned long long s = cfgpath_fs_begin(CFGPATH_FS_STAT, paths[i]);
+		if (!start) start = s;
+		unsigned int idx = tail & *r->sq_mask;
+		struct io_uring_sqe *sqe = &r->sqes[idx];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_STATX;
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long long)(uintptr_t)paths[i];
+		sqe->len = STATX_TYPE;
+		sqe->off = (unsigned long long)(uintptr_t)&r->stx[i];
+		sqe->user_data = i;
+		r->sq_array[idx] = idx;
+		tail++;
+	}
+	__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+	int result[CFGPATH_PROBE_BATCH] = { 0 };
+	unsigned int done = 0;
+	while (done < count) {
+		unsigned int to_submit = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		if ((syscall(__NR_io_uring_enter, r->fd, to_submit, count - done,
+			IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR)
+		) {
+			if (done || (to_submit < count)) {
+				/* Some are in flight, so the ring can't be trusted any more.  It is
+				 * never used again, so r->stx is left for them to finish with. */
+				cfgpath_uring_teardown(r);
+				r->state = -1;
+			}
+			for (i = 0; i < count; i++) cfgpath_fs_end(CFGPATH_FS_STAT, paths[i], -1, start);
+			return -1;
+		}
+		unsigned int head = *r->cq_head;
+		while (head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+			result[cqe->user_data] = cqe->res;
+			head++;
+			done++;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	/* Kernels before 5.6 don't know IORING_OP_STATX */
+	if ((result[0] == -EINVAL) || (result[0] == -EOPNOTSUPP)) {
+		errno = -result[0];
+		for (i = 0; i < count; i++) cfgpath_fs_end(CFGPATH_FS_STAT, paths[i], -1, start);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		exists[i] = (result[i] == 0);
+		if (result[i] < 0) errno = -result[i];
+		cfgpath_fs_end(CFGPATH_FS_STAT, paths[i], result[i] ? -1 : 0, start);
+	}
+	return 0;
+}
+#endif /* !CFGPATH_NO_IO_URING */
+
+/* A list of candidates being checked by the thread pool. */
+struct cfgpath_probe_job {
+	const char *const *paths;
+	unsigned int count;
+	int *exists;
+	unsigned int next;   /* Next candidate to claim */
+	unsigned int done;   /* Number of candidates checked */
+	unsigned int first;  /* Lowest existing candidate so far, or count */
+	int stop_at_first;   /* Skip candidates after the first that exists */
+};
+
+/* Threads for checking candidates when io_uring is unavailable, started the
+ * first time they are needed.  Only one job is run at a time. */
+static struct cfgpath_probe_pool {
+	pthread_mutex_t job_lock;  /* Held by the caller for the whole job */
+	pthread_mutex_t lock;      /* Protects the fields below */
+	pthread_cond_t wake;       /* Signalled when a job is posted */
+	pthread_cond_t idle;       /* Signalled when a thread finishes a job */
+	struct cfgpath_probe_job *job;
+	unsigned int generation;   /* Incremented for each job */
+	unsigned int busy;         /* Threads working on the current job */
+	unsigned int threads;      /* Number of threads started */
+} cfgpath_probe_pool = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+	PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0
+};
+
+/* The threads do not exist in a child process, and the locks may have been
+ * held by another thread when fork() was called. */
+static void cfgpath_probe_pool_atfork_child(void)
+{
+	static const struct cfgpath_probe_pool init = {
+		PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
+		PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0
+	};
+	memcpy(&cfgpath_probe_pool, &init, sizeof(init));
+}
+
+/* Claim and check candidates until there are none left. */
+static inline void cfgpath_probe_work(struct cfgpath_probe_job *job)
+{
+	for (;;) {
+		unsigned int i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+		if (i >= job->count) break;
+		int found = 0;
+		if (!job->stop_at_first || (i < __atomic_load_n(&job->first, __ATOMIC_RELAXED))) {
+			struct stat st;
+			found = (cfgpath_fs_stat(job->paths[i], &st) == 0);
+		}
+		job->exists[i] = found;
+		if (found) {
+			unsigned int first = __atomic_load_n(&job->first, __ATOMIC_RELAXED);
+			while ((i < first) && !__atomic_compare_exchange_n(&job->first, &first, i,
+				1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+		}
+		__atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+	}
+}
+
+static void *cfgpath_probe_thread(void *arg)
+{
+	struct cfgpath_probe_pool *pool = (struct cfgpath_probe_pool *)arg;
+	unsigned int seen = 0;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->job || (pool->generation == seen)) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		seen = pool->generation;
+		struct cfgpath_probe_job *job = pool->job;
+		pool->busy++;
+		pthread_mutex_unlock(&pool->lock);
+		cfgpath_probe_work(job);
+		pthread_mutex_lock(&pool->lock);
+		pool->busy--;
+		pthread_cond_broadcast(&pool->idle);
+	}
+	return NULL;
+}
+
+/* Check candidates using the thread pool, with the calling thread helping. */
+static inline void cfgpath_probe_threads(const char *const *paths,
+	unsigned int count, int *exists, int stop_at_first)
+{
+	struct cfgpath_probe_pool *pool = &cfgpath_probe_pool;
+	struct cfgpath_probe_job job = { paths, count, exists, 0, 0, count, stop_at_first };
+
+	pthread_mutex_lock(&pool->job_lock);
+	pthread_mutex_lock(&pool->lock);
+	while ((pool->threads < CFGPATH_PROBE_THREADS) && (pool->threads + 1 < count)) {
+		pthread_attr_t attr;
+		pthread_t thread;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		int err = pthread_create(&thread, &attr, cfgpath_probe_thread, pool);
+		pthread_attr_destroy(&attr);
+		if (err) break; /* Carry on with the threads there are */
+		if (pool->threads++ == 0) {
+			static int atfork_done;
+			if (!atfork_done) pthread_atfork(NULL, NULL, cfgpath_probe_pool_atfork_child);
+			atfork_done = 1;
+		}
+	}
+	pool->job = &job;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	cfgpath_probe_work(&job);
+
+	/* job is on the stack, so wait until no thread is looking at it */
+	pthread_mutex_lock(&pool->lock);
+	pool->job = NULL;
+	while (pool->busy) pthread_cond_wait(&pool->idle, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	pthread_mutex_unlock(&pool->job_lock);
+}
+#endif /* CFGPATH_LINUX */
+
+#if defined(CFGPATH_LINUX) && !defined(CFGPATH_NO_IO_URING)
+/* Check as many candidates as possible with io_uring.  Returns the number of
+ * candidates at the start of paths that have been dealt with, which is count
+ * if there is nothing left for the thread pool to do. */
+static inline unsigned int cfgpath_probe_uring(const char *const *paths,
+	unsigned int count, int *exists, int stop_at_first)
+{
+	struct cfgpath_uring *r = &cfgpath_uring;
+	unsigned int i, pos = 0;
+	/* Waiting for another thread's batch could take as long as doing this one
+	 * with the thread pool, so only use the ring if it is free */
+	if (pthread_mutex_trylock(&cfgpath_uring_lock) != 0) return 0;
+	if (r->state == 0) {
+		static int atfork_done;
+		r->state = (cfgpath_uring_setup(r) == 0) ? 1 : -1;
+		if ((r->state == 1) && !atfork_done) {
+			pthread_atfork(NULL, NULL, cfgpath_uring_atfork_child);
+			atfork_done = 1;
+		}
+	}
+	while ((r->state == 1) && (pos < count)) {
+		unsigned int n = count - pos;
+		if (n > CFGPATH_PROBE_BATCH) n = CFGPATH_PROBE_BATCH;
+		if (cfgpath_uring_probe(r, paths + pos, n, exists + pos) != 0) {
+			if (r->state == 1) {
+				/* Ring works but statx doesn't, so don't try again */
+				cfgpath_uring_teardown(r);
+				r->state = -1;
+			}
+			break;
+		}
+		pos += n;
+		if (stop_at_first) {
+			for (i = pos - n; i < pos; i++) if (exists[i]) break;
+			if (i < pos) break;
+		}
+	}
+	pthread_mutex_unlock(&cfgpath_uring_lock);
+	if (stop_at_first) {
+		for (i = 0; i < pos; i++) {
+			if (exists[i]) {
+				for (i = pos; i < count; i++) exists[i] = 0;
+				return count;
+			}
+		}
+	}
+	return pos;
+}
+#endif
+
+/* Check candidates, filling in exists[].  If stop_at_first is set, candidates
+ * after the first one that exists may not be checked (and are reported as not
+ * existing). */
+static inline void cfgpath_probe_run(const char *const *paths,
+	unsigned int count, int *exists, int stop_at_first)
+{
+#ifdef CFGPATH_LINUX
+	int err = errno;
+#ifndef CFGPATH_NO_IO_URING
+	unsigned int done = cfgpath_probe_uring(paths, count, exists, stop_at_first);
+	paths += done;
+	exists += done;
+	count -= done;
+#endif
+	if (count > 1) {
+		cfgpath_probe_threads(paths, count, exists, stop_at_first);
+	} else if (count == 1) {
+		struct stat st;
+		exists[0] = (cfgpath_fs_stat(paths[0], &st) == 0);
+	}
+	errno = err;
+#else
+	struct stat st;
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		exists[i] = (stat(paths[i], &st) == 0);
+		if (stop_at_first && exists[i]) {
+			for (i++; i < count; i++) exists[i] = 0;
+		}
+	}
+#endif
+}
+
+/** Check which of several paths exist.
+ *
+ * All the checks are started together and the function returns once they have
+ * all finished, so the time taken is roughly that of the slowest check rather
+ * than the total of them all.
+ *
+ * @param paths
+ *   Paths to check.
+ *
+ * @param count
+ *   Number of entries in paths.
+ *
+ * @param exists
+ *   Array of count entries, each set to 1 if the path at the same index in
+ *   paths exists, or 0 if it does not or could not be checked.
+ *
+ * @return Number of paths that exist.
+ */
+static inline unsigned int cfgpath_probe(const char *const *paths,
+	unsigned int count, int *exists)
+{
+	unsigned int i, found = 0;
+	cfgpath_probe_run(paths, count, exists, 0);
+	for (i = 0; i < count; i++) found += exists[i];
+	return found;
+}
+
+/** Find the first of several paths that exists.
+ *
+ * This is for finding which of several candidate files to load, in priority
+ * order.  The checks are started together as for cfgpath_probe(), so
+ * discovering the file costs one round trip rather than one per candidate.
+ *
+ * @param paths
+ *   Paths to check, most important first.
+ *
+ * @param count
+ *   Number of entries in paths.
+ *
+ * @return Index of the first path that exists, or -1 if none of them do.
+ */
+static inline int cfgpath_probe_first(const char *const *paths, unsigned int count)
+{
+	int stack_exists[CFGPATH_PROBE_BATCH];
+	int *exists = stack_exists;
+	if (count > CFGPATH_PROBE_BATCH) {
+		exists = (int *)malloc(count * sizeof(int));
+		if (!exists) return -1;
+	}
+	cfgpath_probe_run(paths, count, exists, 1);
+	int first = -1;
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		if (exists[i]) {
+			first = i;
+			break;
+		}
+	}
+	if (exists != stack_exists) free(exists);
+	return first;
+}
+
+#endif /* CFGPATH_PROBE_H_ */
@@ -0,0 +1,484 @@
+/**
+ * @file  cfgpath-watch.h
+ * @brief Find out when configuration files change, without polling them.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Example use, with cfgpath-overlay.h:
+ *
+ * void settings_changed(void *ctx)
+ * {
+ *     cfgpath_overlay_reload((struct cfgpath_overlay *)ctx);
+ * }
+ *
+ * struct cfgpath_watch watch;
+ * cfgpath_watch_config_file(&watch, "myapp", 200, settings_changed, &settings);
+ * ...
+ * cfgpath_watch_stop(&watch);
+ *
+ * This watches ~/.config/myapp.conf and the fragments in ~/.config/myapp.conf.d/,
+ * which are the files the user edits to change the overlay's settings.
+ *
+ * Each watch has its own thread, which sleeps until the folder changes.  Under
+ * Linux it is woken by inotify.  If inotify is not available (e.g. the
+ * per-user limit on watches has been reached), or CFGPATH_NO_INOTIFY is
+ * defined, the folder is checked every CFGPATH_WATCH_POLL_MS milliseconds
+ * instead.
+ *
+ * A single change to a file is often seen as several events.  An editor
+ * saving a file may write a temporary file, rename the old one as a backup
+ * and rename the temporary file over the original, and a program may write a
+ * file in many small pieces.  The callback is therefore only called once the
+ * folder has been left alone for the debounce time, so each of these is
+ * reported once.
+ */
+
+#ifndef CFGPATH_WATCH_H_
+#define CFGPATH_WATCH_H_
+
+#include "cfgpath.h"
+
+#ifndef CFGPATH_WINDOWS
+#include <stdint.h>
+#include <dirent.h>
+#include <poll.h>
+#include <pthread.h>
+#if defined(__linux__) && !defined(CFGPATH_NO_INOTIFY)
+#define CFGPATH_WATCH_INOTIFY
+#include <sys/inotify.h>
+#endif
+#endif
+
+/* How often to check the folder when inotify can't be used. */
+#ifndef CFGPATH_WATCH_POLL_MS
+#define CFGPATH_WATCH_POLL_MS 1000
+#endif
+
+/** Called on the watch's own thread after a change, see cfgpath_watch_start(). */
+typedef void (*cfgpath_watch_func)(void *ctx);
+
+/** A folder being watched, see cfgpath_watch_start(). */
+struct cfgpath_watch {
+#ifndef CFGPATH_WINDOWS
+	pthread_t thread;
+#endif
+	int wake[2];               /* Pipe written to by cfgpath_watch_stop() */
+	int fd;                    /* inotify handle, or -1 when polling */
+	int wd;                    /* inotify watch on the folder, or -1 if lost */
+	int wd_sub;                /* inotify watch on sub, or -1 if missing */
+	char *folder;
+	char *name;                /* Only entry to watch, or NULL for all */
+	char *sub;                 /* name with ".d" appended, also watched inside */
+	unsigned long long sig;    /* Fingerprint of the folder when polling */
+	unsigned int debounce_ms;
+	cfgpath_watch_func func;
+	void *ctx;
+};
+
+#ifndef CFGPATH_WINDOWS
+/* Does a change to this folder entry count?  in_sub is nonzero for entries in
+ * the sub folder rather than the folder itself.  Hidden files and backups are
+ * the leftovers of editors saving files, which matter only once they are
+ * renamed over a real file. */
+static inline int cfgpath_watch_match(const struct cfgpath_watch *w,
+	const char *name, int in_sub)
+{
+	if (w->name && !in_sub) {
+		if (strcmp(name, w->name) == 0) return 1;
+		if (!w->sub) return 0;
+		size_t name_len = strlen(w->name);
+		return !strncmp(name, w->name, name_len) && !strcmp(name + name_len, ".d");
+	}
+	size_t len = strlen(name);
+	return (len > 0) && (name[0] != '.') && (name[len - 1] != '~');
+}
+
+static inline unsigned long long cfgpath_watch_now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Add everything cfgpath_watch_match() accepts in a folder to a fingerprint,
+ * returning 0 if the folder can't be read. */
+static inline uint64_t cfgpath_watch_hash(const struct cfgpath_watch *w,
+	uint64_t h, const char *folder, int in_sub)
+{
+	DIR *dir = opendir(folder);
+	if (!dir) return 0;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (!cfgpath_watch_match(w, de->d_name, in_sub)) continue;
+		struct stat st;
+		if (fstatat(dirfd(dir), de->d_name, &st, 0) != 0) continue;
+		const unsigned char *p = (const unsigned char *)de->d_name;
+		while (*p) h = (h ^ *p++) * 1099511628211ull;
+		uint64_t v[4] = {
+			(uint64_t)st.st_ino, (uint64_t)st.st_size, (uint64_t)st.st_mtime,
+#ifdef __linux__
+			(uint64_t)st.st_mtim.tv_nsec
+#else
+			0
+#endif
+		};
+		unsigned int i;
+		for (i = 0; i < 4; i++) h = (h ^ v[i]) * 1099511628211ull;
+	}
+	closedir(dir);
+	return h;
+}
+
+/* Fingerprint of the watched entries, which changes whenever one of them is
+ * created, removed, replaced or written to. */
+static inline uint64_t cfgpath_watch_signature(const struct cfgpath_watch *w)
+{
+	uint64_t h = cfgpath_watch_hash(w, 14695981039346656037ull, w->folder, 0);
+	/* A missing sub folder is already covered by the entry for it */
+	if (h && w->sub) {
+		uint64_t sub = cfgpath_watch_hash(w, h, w->sub, 1);
+		if (sub) h = sub;
+	}
+	return h;
+}
+
+#ifdef CFGPATH_WATCH_INOTIFY
+/* Events that can mean a file has finished changing.  IN_MODIFY is left out
+ * as it happens for every write(), with the file only half written. */
+#define CFGPATH_WATCH_EVENTS (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE \
+	| IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF \
+	| IN_ONLYDIR)
+
+/* Read the queued events, returning whether any of them count. */
+static inline int cfgpath_watch_read(struct cfgpath_watch *w)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int changed = 0;
+	for (;;) {
+		ssize_t len = read(w->fd, buf, sizeof(buf));
+		if (len <= 0) break;
+		char *p = buf;
+		while (p < buf + len) {
+			const struct inotify_event *ev = (const struct inotify_event *)p;
+			int *wd = (ev->wd == w->wd) ? &w->wd
+				: (ev->wd == w->wd_sub) ? &w->wd_sub : NULL;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				/* Events were lost */
+				changed = 1;
+			} else if (!wd) {
+				/* Left over from a watch that has already been removed */
+			} else if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+				/* The folder itself went away */
+				if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) {
+					inotify_rm_watch(w->fd, *wd);
+				}
+				*wd = -1;
+				changed = 1;
+			} else if (ev->len && cfgpath_watch_match(w, ev->name, wd == &w->wd_sub)) {
+				changed = 1;
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	return changed;
+}
+#endif
+
+static void *cfgpath_watch_main(void *arg)
+{
+	struct cfgpath_watch *w = (struct cfgpath_watch *)arg;
+	struct pollfd pfd[2];
+	pfd[0].fd = w->wake[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = w->fd;
+	pfd[1].events = POLLIN;
+	int pending = 0;
+	unsigned long long quiet_since = 0;
+	for (;;) {
+		int timeout;
+		if (w->fd < 0) {
+			timeout = CFGPATH_WATCH_POLL_MS;
+		} else if (w->wd < 0) {
+			/* Wait for the folder to come back */
+			timeout = CFGPATH_WATCH_POLL_MS;
+		} else {
+			timeout = -1;
+		}
+		if (pending && (timeout < 0 || (unsigned int)timeout > w->debounce_ms)) {
+			timeout = w->debounce_ms;
+		}
+		int n = poll(pfd, (w->fd < 0) ? 1 : 2, timeout);
+		if ((n < 0) && (errno != EINTR)) break;
+		if ((n > 0) && (pfd[0].revents & POLLIN)) break;
+
+		int changed = 0;
+#ifdef CFGPATH_WATCH_INOTIFY
+		if (w->fd >= 0) {
+			if ((n > 0) && (pfd[1].revents & POLLIN)) changed = cfgpath_watch_read(w);
+			if (w->wd < 0) {
+				w->wd = inotify_add_watch(w->fd, w->folder, CFGPATH_WATCH_EVENTS);
+				/* Anything may have happened while it was gone */
+				if (w->wd >= 0) changed = 1;
+			}
+			/* Creating the sub folder was reported by the watch on the folder */
+			if (w->sub && (w->wd >= 0) && (w->wd_sub < 0)) {
+				w->wd_sub = inotify_add_watch(w->fd, w->sub, CFGPATH_WATCH_EVENTS);
+			}
+		}
+#endif
+		if (w->fd < 0) {
+			uint64_t now_sig = cfgpath_watch_signature(w);
+			if (now_sig != w->sig) {
+				w->sig = now_sig;
+				changed = 1;
+			}
+		}
+
+		unsigned long long now = cfgpath_watch_now_ms();
+		if (changed) {
+			pending = 1;
+			quiet_since = now;
+		} else if (pending && (now - quiet_since >= w->debounce_ms)) {
+			pending = 0;
+			w->func(w->ctx);
+		}
+	}
+	return NULL;
+}
+#endif /* !CFGPATH_WINDOWS */
+
+/* Start a watch, see cfgpath_watch_start().  If with_sub is nonzero, the
+ * entries inside the folder called name with ".d" appended are watched too. */
+static inline int cfgpath_watch_start_ex(struct cfgpath_watch *w,
+	const char *folder, const char *name, int with_sub, unsigned int debounce_ms,
+	cfgpath_watch_func func, void *ctx)
+{
+#ifdef CFGPATH_WINDOWS
+	errno = ENOSYS;
+	return -1;
+#else
+	struct stat st;
+	memset(w, 0, sizeof(*w));
+	w->fd = -1;
+	w->wd = -1;
+	w->wd_sub = -1;
+	w->wake[0] = w->wake[1] = -1;
+	if (stat(folder, &st) != 0) return -1;
+	if (!S_ISDIR(st.st_mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	if (!name) with_sub = 0;
+	size_t folder_len = strlen(folder), name_len = name ? strlen(name) : 0;
+	size_t sub_len = with_sub ? folder_len + 1 + name_len + 2 : 0;
+	w->folder = (char *)malloc(folder_len + 1 + (name ? name_len + 1 : 0)
+		+ (with_sub ? sub_len + 1 : 0));
+	if (!w->folder) {
+		errno = ENOMEM;
+		return -1;
+	}
+	memcpy(w->folder, folder, folder_len + 1);
+	if (name) {
+		w->name = w->folder + folder_len + 1;
+		memcpy(w->name, name, name_len + 1);
+	}
+	if (with_sub) {
+		w->sub = w->name + name_len + 1;
+		int sep = (folder_len > 0) && (folder[folder_len - 1] != '/');
+		snprintf(w->sub, sub_len + 1, "%s%s%s.d", folder, sep ? "/" : "", name);
+	}
+	w->debounce_ms = debounce_ms;
+	w->func = func;
+	w->ctx = ctx;
+
+	if (pipe(w->wake) != 0) {
+		free(w->folder);
+		return -1;
+	}
+	fcntl(w->wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl(w->wake[1], F_SETFD, FD_CLOEXEC);
+#ifdef CFGPATH_WATCH_INOTIFY
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (w->fd >= 0) {
+		w->wd = inotify_add_watch(w->fd, folder, CFGPATH_WATCH_EVENTS);
+		if (w->wd < 0) {
+			/* Out of watches, so fall back to polling */
+			close(w->fd);
+			w->fd = -1;
+		} else if (w->sub) {
+			/* Added by the thread instead if it doesn't exist yet */
+			w->wd_sub = inotify_add_watch(w->fd, w->sub, CFGPATH_WATCH_EVENTS);
+		}
+	}
+#endif
+	/* Taken now, so changes made as soon as this returns are noticed */
+	if (w->fd < 0) w->sig = cfgpath_watch_signature(w);
+	int err = pthread_create(&w->thread, NULL, cfgpath_watch_main, w);
+	if (err != 0) {
+		if (w->fd >= 0) close(w->fd);
+		close(w->wake[0]);
+		close(w->wake[1]);
+		free(w->folder);
+		errno = err;
+		return -1;
+	}
+	return 0;
+#endif
+}
+
+/** Start watching a folder for changes.
+ *
+ * Only the folder itself is watched, not any folders inside it.
+ *
+ * @param w
+ *   Watch to set up.  It must not be moved afterwards, and must be passed to
+ *   cfgpath_watch_stop() when no longer needed.
+ *
+ * @param folder
+ *   Folder to watch, which must exist.
+ *
+ * @param name
+ *   Name of the only entry in the folder to watch, e.g. "myapp.conf", or NULL
+ *   to watch them all.  When watching them all, changes to hidden files and
+ *   backups ending in '~' are ignored.
+ *
+ * @param debounce_ms
+ *   How long the folder must be left alone after a change before func is
+ *   called.
+ *
+ * @param func
+ *   Function to call after each change.  It is called on the watch's own
+ *   thread, and must not call cfgpath_watch_stop().
+ *
+ * @param ctx
+ *   Passed to func.
+ *
+ * @return 0 on success, or -1 on error with errno set (ENOSYS on Windows.)
+ */
+static inline int cfgpath_watch_start(struct cfgpath_watch *w,
+	const char *folder, const char *name, unsigned int debounce_ms,
+	cfgpath_watch_func func, void *ctx)
+{
+	return cfgpath_watch_start_ex(w, folder, name, 0, debounce_ms, func, ctx);
+}
+
+/** Start watching the application's configuration folder.
+ *
+ * This watches the folder from get_user_config_folder(), creating it if
+ * needed.
+ *
+ * @param appname
+ *   Short name of the application, as for get_user_config_folder().
+ *
+ * See cfgpath_watch_start() for the other parameters and the return value.
+ * errno is set to ENOENT if the user's home folder cannot be found.
+ */
+static inline int cfgpath_watch_config(struct cfgpath_watch *w,
+	const char *appname, unsigned int debounce_ms, cfgpath_watch_func func,
+	void *ctx)
+{
+	char folder[MAX_PATH];
+	if (cfgpath_get(CFGPATH_CONFIG_FOLDER, folder, sizeof(folder), appname) <= 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return cfgpath_watch_start(w, folder, NULL, debounce_ms, func, ctx);
+}
+
+/** Start watching a configuration file and its fragments.
+ *
+ * This watches the file, which need not exist yet, along with the *.conf
+ * fragments in the folder of the same name with ".d" appended, as read by
+ * cfgpath-overlay.h.  As editors usually replace a file rather than writing to
+ * it, the folder holding the file is watched, ignoring its other entries.
+ *
+ * @param path
+ *   Path of the file, e.g. "/home/user/.config/myapp.conf".  The folder it is
+ *   in must exist.
+ *
+ * See cfgpath_watch_start() for the other parameters and the return value.
+ */
+static inline int cfgpath_watch_file(struct cfgpath_watch *w, const char *path,
+	unsigned int debounce_ms, cfgpath_watch_func func, void *ctx)
+{
+	char folder[MAX_PATH];
+	const char *name = path + strlen(path);
+	while ((name > path) && (name[-1] != '/') && (name[-1] != PATH_SEPARATOR_CHAR)) {
+		name--;
+	}
+	size_t folder_len = name - path;
+	if ((*name == 0) || (folder_len == 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (folder_len >= sizeof(folder)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(folder, path, folder_len);
+	folder[folder_len] = 0;
+	return cfgpath_watch_start_ex(w, folder, name, 1, debounce_ms, func, ctx);
+}
+
+/** Start watching the application's configuration file.
+ *
+ * This watches the file from get_user_config_file() and its fragments, which
+ * are the files a user edits to change the settings read by
+ * cfgpath_overlay_reload(), see cfgpath_watch_file().  The folder holding the
+ * file is created if needed.
+ *
+ * @param appname
+ *   Short name of the application, as for get_user_config_file().
+ *
+ * See cfgpath_watch_start() for the other parameters and the return value.
+ * errno is set to ENOENT if the user's home folder cannot be found.
+ */
+static inline int cfgpath_watch_config_file(struct cfgpath_watch *w,
+	const char *appname, unsigned int debounce_ms, cfgpath_watch_func func,
+	void *ctx)
+{
+	char path[MAX_PATH];
+	if (cfgpath_get(CFGPATH_CONFIG_FILE, path, sizeof(path), appname) <= 0) {
+		errno = ENOENT;
+		return -1;
+	}
+	return cfgpath_watch_file(w, path, debounce_ms, func, ctx);
+}
+
+/** Stop watching a folder.
+ *
+ * @post The callback is not running and will not be called again.  A change
+ *   still waiting for the debounce time to pass is not reported.
+ */
+static inline void cfgpath_watch_stop(struct cfgpath_watch *w)
+{
+#ifndef CFGPATH_WINDOWS
+	if (!w->folder) return;
+	ssize_t ret;
+	do {
+		ret = write(w->wake[1], "", 1);
+	} while ((ret < 0) && (errno == EINTR));
+	pthread_join(w->thread, NULL);
+	if (w->fd >= 0) close(w->fd);
+	close(w->wake[0]);
+	close(w->wake[1]);
+	free(w->folder);
+	w->folder = NULL;
+	w->name = NULL;
+	w->sub = NULL;
+	w->fd = -1;
+	w->wd = -1;
+	w->wd_sub = -1;
+#endif
+}
+
+/** Is a watch using inotify, rather than checking the folder periodically? */
+static inline int cfgpath_watch_is_inotify(const struct cfgpath_watch *w)
+{
+	return w->fd >= 0;
+}
+
+#endif /* CFGPATH_WATCH_H_ */
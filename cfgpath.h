@@ -45,15 +45,27 @@
 
 #if defined(__linux__) || defined(BSD)
 #define CFGPATH_LINUX
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <time.h>
 #include <sys/stat.h>
 #define MAX_PATH 512  /* arbitrary value */
 #define PATH_SEPARATOR_CHAR '/'
 #define PATH_SEPARATOR_STRING "/"
 #elif defined(WIN32)
 #define CFGPATH_WINDOWS
+#include <stdlib.h>
+#include <string.h>
 #include <shlobj.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 /* MAX_PATH is defined by the Windows API */
 #define PATH_SEPARATOR_CHAR '\\'
 #define PATH_SEPARATOR_STRING "\\"
@@ -68,407 +80,3187 @@
 #error cfgpath.h functions have not been implemented for your platform!  Please send patches.
 #endif
 
-/** Get an absolute path to a single configuration file, specific to this user.
- *
- * This function is useful for programs that need only a single configuration
- * file.  The file is unique to the user account currently logged in.
+/* Thread local variables and atomic operations.  GCC and Clang (including
+ * MinGW) have builtins for these.  The MSVC intrinsics are always full
+ * barriers, so the memory order is ignored there, and only work on 32-bit
+ * values (or pointers, for the _PTR versions). */
+#ifdef _MSC_VER
+#define CFGPATH_THREAD_LOCAL __declspec(thread)
+#define CFGPATH_ATOMIC_LOAD(p, order) _InterlockedOr((volatile long *)(p), 0)
+#define CFGPATH_ATOMIC_STORE(p, v, order) \
+	((void)_InterlockedExchange((volatile long *)(p), (long)(v)))
+#define CFGPATH_ATOMIC_EXCHANGE(p, v, order) \
+	_InterlockedExchange((volatile long *)(p), (long)(v))
+#define CFGPATH_ATOMIC_FETCH_ADD(p, n, order) \
+	_InterlockedExchangeAdd((volatile long *)(p), (long)(n))
+#define CFGPATH_ATOMIC_FETCH_SUB(p, n, order) \
+	_InterlockedExchangeAdd((volatile long *)(p), -(long)(n))
+#define CFGPATH_ATOMIC_LOAD_PTR(p, order) \
+	_InterlockedCompareExchangePointer((void *volatile *)(p), NULL, NULL)
+#define CFGPATH_ATOMIC_EXCHANGE_PTR(p, v, order) \
+	_InterlockedExchangePointer((void *volatile *)(p), (v))
+#else
+#define CFGPATH_THREAD_LOCAL __thread
+#define CFGPATH_ATOMIC_LOAD(p, order) __atomic_load_n((p), order)
+#define CFGPATH_ATOMIC_STORE(p, v, order) __atomic_store_n((p), (v), order)
+#define CFGPATH_ATOMIC_EXCHANGE(p, v, order) __atomic_exchange_n((p), (v), order)
+#define CFGPATH_ATOMIC_FETCH_ADD(p, n, order) __atomic_fetch_add((p), (n), order)
+#define CFGPATH_ATOMIC_FETCH_SUB(p, n, order) __atomic_fetch_sub((p), (n), order)
+#define CFGPATH_ATOMIC_LOAD_PTR(p, order) __atomic_load_n((p), order)
+#define CFGPATH_ATOMIC_EXCHANGE_PTR(p, v, order) __atomic_exchange_n((p), (v), order)
+#endif
+
+/* Initialiser for an array of structures, leaving them all zeroed without a
+ * warning for each field that isn't listed. */
+#ifdef __cplusplus
+#define CFGPATH_ZERO_ARRAY {}
+#else
+#define CFGPATH_ZERO_ARRAY { { 0 } }
+#endif
+
+/* The kinds of path the get_user_*() functions can resolve. */
+enum cfgpath_kind {
+	CFGPATH_CONFIG_FILE,
+	CFGPATH_CONFIG_FOLDER,
+	CFGPATH_DATA_FOLDER,
+	CFGPATH_CACHE_FOLDER,
+	CFGPATH_KIND_COUNT
+};
+
+/** Errors returned by cfgpath_get() and cfgpath_get_async().  All are
+ * negative. */
+enum cfgpath_error {
+	CFGPATH_ERR_NOHOME = -1,  /* The user's home folder could not be found */
+	CFGPATH_ERR_INVALID = -2, /* Unknown kind, NULL appname or unusable path */
+	CFGPATH_ERR_CREATE = -3,  /* The folder could not be created */
+	CFGPATH_ERR_NOMEM = -4,   /* Out of memory */
+	CFGPATH_ERR_NOTFOUND = -5 /* No readable file, see cfgpath_find_file() */
+};
+
+/** Flags for cfgpath_get_ex(), choosing when the folders are created. */
+enum cfgpath_flags {
+	/* Create the folders before returning, like get_user_config_folder() */
+	CFGPATH_CREATE_NOW = 0,
+	/* Only build the path, without touching the filesystem at all */
+	CFGPATH_CREATE_NONE = 1,
+	/* Create the folders later on a background thread, see cfgpath_flush() */
+	CFGPATH_CREATE_DEFERRED = 2,
+	/* Leave it to the caller, see cfgpath_ensure_parent() */
+	CFGPATH_CREATE_LAZY = 3,
+	CFGPATH_CREATE_MASK = 3
+};
+
+/** Lists of system folders to search, see cfgpath_get_system_dirs(). */
+enum cfgpath_search {
+	CFGPATH_SEARCH_CONFIG,  /**< $XDG_CONFIG_DIRS, e.g. /etc/xdg/ */
+	CFGPATH_SEARCH_DATA,    /**< $XDG_DATA_DIRS, e.g. /usr/share/ */
+	CFGPATH_SEARCH_COUNT
+};
+
+/** A list of folders, as returned by cfgpath_get_system_dirs(). */
+struct cfgpath_dirs {
+	unsigned int count;        /**< Number of folders */
+	const char *const *dir;    /**< Each folder, ending in a slash */
+	const unsigned int *len;   /**< Length of each folder */
+};
+
+/* Number of (kind, appname) pairs the resolution cache can hold. */
+#ifndef CFGPATH_CACHE_SIZE
+#define CFGPATH_CACHE_SIZE 16
+#endif
+
+/* Longest appname (excluding terminating null) that will be cached. */
+#define CFGPATH_CACHE_APPNAME_MAX 64
+
+/* Number of home folders the get_user_*_uid() functions can remember. */
+#ifndef CFGPATH_UID_CACHE_SIZE
+#define CFGPATH_UID_CACHE_SIZE 32
+#endif
+
+/** Counters for one kind of path, see cfgpath_stats_get(). */
+struct cfgpath_kind_stats {
+	unsigned long long calls;        /**< Number of times the path was resolved */
+	unsigned long long cache_hits;   /**< Resolutions answered from the cache */
+	unsigned long long getenv_calls; /**< Calls to getenv() */
+	unsigned long long mkdir_calls;  /**< Calls to mkdir() and mkdirat() */
+	unsigned long long open_calls;   /**< Calls to open() and openat() */
+	unsigned long long stat_calls;   /**< Calls to stat() and friends */
+	unsigned long long getpw_calls;  /**< User database lookups */
+	unsigned long long time_ns;      /**< Total time spent resolving */
+	unsigned long long fs_time_ns;   /**< Part of time_ns spent in the above */
+};
+
+/** Statistics collected while cfgpath_stats_enable() is in effect. */
+struct cfgpath_stats {
+	/** Counters for each kind of path, indexed by enum cfgpath_kind */
+	struct cfgpath_kind_stats kind[CFGPATH_KIND_COUNT];
+};
+
+/** Filesystem (and user database) operations reported to hooks. */
+enum cfgpath_fs_op {
+	CFGPATH_FS_MKDIR,  /**< mkdir() or mkdirat() */
+	CFGPATH_FS_OPEN,   /**< open() or openat() */
+	CFGPATH_FS_STAT,   /**< stat() or similar */
+	CFGPATH_FS_GETPW   /**< getpwuid_r(), path is NULL */
+};
+
+/** Callbacks run around each filesystem operation, see cfgpath_set_fs_hooks().
  *
- * Output is typically:
+ * For operations relative to a folder handle (mkdirat() and openat()) the path
+ * given is relative to that folder.
+ */
+struct cfgpath_fs_hooks {
+	/** Called just before the operation, may be NULL. */
+	void (*before)(enum cfgpath_fs_op op, const char *path, void *ctx);
+
+	/** Called just after the operation, may be NULL.  result is the return
+	 *  value, err is errno if the operation failed and elapsed_ns is how long
+	 *  it took. */
+	void (*after)(enum cfgpath_fs_op op, const char *path, int result, int err,
+		unsigned long long elapsed_ns, void *ctx);
+
+	/** Passed to the callbacks. */
+	void *ctx;
+};
+
+#ifdef CFGPATH_LINUX
+/* Nonzero if statistics are being collected. */
+static int cfgpath_stats_enabled;
+
+static struct cfgpath_stats cfgpath_stats;
+
+/* Counters for the path being resolved by this thread, or NULL if none is or
+ * statistics are disabled. */
+static __thread struct cfgpath_kind_stats *cfgpath_stats_cur;
+
+/* Hooks set by cfgpath_set_fs_hooks(), or NULL. */
+static const struct cfgpath_fs_hooks *cfgpath_fs_hooks;
+
+static inline unsigned long long cfgpath_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#define CFGPATH_STATS_ADD(field, n) do { \
+	if (cfgpath_stats_cur) \
+		__atomic_fetch_add(&cfgpath_stats_cur->field, (n), __ATOMIC_RELAXED); \
+} while (0)
+
+/* Start charging statistics to a kind of path.  Nested calls are ignored, so
+ * the work done by one public function is only counted once. */
+struct cfgpath_stats_scope {
+	unsigned long long start;  /* 0 if this scope is not counting */
+};
+
+static inline void cfgpath_stats_begin(struct cfgpath_stats_scope *scope,
+	enum cfgpath_kind kind)
+{
+	scope->start = 0;
+	if (!__atomic_load_n(&cfgpath_stats_enabled, __ATOMIC_RELAXED)) return;
+	if (cfgpath_stats_cur) return;
+	cfgpath_stats_cur = &cfgpath_stats.kind[kind];
+	CFGPATH_STATS_ADD(calls, 1);
+	scope->start = cfgpath_now_ns();
+}
+
+static inline void cfgpath_stats_end(struct cfgpath_stats_scope *scope)
+{
+	if (!scope->start) return;
+	CFGPATH_STATS_ADD(time_ns, cfgpath_now_ns() - scope->start);
+	cfgpath_stats_cur = NULL;
+}
+
+/* Wrap a filesystem operation to run hooks and count it.  Begin returns the
+ * start time, or 0 if nobody is interested in how long it takes. */
+static inline unsigned long long cfgpath_fs_begin(enum cfgpath_fs_op op,
+	const char *path)
+{
+	const struct cfgpath_fs_hooks *hooks =
+		__atomic_load_n(&cfgpath_fs_hooks, __ATOMIC_ACQUIRE);
+	if (hooks && hooks->before) hooks->before(op, path, hooks->ctx);
+	if (!hooks && !cfgpath_stats_cur) return 0;
+	return cfgpath_now_ns();
+}
+
+static inline void cfgpath_fs_end(enum cfgpath_fs_op op, const char *path,
+	int result, unsigned long long start)
+{
+	int err = errno;
+	if (cfgpath_stats_cur) {
+		switch (op) {
+			case CFGPATH_FS_MKDIR: CFGPATH_STATS_ADD(mkdir_calls, 1); break;
+			case CFGPATH_FS_OPEN:  CFGPATH_STATS_ADD(open_calls, 1); break;
+			case CFGPATH_FS_STAT:  CFGPATH_STATS_ADD(stat_calls, 1); break;
+			case CFGPATH_FS_GETPW: CFGPATH_STATS_ADD(getpw_calls, 1); break;
+		}
+	}
+	if (!start) return;
+	unsigned long long elapsed = cfgpath_now_ns() - start;
+	CFGPATH_STATS_ADD(fs_time_ns, elapsed);
+	const struct cfgpath_fs_hooks *hooks =
+		__atomic_load_n(&cfgpath_fs_hooks, __ATOMIC_ACQUIRE);
+	if (hooks && hooks->after) {
+		hooks->after(op, path, result, (result < 0) ? err : 0, elapsed, hooks->ctx);
+	}
+	errno = err;
+}
+
+static inline int cfgpath_fs_mkdirat(int dirfd, const char *path, mode_t mode)
+{
+	unsigned long long start = cfgpath_fs_begin(CFGPATH_FS_MKDIR, path);
+	int ret = (dirfd == AT_FDCWD) ? mkdir(path, mode) : mkdirat(dirfd, path, mode);
+	cfgpath_fs_end(CFGPATH_FS_MKDIR, path, ret, start);
+	return ret;
+}
+
+static inline int cfgpath_fs_openat(int dirfd, const char *path, int flags)
+{
+	unsigned long long start = cfgpath_fs_begin(CFGPATH_FS_OPEN, path);
+	int ret = (dirfd == AT_FDCWD) ? open(path, flags) : openat(dirfd, path, flags);
+	cfgpath_fs_end(CFGPATH_FS_OPEN, path, ret, start);
+	return ret;
+}
+
+static inline int cfgpath_fs_stat(const char *path, struct stat *st)
+{
+	unsigned long long start = cfgpath_fs_begin(CFGPATH_FS_STAT, path);
+	int ret = stat(path, st);
+	cfgpath_fs_end(CFGPATH_FS_STAT, path, ret, start);
+	return ret;
+}
+
+/* path is the name fd was opened with, only used to report to the hooks. */
+static inline int cfgpath_fs_fstat(int fd, const char *path, struct stat *st)
+{
+	unsigned long long start = cfgpath_fs_begin(CFGPATH_FS_STAT, path);
+	int ret = fstat(fd, st);
+	cfgpath_fs_end(CFGPATH_FS_STAT, path, ret, start);
+	return ret;
+}
+
+static inline int cfgpath_fs_access(const char *path, int mode)
+{
+	unsigned long long start = cfgpath_fs_begin(CFGPATH_FS_STAT, path);
+	int ret = access(path, mode);
+	cfgpath_fs_end(CFGPATH_FS_STAT, path, ret, start);
+	return ret;
+}
+
+/* Call getenv(), counting it. */
+static inline const char *cfgpath_getenv_counted(const char *name)
+{
+	CFGPATH_STATS_ADD(getenv_calls, 1);
+	return getenv(name);
+}
+
+/* Environment variables consulted when resolving paths. */
+enum cfgpath_env_var {
+	CFGPATH_ENV_HOME,
+	CFGPATH_ENV_XDG_CONFIG_HOME,
+	CFGPATH_ENV_XDG_DATA_HOME,
+	CFGPATH_ENV_XDG_CACHE_HOME,
+	CFGPATH_ENV_XDG_CONFIG_DIRS,
+	CFGPATH_ENV_XDG_DATA_DIRS,
+	CFGPATH_ENV_XDG_RUNTIME_DIR,
+	CFGPATH_ENV_COUNT
+};
+
+static const char *const cfgpath_env_names[CFGPATH_ENV_COUNT] = {
+	"HOME",
+	"XDG_CONFIG_HOME",
+	"XDG_DATA_HOME",
+	"XDG_CACHE_HOME",
+	"XDG_CONFIG_DIRS",
+	"XDG_DATA_DIRS",
+	"XDG_RUNTIME_DIR",
+};
+
+/* Copy of the environment variables taken by cfgpath_env_refresh(). */
+struct cfgpath_env {
+	struct cfgpath_env *next;  /* Previously taken snapshot */
+	const char *value[CFGPATH_ENV_COUNT];
+};
+
+/* The snapshot in use, or NULL to read the environment directly. */
+static struct cfgpath_env *cfgpath_env_current;
+
+/* Every snapshot ever taken.  Readers do not lock anything, so there is no way
+ * to know when a replaced snapshot is no longer in use.  They are never freed,
+ * which is fine as refreshing is expected to be rare. */
+static struct cfgpath_env *cfgpath_env_all;
+
+/* Take a snapshot of the environment variables.  Returns NULL if out of
+ * memory. */
+static inline struct cfgpath_env *cfgpath_env_capture(void)
+{
+	const char *value[CFGPATH_ENV_COUNT];
+	size_t len[CFGPATH_ENV_COUNT];
+	size_t total = sizeof(struct cfgpath_env);
+	unsigned int i;
+	for (i = 0; i < CFGPATH_ENV_COUNT; i++) {
+		value[i] = cfgpath_getenv_counted(cfgpath_env_names[i]);
+		len[i] = value[i] ? strlen(value[i]) + 1 : 0;
+		total += len[i];
+	}
+
+	struct cfgpath_env *env = (struct cfgpath_env *)malloc(total);
+	if (!env) return NULL;
+	char *data = (char *)(env + 1);
+	for (i = 0; i < CFGPATH_ENV_COUNT; i++) {
+		if (value[i]) {
+			memcpy(data, value[i], len[i]);
+			env->value[i] = data;
+			data += len[i];
+		} else {
+			env->value[i] = NULL;
+		}
+	}
+
+	/* Keep track of it forever, see cfgpath_env_all */
+	env->next = __atomic_load_n(&cfgpath_env_all, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&cfgpath_env_all, &env->next, env, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	return env;
+}
+
+/* Get the value of an environment variable, from the snapshot if there is
+ * one. */
+static inline const char *cfgpath_linux_getenv(enum cfgpath_env_var var)
+{
+	struct cfgpath_env *env = __atomic_load_n(&cfgpath_env_current, __ATOMIC_ACQUIRE);
+#ifdef CFGPATH_ENV_SNAPSHOT
+	if (!env) {
+		/* First use, publish a snapshot unless another thread beat us to it */
+		struct cfgpath_env *snap = cfgpath_env_capture();
+		if (snap) {
+			if (__atomic_compare_exchange_n(&cfgpath_env_current, &env, snap, 0,
+				__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				env = snap;
+			}
+		}
+	}
+#endif
+	if (!env) return cfgpath_getenv_counted(cfgpath_env_names[var]);
+	return env->value[var];
+}
+
+/* A string literal followed by its length. */
+#define CFGPATH_LITERAL(s) s, sizeof(s) - 1
+
+/* Where each kind of path lives, per the XDG Base Directory specification. */
+static const struct cfgpath_linux_kind {
+	enum cfgpath_env_var xdg_env; /* Variable overriding the location */
+	const char *home_dir; /* Location relative to $HOME if xdg_env is unset */
+	unsigned int home_dir_len;
+	const char *suffix;   /* Appended after appname */
+	unsigned int suffix_len;
+	int is_folder;        /* Nonzero if the appname folder should be created */
+} cfgpath_linux_kinds[CFGPATH_KIND_COUNT] = {
+	{ CFGPATH_ENV_XDG_CONFIG_HOME, CFGPATH_LITERAL(".config/"),      CFGPATH_LITERAL(".conf"), 0 },
+	{ CFGPATH_ENV_XDG_CONFIG_HOME, CFGPATH_LITERAL(".config/"),      CFGPATH_LITERAL("/"),     1 },
+	{ CFGPATH_ENV_XDG_DATA_HOME,   CFGPATH_LITERAL(".local/share/"), CFGPATH_LITERAL("/"),     1 },
+	{ CFGPATH_ENV_XDG_CACHE_HOME,  CFGPATH_LITERAL(".cache/"),       CFGPATH_LITERAL("/"),     1 },
+};
+
+/* Check whether a length returned by cfgpath_linux_build() or cfgpath_get() is
+ * a path that was actually written to a buffer of maxlen bytes. */
+static inline int cfgpath_fits(int len, unsigned int maxlen)
+{
+	return (len > 0) && ((unsigned int)len < maxlen);
+}
+
+/* Build a path from environment values that have already been looked up,
+ * without touching the filesystem.  xdg is the value of the kind's xdg_env and
+ * home is $HOME, either of which may be NULL.
  *
- *   Windows: C:\Users\jcitizen\AppData\Roaming\appname.ini
- *   Linux: /home/jcitizen/.config/appname.conf
- *   Mac: /Users/jcitizen/Library/Application Support/appname.conf
+ * Returns the length of the path, excluding the terminating null, like
+ * snprintf().  If this is maxlen or more the path did not fit, and out is set
+ * to an empty string instead (unless maxlen is 0, in which case out may be
+ * NULL).  On success *base_len is set to the length of the leading folder that
+ * appname is appended to, including its trailing slash.  If there is no home
+ * folder, CFGPATH_ERR_NOHOME is returned and out is set to an empty string.
  *
- * @param out
- *   Buffer to write the path.  On return will contain the path, or an empty
- *   string on error.
+ * name starts with the appname, which is app_len characters long.  If name_len
+ * is more than app_len, name already ends with the suffix for the kind (e.g.
+ * "myapp.conf", as assembled at compile time by cfgpath.hpp), otherwise the
+ * suffix is added after it. */
+static inline int cfgpath_linux_build_n(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *name, unsigned int app_len,
+	unsigned int name_len, const char *xdg, const char *home,
+	unsigned int *base_len)
+{
+	const struct cfgpath_linux_kind *k = &cfgpath_linux_kinds[kind];
+	char *out_orig = out;
+	unsigned int config_len = 0;
+	if (xdg) {
+		home = xdg;
+	} else {
+		if (!home) {
+			// Can't find home directory
+			if (maxlen) out[0] = 0;
+			return CFGPATH_ERR_NOHOME;
+		}
+		config_len = k->home_dir_len;
+	}
+
+	unsigned int home_len = strlen(home);
+	unsigned int appname_len = name_len;
+	unsigned int suffix_len = (name_len > app_len) ? 0 : k->suffix_len;
+
+	/* +1 is "/" */
+	unsigned int len = home_len + 1 + config_len + appname_len + suffix_len;
+	if (len >= maxlen) {
+		if (maxlen) out[0] = 0;
+		return len;
+	}
+
+	memcpy(out, home, home_len);
+	out += home_len;
+	*out = '/';
+	out++;
+	memcpy(out, k->home_dir, config_len);
+	out += config_len;
+	*base_len = out - out_orig;
+	memcpy(out, name, appname_len);
+	out += appname_len;
+	memcpy(out, k->suffix, suffix_len);
+	out += suffix_len;
+	*out = '\0';
+	return len;
+}
+
+/* Build a path for a null terminated appname, see cfgpath_linux_build_n(). */
+static inline int cfgpath_linux_build(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname, const char *xdg, const char *home,
+	unsigned int *base_len)
+{
+	unsigned int len = strlen(appname);
+	return cfgpath_linux_build_n(kind, out, maxlen, appname, len, len, xdg, home,
+		base_len);
+}
+
+#ifdef O_PATH
+#define CFGPATH_O_DIR (O_PATH | O_DIRECTORY | O_CLOEXEC)
+#else
+#define CFGPATH_O_DIR (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#endif
+
+/* Make a newly created folder's entry durable, by syncing the folder holding
+ * it.  path[0..len) is the new folder.  It is modified temporarily but
+ * restored before returning.  Returns 0 on success, -1 on error with errno
+ * set. */
+static inline int cfgpath_sync_parent(char *path, unsigned int len)
+{
+	unsigned int end = len;
+	while ((end > 1) && (path[end - 1] == '/')) end--;
+	while ((end > 0) && (path[end - 1] != '/')) end--;
+	while ((end > 1) && (path[end - 1] == '/')) end--;
+	char c = path[end];
+	path[end] = '\0';
+	int fd = cfgpath_fs_openat(AT_FDCWD, end ? path : ".",
+		O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	path[end] = c;
+	if (fd < 0) return -1;
+	int ret = fsync(fd);
+	int err = errno;
+	close(fd);
+	errno = err;
+	return ret;
+}
+
+/* Create a folder and any missing parents, like "mkdir -p".
  *
- * @param maxlen
- *   Length of out.  Must be >= MAX_PATH.
+ * The folder itself is tried first, so when it already exists this costs a
+ * single mkdir() call.  Only if that fails with ENOENT are the parents tried,
+ * working upwards until one can be created or is found to exist.  The missing
+ * components below it are then created with mkdirat() relative to a handle on
+ * that folder, so the kernel does not have to walk the full path again for
+ * each one.
  *
- * @param appname
- *   Short name of the application.  Avoid using spaces or version numbers, and
- *   use lowercase if possible.
+ * If durable is set, the folder holding each folder that is created is synced
+ * as well, so the new folders are still there after a crash.  Nothing extra is
+ * done when the folder already exists.
  *
- * @post The file may or may not exist.
- * @post The folder holding the file is created if needed.
+ * path must be null terminated at len.  It is modified temporarily but restored
+ * before returning.  Returns 0 on success or if the folder already exists, -1
+ * on error with errno set.
  */
-static inline void get_user_config_file(char *out, unsigned int maxlen, const char *appname)
+static inline int cfgpath_mkdir_p_ex(char *path, unsigned int len, mode_t mode,
+	int durable)
 {
-#ifdef CFGPATH_LINUX
-	const char *out_orig = out;
-	char *home = getenv("XDG_CONFIG_HOME");
-	unsigned int config_len = 0;
-	if (!home) {
-		home = getenv("HOME");
-		if (!home) {
-			// Can't find home directory
-			out[0] = 0;
-			return;
+	if (cfgpath_fs_mkdirat(AT_FDCWD, path, mode) == 0) {
+		return durable ? cfgpath_sync_parent(path, len) : 0;
+	}
+	if (errno == EEXIST) return 0;
+	if (errno != ENOENT) return -1;
+
+	/* Handles that are synced can't be opened with O_PATH */
+	int dir_flags = durable ? (O_RDONLY | O_DIRECTORY | O_CLOEXEC) : CFGPATH_O_DIR;
+
+	/* Walk upwards until path[0..end) is a folder that exists */
+	unsigned int end = len;
+	int dirfd;
+	while ((end > 1) && (path[end - 1] == '/')) end--;
+	for (;;) {
+		/* Strip the last component and the slashes before it */
+		while ((end > 0) && (path[end - 1] != '/')) end--;
+		while ((end > 1) && (path[end - 1] == '/')) end--;
+		if (end == 0) {
+			/* Relative path with no parents left to create */
+			dirfd = AT_FDCWD;
+			break;
+		}
+		char c = path[end];
+		path[end] = '\0';
+		int made = (cfgpath_fs_mkdirat(AT_FDCWD, path, mode) == 0);
+		if (made || (errno == EEXIST)) {
+			if (made && durable && (cfgpath_sync_parent(path, end) != 0)) {
+				path[end] = c;
+				return -1;
+			}
+			dirfd = cfgpath_fs_openat(AT_FDCWD, path, dir_flags);
+			path[end] = c;
+			if (dirfd < 0) return -1;
+			break;
+		}
+		path[end] = c;
+		if (errno != ENOENT) return -1;
+	}
+
+	/* Create the remaining components one at a time */
+	int ret = 0;
+	unsigned int pos = end;
+	for (;;) {
+		while ((pos < len) && (path[pos] == '/')) pos++;
+		if (pos >= len) break;
+		unsigned int start = pos;
+		while ((pos < len) && (path[pos] != '/')) pos++;
+		char c = path[pos];
+		path[pos] = '\0';
+		if (cfgpath_fs_mkdirat(dirfd, path + start, mode) == 0) {
+			if (durable && ((dirfd == AT_FDCWD)
+				? cfgpath_sync_parent(path, pos) : fsync(dirfd)) != 0
+			) {
+				ret = -1;
+			}
+		} else if (errno != EEXIST) {
+			ret = -1;
+		}
+		if (!ret && (pos < len)) {
+			int next = cfgpath_fs_openat(dirfd, path + start, dir_flags);
+			if (dirfd >= 0) close(dirfd);
+			dirfd = next;
+			if (dirfd < 0) ret = -1;
+		}
+		path[pos] = c;
+		if (ret) break;
+	}
+	if (dirfd >= 0) {
+		int err = errno;
+		close(dirfd);
+		errno = err;
+	}
+	return ret;
+}
+
+/* Create a folder and any missing parents, see cfgpath_mkdir_p_ex(). */
+static inline int cfgpath_mkdir_p(char *path, unsigned int len, mode_t mode)
+{
+	return cfgpath_mkdir_p_ex(path, len, mode, 0);
+}
+
+/* Position of the slash after the folder that must exist for a path produced
+ * by cfgpath_linux_build().  For a folder this is the folder itself, and for a
+ * file the folder holding it. */
+static inline unsigned int cfgpath_linux_folder_end(enum cfgpath_kind kind,
+	unsigned int len, unsigned int base_len)
+{
+	return cfgpath_linux_kinds[kind].is_folder ? len - 1 : base_len - 1;
+}
+
+/* Create the folders needed by a path produced by cfgpath_linux_build().  The
+ * path is modified temporarily but restored before returning.  Returns 0 on
+ * success, -1 on error with errno set. */
+static inline int cfgpath_linux_create(enum cfgpath_kind kind, char *path,
+	unsigned int len, unsigned int base_len)
+{
+	unsigned int end = cfgpath_linux_folder_end(kind, len, base_len);
+	path[end] = '\0';
+	int ret = cfgpath_mkdir_p(path, end, 0755);
+	path[end] = '/';
+	return ret;
+}
+
+/* Work to be done by the background thread.  Tasks are allocated by whoever
+ * queues them, and run() is responsible for freeing them. */
+struct cfgpath_task {
+	struct cfgpath_task *next;
+	void (*run)(struct cfgpath_task *task);
+};
+
+/* A single background thread, started the first time it is needed. */
+struct cfgpath_worker {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;       /* Signalled when a task is queued */
+	pthread_cond_t idle;       /* Signalled when pending drops to zero */
+	struct cfgpath_task *head; /* Next task to run */
+	struct cfgpath_task *tail; /* Last task queued */
+	unsigned int pending;      /* Tasks queued or running */
+	int started;
+	/* CFGPATH_CREATE_DEFERRED tasks queued or running, so the same folders
+	 * aren't queued again meanwhile */
+	struct cfgpath_create_task *creating;
+};
+
+static struct cfgpath_worker cfgpath_worker = {
+	PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	NULL, NULL, 0, 0, NULL
+};
+
+static void *cfgpath_worker_main(void *arg)
+{
+	struct cfgpath_worker *w = (struct cfgpath_worker *)arg;
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->head) pthread_cond_wait(&w->wake, &w->lock);
+		struct cfgpath_task *task = w->head;
+		w->head = task->next;
+		if (!w->head) w->tail = NULL;
+		pthread_mutex_unlock(&w->lock);
+		task->run(task);
+		pthread_mutex_lock(&w->lock);
+		if (--w->pending == 0) pthread_cond_broadcast(&w->idle);
+	}
+	return NULL;
+}
+
+/* The thread does not exist in a child process, and the lock may have been
+ * held by another thread when fork() was called, so start again from scratch.
+ * Anything still queued is dropped as the parent will take care of it. */
+static void cfgpath_worker_atfork_child(void)
+{
+	static const struct cfgpath_worker init = {
+		PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		NULL, NULL, 0, 0, NULL
+	};
+	memcpy(&cfgpath_worker, &init, sizeof(init));
+}
+
+/* Queue a task for the background thread, starting it if needed.  If the
+ * thread cannot be started the task is run immediately instead. */
+static inline void cfgpath_worker_submit(struct cfgpath_task *task)
+{
+	static int atfork_done;
+	struct cfgpath_worker *w = &cfgpath_worker;
+	task->next = NULL;
+	pthread_mutex_lock(&w->lock);
+	if (!w->started) {
+		pthread_attr_t attr;
+		pthread_t thread;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		w->started = (pthread_create(&thread, &attr, cfgpath_worker_main, w) == 0);
+		pthread_attr_destroy(&attr);
+		if (w->started && !atfork_done) {
+			pthread_atfork(NULL, NULL, cfgpath_worker_atfork_child);
+			atfork_done = 1;
+		}
+	}
+	if (!w->started) {
+		pthread_mutex_unlock(&w->lock);
+		task->run(task);
+		return;
+	}
+	if (w->tail) {
+		w->tail->next = task;
+	} else {
+		w->head = task;
+	}
+	w->tail = task;
+	w->pending++;
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Wait until the background thread has finished everything queued so far. */
+static inline void cfgpath_worker_wait(void)
+{
+	struct cfgpath_worker *w = &cfgpath_worker;
+	pthread_mutex_lock(&w->lock);
+	while (w->pending) pthread_cond_wait(&w->idle, &w->lock);
+	pthread_mutex_unlock(&w->lock);
+}
+
+/* Folder creation queued by CFGPATH_CREATE_DEFERRED, followed by the path. */
+struct cfgpath_create_task {
+	struct cfgpath_task task;  /* Must be first */
+	struct cfgpath_create_task *next_creating;  /* See cfgpath_worker.creating */
+	enum cfgpath_kind kind;
+	unsigned int len;
+	unsigned int base_len;
+};
+
+static void cfgpath_create_task_run(struct cfgpath_task *task)
+{
+	struct cfgpath_create_task *t = (struct cfgpath_create_task *)task;
+	struct cfgpath_worker *w = &cfgpath_worker;
+	cfgpath_linux_create(t->kind, (char *)(t + 1), t->len, t->base_len);
+	pthread_mutex_lock(&w->lock);
+	struct cfgpath_create_task **link = &w->creating;
+	while (*link != t) link = &(*link)->next_creating;
+	*link = t->next_creating;
+	pthread_mutex_unlock(&w->lock);
+	free(t);
+}
+
+/* Create the folders for a path produced by cfgpath_linux_build() as chosen by
+ * the CFGPATH_CREATE_* value in flags. */
+static inline void cfgpath_linux_create_as(enum cfgpath_kind kind, char *path,
+	unsigned int len, unsigned int base_len, unsigned int flags)
+{
+	switch (flags & CFGPATH_CREATE_MASK) {
+		case CFGPATH_CREATE_NOW:
+			cfgpath_linux_create(kind, path, len, base_len);
+			break;
+		case CFGPATH_CREATE_DEFERRED: {
+			/* Programs often ask for the same path over and over, so only queue
+			 * it if it isn't already waiting */
+			struct cfgpath_worker *w = &cfgpath_worker;
+			struct cfgpath_create_task *t;
+			pthread_mutex_lock(&w->lock);
+			for (t = w->creating; t; t = t->next_creating) {
+				if ((t->kind == kind) && (t->len == len) && !memcmp(t + 1, path, len)) break;
+			}
+			if (t) {
+				pthread_mutex_unlock(&w->lock);
+				break;
+			}
+			t = (struct cfgpath_create_task *)malloc(
+				sizeof(struct cfgpath_create_task) + len + 1);
+			if (!t) {
+				/* It's only a hint, the caller can't rely on it anyway */
+				pthread_mutex_unlock(&w->lock);
+				break;
+			}
+			t->task.run = cfgpath_create_task_run;
+			t->kind = kind;
+			t->len = len;
+			t->base_len = base_len;
+			memcpy(t + 1, path, len + 1);
+			t->next_creating = w->creating;
+			w->creating = t;
+			pthread_mutex_unlock(&w->lock);
+			cfgpath_worker_submit(&t->task);
+			break;
 		}
-		config_len = strlen(".config/");
+		default:
+			break;
+	}
+}
+
+/* Resolve a path from environment values that have already been looked up,
+ * creating any folders needed as chosen by flags.  name, app_len and name_len
+ * are as for cfgpath_linux_build_n().  Returns the same as
+ * cfgpath_linux_build(), and nothing is created unless the path fits in out. */
+static inline int cfgpath_linux_resolve_from(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *name, unsigned int app_len,
+	unsigned int name_len, const char *xdg, const char *home, unsigned int flags)
+{
+	unsigned int base_len;
+	int len = cfgpath_linux_build_n(kind, out, maxlen, name, app_len, name_len,
+		xdg, home, &base_len);
+	if (cfgpath_fits(len, maxlen)) {
+		cfgpath_linux_create_as(kind, out, len, base_len, flags);
+	}
+	return len;
+}
+
+/* Resolve a path without consulting the cache.  See cfgpath_linux_build_n()
+ * and cfgpath_get_ex() for the meaning of the parameters and return value. */
+static inline int cfgpath_linux_resolve(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *name, unsigned int app_len,
+	unsigned int name_len, unsigned int flags)
+{
+	const char *xdg = cfgpath_linux_getenv(cfgpath_linux_kinds[kind].xdg_env);
+	const char *home = xdg ? NULL : cfgpath_linux_getenv(CFGPATH_ENV_HOME);
+	return cfgpath_linux_resolve_from(kind, out, maxlen, name, app_len, name_len,
+		xdg, home, flags);
+}
+
+/* A previously resolved path.  The environment variable the path was built
+ * from is recorded so that a change to it can be detected. */
+struct cfgpath_cache_entry {
+	int used;
+	enum cfgpath_kind kind;
+	char appname[CFGPATH_CACHE_APPNAME_MAX + 1];
+	int from_xdg;          /* Path came from xdg_env rather than $HOME */
+	unsigned int env_len;  /* Length of the environment value at path[0] */
+	unsigned int path_len;
+	char path[MAX_PATH];
+	int fd;                /* Open handle on the folder, or -1 */
+};
+
+struct cfgpath_cache {
+	pthread_mutex_t lock;  /* Held while modifying the cache */
+	unsigned int seq;      /* Odd while the cache is being modified */
+	int enabled;
+	unsigned int next;     /* Slot to replace on the next miss */
+	struct cfgpath_cache_entry entry[CFGPATH_CACHE_SIZE];
+};
+
+/* Number of times cfgpath_cache_read() retries while a writer holds the cache
+ * before giving up and resolving the path directly. */
+#ifndef CFGPATH_CACHE_READ_TRIES
+#define CFGPATH_CACHE_READ_TRIES 64
+#endif
+
+/* Paths returned by the get_user_*() functions, see cfgpath_cache_enable() */
+static struct cfgpath_cache cfgpath_cache = {
+	PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, CFGPATH_ZERO_ARRAY
+};
+
+/* Folder handles returned by the get_user_*_fd() functions */
+static struct cfgpath_cache cfgpath_fd_cache = {
+	PTHREAD_MUTEX_INITIALIZER, 0, 1, 0, CFGPATH_ZERO_ARRAY
+};
+
+/* Tell the CPU this thread is spinning, so a writer on a sibling hyperthread
+ * is not starved. */
+static inline void cfgpath_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/* Check whether a cache is in use, without taking its lock. */
+static inline int cfgpath_cache_enabled(struct cfgpath_cache *c)
+{
+	return __atomic_load_n(&c->enabled, __ATOMIC_ACQUIRE);
+}
+
+/* Lock a cache for modification.  Lock-free readers of the cache will retry
+ * until cfgpath_cache_write_end() is called. */
+static inline void cfgpath_cache_write_begin(struct cfgpath_cache *c)
+{
+	pthread_mutex_lock(&c->lock);
+	__atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void cfgpath_cache_write_end(struct cfgpath_cache *c)
+{
+	__atomic_store_n(&c->seq, c->seq + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&c->lock);
+}
+
+/* Handles dropped from cfgpath_fd_cache.  They have already been given out and
+ * may still be in use, so they stay open until cfgpath_close_folder_fds(), as
+ * closing one would let its number be reused for an unrelated file.  Protected
+ * by the cfgpath_fd_cache lock. */
+static struct {
+	int *fd;
+	unsigned int count;
+	unsigned int size;
+} cfgpath_fd_retired;
+
+/* Remove an entry from a cache.  A folder handle is kept open, see
+ * cfgpath_fd_retired.  The cache must be locked. */
+static inline void cfgpath_cache_drop(struct cfgpath_cache_entry *e)
+{
+	if (e->used && (e->fd >= 0)) {
+		if (cfgpath_fd_retired.count == cfgpath_fd_retired.size) {
+			unsigned int size = cfgpath_fd_retired.size ? cfgpath_fd_retired.size * 2 : 16;
+			int *grown = (int *)realloc(cfgpath_fd_retired.fd, size * sizeof(int));
+			if (grown) {
+				cfgpath_fd_retired.fd = grown;
+				cfgpath_fd_retired.size = size;
+			}
+		}
+		/* If there is no room the handle is leaked rather than closed */
+		if (cfgpath_fd_retired.count < cfgpath_fd_retired.size) {
+			cfgpath_fd_retired.fd[cfgpath_fd_retired.count++] = e->fd;
+		}
+	}
+	e->used = 0;
+}
+
+/* Remove all entries from a cache. */
+static inline void cfgpath_cache_clear(struct cfgpath_cache *c)
+{
+	cfgpath_cache_write_begin(c);
+	unsigned int i;
+	for (i = 0; i < CFGPATH_CACHE_SIZE; i++) cfgpath_cache_drop(&c->entry[i]);
+	cfgpath_cache_write_end(c);
+}
+
+/* Check whether a cache entry still matches the current environment. */
+static inline int cfgpath_cache_entry_valid(const struct cfgpath_cache_entry *e)
+{
+	const char *env = cfgpath_linux_getenv(cfgpath_linux_kinds[e->kind].xdg_env);
+	if ((env != NULL) != e->from_xdg) return 0;
+	if (!env) {
+		env = cfgpath_linux_getenv(CFGPATH_ENV_HOME);
+		if (!env) return 0;
+	}
+	if (e->env_len > e->path_len) return 0; /* torn read, see cfgpath_cache_read() */
+	return (strlen(env) == e->env_len) && (memcmp(env, e->path, e->env_len) == 0);
+}
+
+/* Find the entry for a (kind, appname) pair.  Entries that no longer match the
+ * environment are dropped.  The cache must be locked.  Returns NULL if there is
+ * no valid entry. */
+static inline struct cfgpath_cache_entry *cfgpath_cache_find(
+	struct cfgpath_cache *c, enum cfgpath_kind kind, const char *appname)
+{
+	unsigned int i;
+	for (i = 0; i < CFGPATH_CACHE_SIZE; i++) {
+		struct cfgpath_cache_entry *e = &c->entry[i];
+		if (!e->used || (e->kind != kind) || strcmp(e->appname, appname)) continue;
+		if (!cfgpath_cache_entry_valid(e)) {
+			cfgpath_cache_drop(e);
+			return NULL;
+		}
+		return e;
+	}
+	return NULL;
+}
+
+/* Check whether an entry is for a (kind, appname) pair, where appname is len
+ * characters long and need not be null terminated. */
+static inline int cfgpath_cache_entry_is(const struct cfgpath_cache_entry *e,
+	enum cfgpath_kind kind, const char *appname, unsigned int len)
+{
+	return e->used && (e->kind == kind) && (len <= CFGPATH_CACHE_APPNAME_MAX)
+		&& !memcmp(e->appname, appname, len) && (e->appname[len] == 0);
+}
+
+/* Copy the path for a (kind, appname) pair out of a cache without locking it.
+ * This is a seqlock reader: if the cache is modified while the entry is being
+ * copied the lookup is retried, so a half-written entry is never returned.
+ * Returns -1 if the pair was not found, or the cache was busy for
+ * CFGPATH_CACHE_READ_TRIES attempts, otherwise the length of the path as for
+ * cfgpath_linux_build(), in which case out contains the path (or an empty
+ * string if maxlen is too small). */
+static inline int cfgpath_cache_read(struct cfgpath_cache *c,
+	enum cfgpath_kind kind, const char *appname, unsigned int appname_len,
+	char *out, unsigned int maxlen)
+{
+	unsigned int tries;
+	for (tries = 0; tries < CFGPATH_CACHE_READ_TRIES; tries++) {
+		unsigned int seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1) {
+			cfgpath_cpu_relax();
+			continue;
+		}
+
+		int found = -1;
+		unsigned int i;
+		for (i = 0; i < CFGPATH_CACHE_SIZE; i++) {
+			const struct cfgpath_cache_entry *e = &c->entry[i];
+			if (!cfgpath_cache_entry_is(e, kind, appname, appname_len)) continue;
+			unsigned int len = e->path_len;
+			if ((len >= MAX_PATH) || !cfgpath_cache_entry_valid(e)) break;
+			if (len + 1 > maxlen) {
+				if (maxlen) out[0] = 0;
+			} else {
+				memcpy(out, e->path, len);
+				out[len] = 0;
+			}
+			found = len;
+			break;
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq) return found;
+		cfgpath_cpu_relax();
+	}
+	return -1;
+}
+
+/* Add a newly resolved path to a cache, replacing any stale entry for the same
+ * pair, or the oldest entry if the cache is full.  The cache must be locked.
+ * Returns NULL if the path cannot be cached, in which case fd is left open. */
+static inline struct cfgpath_cache_entry *cfgpath_cache_add(
+	struct cfgpath_cache *c, enum cfgpath_kind kind, const char *appname,
+	unsigned int appname_len, const char *path, int fd)
+{
+	unsigned int path_len = strlen(path);
+	if ((appname_len > CFGPATH_CACHE_APPNAME_MAX) || (path_len >= MAX_PATH)) {
+		/* Too long to cache, so it will be resolved every time */
+		return NULL;
+	}
+	const char *env = cfgpath_linux_getenv(cfgpath_linux_kinds[kind].xdg_env);
+	int from_xdg = (env != NULL);
+	if (!env) env = cfgpath_linux_getenv(CFGPATH_ENV_HOME);
+	if (!env) return NULL;
+
+	struct cfgpath_cache_entry *e = NULL;
+	unsigned int i;
+	for (i = 0; i < CFGPATH_CACHE_SIZE; i++) {
+		if (cfgpath_cache_entry_is(&c->entry[i], kind, appname, appname_len)) {
+			e = &c->entry[i];
+			break;
+		}
+	}
+	if (!e) {
+		e = &c->entry[c->next];
+		c->next = (c->next + 1) % CFGPATH_CACHE_SIZE;
 	}
+	cfgpath_cache_drop(e);
+	e->used = 1;
+	e->kind = kind;
+	memcpy(e->appname, appname, appname_len);
+	e->appname[appname_len] = 0;
+	e->from_xdg = from_xdg;
+	e->env_len = strlen(env);
+	e->path_len = path_len;
+	memcpy(e->path, path, path_len + 1);
+	e->fd = fd;
+	return e;
+}
+
+/* Resolve a path, using the cache if it has been enabled.  See
+ * cfgpath_linux_build_n() and cfgpath_get_ex() for the meaning of the
+ * parameters and return value. */
+static inline int cfgpath_linux_get_n(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *name, unsigned int app_len,
+	unsigned int name_len, unsigned int flags)
+{
+	struct cfgpath_stats_scope scope;
+	cfgpath_stats_begin(&scope, kind);
+
+	int len;
+	if (!cfgpath_cache_enabled(&cfgpath_cache)) {
+		len = cfgpath_linux_resolve(kind, out, maxlen, name, app_len, name_len, flags);
+	} else if ((len = cfgpath_cache_read(&cfgpath_cache, kind, name, app_len, out,
+		maxlen)) >= 0
+	) {
+		CFGPATH_STATS_ADD(cache_hits, 1);
+	} else {
+		len = cfgpath_linux_resolve(kind, out, maxlen, name, app_len, name_len, flags);
+		/* Only cache paths whose folders are known to exist, as a cached path
+		 * is returned without creating anything */
+		if (cfgpath_fits(len, maxlen)
+			&& ((flags & CFGPATH_CREATE_MASK) == CFGPATH_CREATE_NOW)
+		) {
+			cfgpath_cache_write_begin(&cfgpath_cache);
+			cfgpath_cache_add(&cfgpath_cache, kind, name, app_len, out, -1);
+			cfgpath_cache_write_end(&cfgpath_cache);
+		}
+	}
+
+	cfgpath_stats_end(&scope);
+	return len;
+}
+
+/* Resolve a path for a null terminated appname, see cfgpath_linux_get_n(). */
+static inline int cfgpath_linux_get_ex(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname, unsigned int flags)
+{
+	unsigned int len = strlen(appname);
+	return cfgpath_linux_get_n(kind, out, maxlen, appname, len, len, flags);
+}
+
+/* Resolve a path, creating the folders immediately. */
+static inline int cfgpath_linux_get(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname)
+{
+	return cfgpath_linux_get_ex(kind, out, maxlen, appname, CFGPATH_CREATE_NOW);
+}
+
+/* Resolution queued by cfgpath_get_async(), followed by the path and then the
+ * appname, both null terminated. */
+struct cfgpath_async_task {
+	struct cfgpath_task task;  /* Must be first */
+	enum cfgpath_kind kind;
+	unsigned int len;
+	unsigned int base_len;
+	void (*func)(int result, const char *path, void *ctx);
+	void *ctx;
+};
+
+static void cfgpath_async_task_run(struct cfgpath_task *task)
+{
+	struct cfgpath_async_task *t = (struct cfgpath_async_task *)task;
+	char *path = (char *)(t + 1);
+	int result = t->len;
+	if (cfgpath_linux_create(t->kind, path, t->len, t->base_len) != 0) {
+		result = CFGPATH_ERR_CREATE;
+	} else {
+		/* mkdir() succeeds with EEXIST for a file too, so check what's there */
+		struct stat st;
+		unsigned int end = cfgpath_linux_folder_end(t->kind, t->len, t->base_len);
+		path[end] = '\0';
+		if (cfgpath_fs_stat(path, &st) != 0) {
+			result = CFGPATH_ERR_CREATE;
+		} else if (!S_ISDIR(st.st_mode)) {
+			errno = ENOTDIR;
+			result = CFGPATH_ERR_CREATE;
+		}
+		path[end] = '/';
+	}
+	if ((result > 0) && cfgpath_cache_enabled(&cfgpath_cache)) {
+		cfgpath_cache_write_begin(&cfgpath_cache);
+		const char *appname = path + t->len + 1;
+		cfgpath_cache_add(&cfgpath_cache, t->kind, appname, strlen(appname), path, -1);
+		cfgpath_cache_write_end(&cfgpath_cache);
+	}
+	t->func(result, path, t->ctx);
+	free(t);
+}
+
+/* Get a cached handle on a folder, opening it on the first call. */
+static inline int cfgpath_linux_get_fd(enum cfgpath_kind kind, const char *appname)
+{
+	struct cfgpath_stats_scope scope;
+	cfgpath_stats_begin(&scope, kind);
+
+	cfgpath_cache_write_begin(&cfgpath_fd_cache);
+	struct cfgpath_cache_entry *e = cfgpath_cache_find(&cfgpath_fd_cache, kind, appname);
+	if (e) {
+		int fd = e->fd;
+		cfgpath_cache_write_end(&cfgpath_fd_cache);
+		CFGPATH_STATS_ADD(cache_hits, 1);
+		cfgpath_stats_end(&scope);
+		return fd;
+	}
+	cfgpath_cache_write_end(&cfgpath_fd_cache);
+
+	char path[MAX_PATH];
+	int fd = -1;
+	cfgpath_linux_get(kind, path, sizeof(path), appname);
+	if (path[0] == 0) {
+		errno = ENOENT;
+	} else {
+		fd = cfgpath_fs_openat(AT_FDCWD, path, CFGPATH_O_DIR);
+	}
+	if (fd >= 0) {
+		cfgpath_cache_write_begin(&cfgpath_fd_cache);
+		/* Another thread may have opened the folder while the lock was released */
+		e = cfgpath_cache_find(&cfgpath_fd_cache, kind, appname);
+		if (e) {
+			close(fd);
+			fd = e->fd;
+		} else if (!cfgpath_cache_add(&cfgpath_fd_cache, kind, appname,
+			strlen(appname), path, fd)
+		) {
+			/* Can't be cached, so it would leak */
+			close(fd);
+			errno = ENAMETOOLONG;
+			fd = -1;
+		}
+		cfgpath_cache_write_end(&cfgpath_fd_cache);
+	}
+
+	cfgpath_stats_end(&scope);
+	return fd;
+}
+
+/* Home folders looked up from the user database, indexed by a hash of the uid.
+ * Users that could not be found are remembered too, so a missing account does
+ * not cause a slow directory server to be queried over and over. */
+struct cfgpath_uid_entry {
+	int used;
+	uid_t uid;
+	int found;             /* Nonzero if the user exists and has a home folder */
+	char home[MAX_PATH];
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct cfgpath_uid_entry entry[CFGPATH_UID_CACHE_SIZE];
+} cfgpath_uid_cache = { PTHREAD_MUTEX_INITIALIZER, CFGPATH_ZERO_ARRAY };
+
+/* Look up the home folder of a user in the user database, without caching.
+ * Returns 0 on success or -1 if the user or their home folder could not be
+ * found or does not fit in maxlen. */
+static inline int cfgpath_getpw_home(uid_t uid, char *out, unsigned int maxlen)
+{
+	struct passwd pw, *result = NULL;
+	char stack_buf[1024];
+	char *buf = stack_buf;
+	size_t buf_len = sizeof(stack_buf);
+	int err;
+	for (;;) {
+		unsigned long long start = cfgpath_fs_begin(CFGPATH_FS_GETPW, NULL);
+		err = getpwuid_r(uid, &pw, buf, buf_len, &result);
+		if (err) errno = err;
+		cfgpath_fs_end(CFGPATH_FS_GETPW, NULL, err ? -1 : 0, start);
+		if (err != ERANGE) break;
+		/* Entry is too large for the buffer, try again with a bigger one */
+		if (buf != stack_buf) free(buf);
+		buf_len *= 2;
+		buf = (char *)malloc(buf_len);
+		if (!buf) return -1;
+	}
+	int ret = -1;
+	if ((err == 0) && result && result->pw_dir && result->pw_dir[0]) {
+		size_t len = strlen(result->pw_dir);
+		if (len + 1 <= maxlen) {
+			memcpy(out, result->pw_dir, len + 1);
+			ret = 0;
+		}
+	}
+	if (buf != stack_buf) free(buf);
+	return ret;
+}
+
+/* Look up the home folder of a user, using the cache where possible. */
+static inline int cfgpath_uid_home(uid_t uid, char *out, unsigned int maxlen)
+{
+	struct cfgpath_uid_entry *e =
+		&cfgpath_uid_cache.entry[(uid * 2654435761u) % CFGPATH_UID_CACHE_SIZE];
+	int ret;
+
+	pthread_mutex_lock(&cfgpath_uid_cache.lock);
+	if (e->used && (e->uid == uid)) {
+		ret = -1;
+		if (e->found) {
+			size_t len = strlen(e->home);
+			if (len + 1 <= maxlen) {
+				memcpy(out, e->home, len + 1);
+				ret = 0;
+			}
+		}
+		pthread_mutex_unlock(&cfgpath_uid_cache.lock);
+		return ret;
+	}
+	pthread_mutex_unlock(&cfgpath_uid_cache.lock);
+
+	/* Don't hold the lock while the user database is queried, as it may be a
+	 * slow network service */
+	char home[MAX_PATH];
+	int found = (cfgpath_getpw_home(uid, home, sizeof(home)) == 0);
+
+	pthread_mutex_lock(&cfgpath_uid_cache.lock);
+	e->used = 1;
+	e->uid = uid;
+	e->found = found;
+	if (found) strcpy(e->home, home);
+	pthread_mutex_unlock(&cfgpath_uid_cache.lock);
+
+	if (!found || (strlen(home) + 1 > maxlen)) return -1;
+	strcpy(out, home);
+	return 0;
+}
+
+/* Resolve a path for a given user. */
+static inline void cfgpath_linux_resolve_uid(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname, uid_t uid)
+{
+	struct cfgpath_stats_scope scope;
+	cfgpath_stats_begin(&scope, kind);
+
+	char home[MAX_PATH];
+	if ((uid == getuid())
+		/* The environment belongs to this user, so use it if it's there */
+		&& (cfgpath_linux_getenv(cfgpath_linux_kinds[kind].xdg_env)
+			|| cfgpath_linux_getenv(CFGPATH_ENV_HOME))
+	) {
+		cfgpath_linux_get(kind, out, maxlen, appname);
+	} else if (cfgpath_uid_home(uid, home, sizeof(home)) != 0) {
+		out[0] = 0;
+	} else {
+		unsigned int base_len;
+		int len = cfgpath_linux_build(kind, out, maxlen, appname, NULL,
+			home, &base_len);
+		/* Folders created for another user would be owned by the wrong account */
+		if (cfgpath_fits(len, maxlen) && (uid == geteuid())) {
+			cfgpath_linux_create(kind, out, len, base_len);
+		}
+	}
+
+	cfgpath_stats_end(&scope);
+}
+
+/* A parsed $XDG_CONFIG_DIRS or $XDG_DATA_DIRS, allocated as a single block
+ * holding this structure, the dir and len arrays, and then the strings. */
+struct cfgpath_dirs_list {
+	struct cfgpath_dirs dirs;
+	struct cfgpath_dirs_list *next;  /* Previously parsed list */
+	const char *source;              /* Value that was parsed, NULL if default */
+};
+
+/* Where each list comes from, and its value if the variable is unset. */
+static const struct {
+	enum cfgpath_env_var env;
+	const char *fallback;
+} cfgpath_search_lists[CFGPATH_SEARCH_COUNT] = {
+	{ CFGPATH_ENV_XDG_CONFIG_DIRS, "/etc/xdg" },
+	{ CFGPATH_ENV_XDG_DATA_DIRS,   "/usr/local/share/:/usr/share/" },
+};
+
+/* The most recently parsed lists. */
+static struct cfgpath_dirs_list *cfgpath_dirs_current[CFGPATH_SEARCH_COUNT];
+
+/* Every list ever parsed.  Like cfgpath_env_all these are never freed, as the
+ * caller may still be looking at a list when it is replaced. */
+static struct cfgpath_dirs_list *cfgpath_dirs_all;
+
+/* Split a colon separated list of folders, as found in $XDG_CONFIG_DIRS.
+ * Empty and relative entries are ignored, as the XDG spec requires, and each
+ * folder is given a single trailing slash.  Returns NULL if out of memory. */
+static inline struct cfgpath_dirs_list *cfgpath_dirs_parse(const char *value,
+	const char *source)
+{
+	/* First pass to work out how much space is needed */
+	unsigned int count = 0;
+	size_t chars = 0;
+	const char *p = value, *end;
+	for (; *p; p = *end ? end + 1 : end) {
+		end = strchr(p, ':');
+		if (!end) end = p + strlen(p);
+		if (*p == '/') {
+			count++;
+			chars += (end - p) + 2; /* maybe a slash, and terminating null */
+		}
+	}
+	size_t source_len = source ? strlen(source) + 1 : 0;
+	struct cfgpath_dirs_list *list = (struct cfgpath_dirs_list *)malloc(
+		sizeof(struct cfgpath_dirs_list) + count * sizeof(const char *)
+		+ count * sizeof(unsigned int) + chars + source_len);
+	if (!list) return NULL;
+	const char **dir = (const char **)(list + 1);
+	unsigned int *len = (unsigned int *)(dir + count);
+	char *data = (char *)(len + count);
+
+	count = 0;
+	for (p = value; *p; p = *end ? end + 1 : end) {
+		end = strchr(p, ':');
+		if (!end) end = p + strlen(p);
+		if (*p != '/') continue;
+		unsigned int n = end - p;
+		while ((n > 1) && (p[n - 1] == '/')) n--;
+		dir[count] = data;
+		memcpy(data, p, n);
+		if (data[n - 1] != '/') data[n++] = '/';
+		data[n] = '\0';
+		len[count++] = n;
+		data += n + 1;
+	}
+	list->dirs.count = count;
+	list->dirs.dir = dir;
+	list->dirs.len = len;
+	list->source = NULL;
+	if (source) {
+		memcpy(data, source, source_len);
+		list->source = data;
+	}
+	return list;
+}
+
+/* Get a list of system folders, parsing the environment variable only if it
+ * has changed since last time.  Returns NULL if out of memory. */
+static inline const struct cfgpath_dirs *cfgpath_linux_dirs(enum cfgpath_search which)
+{
+	const char *value = cfgpath_linux_getenv(cfgpath_search_lists[which].env);
+	if (value && !value[0]) value = NULL; /* empty is the same as unset */
+
+	struct cfgpath_dirs_list *list =
+		__atomic_load_n(&cfgpath_dirs_current[which], __ATOMIC_ACQUIRE);
+	if (list && (value
+		? (list->source && !strcmp(list->source, value))
+		: !list->source)
+	) {
+		return &list->dirs;
+	}
+
+	list = cfgpath_dirs_parse(value ? value : cfgpath_search_lists[which].fallback,
+		value);
+	if (!list) return NULL;
+	/* Keep track of it forever, see cfgpath_dirs_all */
+	list->next = __atomic_load_n(&cfgpath_dirs_all, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&cfgpath_dirs_all, &list->next, list, 1,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	__atomic_store_n(&cfgpath_dirs_current[which], list, __ATOMIC_RELEASE);
+	return &list->dirs;
+}
+
+/* Folder holding the per-user runtime folders when $XDG_RUNTIME_DIR is unset. */
+#ifndef CFGPATH_RUNTIME_TMP
+#define CFGPATH_RUNTIME_TMP "/tmp"
+#endif
+
+#define CFGPATH_O_PRIVATE (O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+
+/* Check an open folder belongs to this user and nobody else can use it.  If
+ * tighten is set, group and other permissions are removed rather than being
+ * treated as an error.  path is what fd was opened with, for the hooks.
+ * Returns 0 if the folder is private, -1 with errno set otherwise. */
+static inline int cfgpath_runtime_check(int fd, const char *path, int tighten)
+{
+	struct stat st;
+	if (cfgpath_fs_fstat(fd, path, &st) != 0) return -1;
+	if (!S_ISDIR(st.st_mode)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+	if (st.st_uid != geteuid()) {
+		errno = EPERM;
+		return -1;
+	}
+	if (st.st_mode & 077) {
+		if (!tighten) {
+			errno = EPERM;
+			return -1;
+		}
+		if (fchmod(fd, st.st_mode & 0700) != 0) return -1;
+	}
+	return 0;
+}
+
+/* Open the folder the runtime folders go in: $XDG_RUNTIME_DIR if it is usable,
+ * otherwise a private folder in CFGPATH_RUNTIME_TMP.  Everything is checked
+ * through an open handle, and symlinks are not followed, so another user
+ * can't swap the folder for one they control.  base is set to the folder's
+ * path, using fallback as storage if needed.  Returns the handle, or -1 with
+ * errno set. */
+static inline int cfgpath_runtime_open_base(const char **base, char *fallback,
+	unsigned int fallback_len)
+{
+	const char *xdg = cfgpath_linux_getenv(CFGPATH_ENV_XDG_RUNTIME_DIR);
+	int fd;
+	if (xdg && (xdg[0] == '/')) {
+		/* The spec requires mode 0700 here, so anything else is not trusted */
+		fd = cfgpath_fs_openat(AT_FDCWD, xdg, CFGPATH_O_PRIVATE);
+		if (fd >= 0) {
+			if (cfgpath_runtime_check(fd, xdg, 0) == 0) {
+				*base = xdg;
+				return fd;
+			}
+			close(fd);
+		}
+	}
+
+	snprintf(fallback, fallback_len, CFGPATH_RUNTIME_TMP "/cfgpath-runtime-%u",
+		(unsigned int)geteuid());
+	if ((cfgpath_fs_mkdirat(AT_FDCWD, fallback, 0700) != 0) && (errno != EEXIST)) {
+		return -1;
+	}
+	/* If it already existed, someone else may have created it first */
+	fd = cfgpath_fs_openat(AT_FDCWD, fallback, CFGPATH_O_PRIVATE);
+	if (fd < 0) return -1;
+	if (cfgpath_runtime_check(fd, fallback, 1) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	*base = fallback;
+	return fd;
+}
+
+/* Resolve the runtime folder.  Returns the length of the path as for
+ * cfgpath_linux_build(), or a negative enum cfgpath_error value. */
+static inline int cfgpath_linux_runtime(char *out, unsigned int maxlen,
+	const char *appname)
+{
+	char fallback[sizeof(CFGPATH_RUNTIME_TMP) + 32];
+	const char *base;
+	int fd = cfgpath_runtime_open_base(&base, fallback, sizeof(fallback));
+	if (fd < 0) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_CREATE;
+	}
+
+	unsigned int base_len = strlen(base);
+	while ((base_len > 1) && (base[base_len - 1] == '/')) base_len--;
+	unsigned int appname_len = strlen(appname);
+	/* +2 is the slash before and after appname */
+	unsigned int len = base_len + appname_len + 2;
+	if (len >= maxlen) {
+		close(fd);
+		if (maxlen) out[0] = 0;
+		return len;
+	}
+
+	int ret = len;
+	if ((cfgpath_fs_mkdirat(fd, appname, 0700) != 0) && (errno != EEXIST)) {
+		ret = CFGPATH_ERR_CREATE;
+	} else {
+		int app_fd = cfgpath_fs_openat(fd, appname, CFGPATH_O_PRIVATE);
+		if ((app_fd < 0) || (cfgpath_runtime_check(app_fd, appname, 1) != 0)) {
+			ret = CFGPATH_ERR_CREATE;
+		}
+		if (app_fd >= 0) {
+			int err = errno;
+			close(app_fd);
+			errno = err;
+		}
+	}
+	int err = errno;
+	close(fd);
+	errno = err;
+	if (ret < 0) {
+		out[0] = 0;
+		return ret;
+	}
+
+	memcpy(out, base, base_len);
+	out[base_len] = '/';
+	memcpy(out + base_len + 1, appname, appname_len);
+	out[len - 1] = '/';
+	out[len] = 0;
+	return len;
+}
+#endif
+
+#ifdef CFGPATH_WINDOWS
+/* In C++ the known folder IDs are passed by reference, in C by pointer */
+#ifdef __cplusplus
+#define CFGPATH_FOLDERID(id) (id)
+#else
+#define CFGPATH_FOLDERID(id) (&(id))
+#endif
+
+/* Known folders the paths are in. */
+enum cfgpath_win_known {
+	CFGPATH_WIN_ROAMING,  /* FOLDERID_RoamingAppData */
+	CFGPATH_WIN_LOCAL,    /* FOLDERID_LocalAppData */
+	CFGPATH_WIN_FOLDER_COUNT
+};
+
+/* Known folders already looked up.  SHGetKnownFolderPath() is slow, and the
+ * folders don't move while the program is running, so each is only looked up
+ * once (see cfgpath_cache_invalidate()).  The lock is only held to copy a
+ * folder, never while calling the shell. */
+static struct {
+	long lock;
+	char *path[CFGPATH_WIN_FOLDER_COUNT];  /* Folder, or NULL if not looked up */
+	unsigned int len[CFGPATH_WIN_FOLDER_COUNT];
+} cfgpath_win_cache;
+
+static inline void cfgpath_win_lock(void)
+{
+	while (CFGPATH_ATOMIC_EXCHANGE(&cfgpath_win_cache.lock, 1, __ATOMIC_ACQUIRE)) {}
+}
+
+static inline void cfgpath_win_unlock(void)
+{
+	CFGPATH_ATOMIC_STORE(&cfgpath_win_cache.lock, 0, __ATOMIC_RELEASE);
+}
+
+/* Ask the shell for a known folder and convert it to the ANSI code page used
+ * by the rest of the API.  A folder with characters the code page can't hold
+ * is refused, as the nearest match Windows would otherwise substitute names a
+ * different folder.  On success *path is a heap block. */
+static inline int cfgpath_win_lookup(enum cfgpath_win_known which,
+	char **path, unsigned int *len)
+{
+	PWSTR wide = NULL;
+	int ret = CFGPATH_ERR_NOHOME;
+	*path = NULL;
+	HRESULT hr = SHGetKnownFolderPath((which == CFGPATH_WIN_LOCAL)
+		? CFGPATH_FOLDERID(FOLDERID_LocalAppData)
+		: CFGPATH_FOLDERID(FOLDERID_RoamingAppData), KF_FLAG_DEFAULT, NULL, &wide);
+	if (SUCCEEDED(hr) && wide) {
+		BOOL lossy = FALSE;
+		int size = WideCharToMultiByte(CP_ACP, WC_NO_BEST_FIT_CHARS, wide, -1,
+			NULL, 0, NULL, &lossy);
+		if (lossy) {
+			ret = CFGPATH_ERR_INVALID;
+		} else if (size > 1) {
+			*path = (char *)malloc(size);
+			ret = CFGPATH_ERR_NOMEM;
+		}
+		if (*path && (WideCharToMultiByte(CP_ACP, WC_NO_BEST_FIT_CHARS, wide, -1,
+			*path, size, NULL, &lossy) == size) && !lossy
+		) {
+			*len = size - 1;
+			ret = 0;
+		} else if (*path) {
+			ret = lossy ? CFGPATH_ERR_INVALID : CFGPATH_ERR_NOHOME;
+			free(*path);
+			*path = NULL;
+		}
+	}
+	/* Must be freed even on failure */
+	CoTaskMemFree(wide);
+	return ret;
+}
+
+/* Build a path in the known folder for a kind, e.g. "<LocalAppData>\appname\"
+ * for CFGPATH_CACHE_FOLDER.  Returns the length like snprintf(), as
+ * cfgpath_get() does, without creating any folders. */
+static inline int cfgpath_win_build(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname)
+{
+	enum cfgpath_win_known which = (kind == CFGPATH_CACHE_FOLDER)
+		? CFGPATH_WIN_LOCAL : CFGPATH_WIN_ROAMING;
+	const char *suffix = (kind == CFGPATH_CONFIG_FILE) ? ".ini" : "\\";
+	unsigned int suffix_len = strlen(suffix);
+	unsigned int appname_len = strlen(appname);
+
+	cfgpath_win_lock();
+	if (!cfgpath_win_cache.path[which]) {
+		cfgpath_win_unlock();
+		unsigned int found_len;
+		char *found;
+		int err = cfgpath_win_lookup(which, &found, &found_len);
+		if (err) {
+			/* Not remembered, so it is tried again next time */
+			if (maxlen) out[0] = 0;
+			return err;
+		}
+		cfgpath_win_lock();
+		if (cfgpath_win_cache.path[which]) {
+			/* Another thread got there first */
+			free(found);
+		} else {
+			cfgpath_win_cache.path[which] = found;
+			cfgpath_win_cache.len[which] = found_len;
+		}
+	}
+	unsigned int base_len = cfgpath_win_cache.len[which];
+	unsigned int len = base_len + 1 + appname_len + suffix_len;
+	if (len >= maxlen) {
+		if (maxlen) out[0] = 0;
+	} else {
+		memcpy(out, cfgpath_win_cache.path[which], base_len);
+		out[base_len] = '\\';
+		memcpy(out + base_len + 1, appname, appname_len);
+		memcpy(out + base_len + 1 + appname_len, suffix, suffix_len + 1);
+	}
+	cfgpath_win_unlock();
+	return len;
+}
+
+/* Create a folder, which may be longer than MAX_PATH.  The ANSI functions
+ * can't go past MAX_PATH unless long path support is enabled in Windows, so a
+ * longer path is converted back to UTF-16 (exactly, as cfgpath_win_lookup()
+ * refuses any folder the code page can't hold) and created with the "\\?\"
+ * prefix, which lifts the limit.  The path must be absolute. */
+static inline void cfgpath_win_mkdir(const char *path, unsigned int len)
+{
+	if (len < MAX_PATH) {
+		mkdir(path);
+		return;
+	}
+	/* A network share "\\server\share" becomes "\\?\UNC\server\share" */
+	int unc = (path[0] == '\\') && (path[1] == '\\');
+	const wchar_t *prefix = unc ? L"\\\\?\\UNC" : L"\\\\?\\";
+	unsigned int prefix_len = wcslen(prefix);
+	if (unc) path++;
+	int size = MultiByteToWideChar(CP_ACP, MB_ERR_INVALID_CHARS, path, -1, NULL, 0);
+	if (size <= 0) return;
+	wchar_t *wide = (wchar_t *)malloc((prefix_len + size) * sizeof(wchar_t));
+	if (!wide) return;
+	memcpy(wide, prefix, prefix_len * sizeof(wchar_t));
+	if (MultiByteToWideChar(CP_ACP, MB_ERR_INVALID_CHARS, path, -1,
+		wide + prefix_len, size) == size
+	) {
+		CreateDirectoryW(wide, NULL);
+	}
+	free(wide);
+}
+
+/* Build a folder path as cfgpath_win_build(), and create the folder if it fit.
+ * The known folder itself always exists already. */
+static inline int cfgpath_win_folder(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname)
+{
+	int len = cfgpath_win_build(kind, out, maxlen, appname);
+	if ((len > 0) && ((unsigned int)len < maxlen)) {
+		out[len - 1] = 0;
+		cfgpath_win_mkdir(out, len - 1);
+		out[len - 1] = '\\';
+	}
+	return len;
+}
+
+/* Forget the known folders, so they are looked up again. */
+static inline void cfgpath_win_cache_clear(void)
+{
+	unsigned int i;
+	cfgpath_win_lock();
+	for (i = 0; i < CFGPATH_WIN_FOLDER_COUNT; i++) {
+		free(cfgpath_win_cache.path[i]);
+		cfgpath_win_cache.path[i] = NULL;
+	}
+	cfgpath_win_unlock();
+}
+#endif
+
+/** Enable or disable the path resolution cache.
+ *
+ * The cache is disabled by default.  Once enabled, the get_user_*() functions
+ * remember each path they return, keyed by the kind of path and the appname,
+ * and later calls for the same pair copy the stored path instead of querying
+ * the system and creating folders again.
+ *
+ * Entries are discarded automatically if the environment variable the path was
+ * derived from ($XDG_CONFIG_HOME, $HOME, etc.) changes.  Because a cached
+ * lookup does not touch the filesystem, a folder deleted after it was first
+ * resolved will not be recreated until cfgpath_cache_invalidate() is called.
+ *
+ * The cache is private to each source file that includes cfgpath.h.
+ *
+ * Currently only Linux paths are cached, this function has no effect on other
+ * platforms.  Under Windows the AppData folders are remembered whether or not
+ * the cache is enabled, see cfgpath_cache_invalidate().
+ *
+ * @param enable
+ *   Nonzero to enable the cache, zero to disable it.  Disabling the cache also
+ *   empties it.
+ */
+static inline void cfgpath_cache_enable(int enable)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_cache_write_begin(&cfgpath_cache);
+	unsigned int i;
+	for (i = 0; i < CFGPATH_CACHE_SIZE; i++) cfgpath_cache_drop(&cfgpath_cache.entry[i]);
+	__atomic_store_n(&cfgpath_cache.enabled, enable, __ATOMIC_RELEASE);
+	cfgpath_cache_write_end(&cfgpath_cache);
+#else
+	(void)enable;
+#endif
+}
+
+/** Discard all paths held in the resolution cache.
+ *
+ * The next call to each get_user_*() function will resolve the path afresh and
+ * create any missing folders.
+ *
+ * Under Windows the AppData folders are always remembered once found, as they
+ * are slow to look up, so this must be called if they are moved (e.g. by
+ * folder redirection) while the program is running.
+ */
+static inline void cfgpath_cache_invalidate(void)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_cache_clear(&cfgpath_cache);
+#elif defined(CFGPATH_WINDOWS)
+	cfgpath_win_cache_clear();
+#endif
+}
+
+/** Take a snapshot of the environment variables used to resolve paths.
+ *
+ * By default the get_user_*() functions call getenv() each time they are used.
+ * This is not safe if another thread may be calling setenv() at the same time.
+ * After this function has been called, paths are instead resolved from a
+ * private copy of $HOME and the $XDG_*_HOME variables, which threads read
+ * without taking any locks.
+ *
+ * Call this function again after changing any of the variables to publish a
+ * new snapshot.  Threads resolving paths at the time will see either the old
+ * or the new snapshot, never a mix of the two.
+ *
+ * If CFGPATH_ENV_SNAPSHOT is defined before including cfgpath.h, a snapshot is
+ * taken automatically the first time a path is resolved, so calling this
+ * function is only needed to pick up later changes.
+ *
+ * Environment variables are only used under Linux, this function has no effect
+ * on other platforms.
+ *
+ * @return 0 on success, -1 if out of memory.
+ */
+static inline int cfgpath_env_refresh(void)
+{
+#ifdef CFGPATH_LINUX
+	struct cfgpath_env *env = cfgpath_env_capture();
+	if (!env) return -1;
+	__atomic_store_n(&cfgpath_env_current, env, __ATOMIC_RELEASE);
+#endif
+	return 0;
+}
+
+/** Stop using the snapshot taken by cfgpath_env_refresh().
+ *
+ * Paths will once again be resolved by calling getenv() each time, unless
+ * CFGPATH_ENV_SNAPSHOT is defined in which case a new snapshot is taken on the
+ * next use.
+ */
+static inline void cfgpath_env_release(void)
+{
+#ifdef CFGPATH_LINUX
+	__atomic_store_n(&cfgpath_env_current, (struct cfgpath_env *)NULL, __ATOMIC_RELEASE);
+#endif
+}
+
+/** Start or stop collecting statistics.
+ *
+ * While enabled, each path resolved is counted along with the time taken and
+ * the number of environment lookups and filesystem operations it needed.  This
+ * is useful for finding out whether slow home folders (e.g. on a network
+ * filesystem) are a problem in production.  Collecting statistics costs a few
+ * clock readings per call, so it is disabled by default.
+ *
+ * Statistics are private to each source file that includes cfgpath.h, and are
+ * currently only collected under Linux.
+ *
+ * @param enable
+ *   Nonzero to start collecting statistics, zero to stop.  Counters collected
+ *   so far are kept, use cfgpath_stats_reset() to clear them.
+ */
+static inline void cfgpath_stats_enable(int enable)
+{
+#ifdef CFGPATH_LINUX
+	__atomic_store_n(&cfgpath_stats_enabled, enable, __ATOMIC_RELAXED);
+#else
+	(void)enable;
+#endif
+}
+
+/** Get the statistics collected since the last reset.
+ *
+ * @param out
+ *   Structure to fill with the counters.
+ */
+static inline void cfgpath_stats_get(struct cfgpath_stats *out)
+{
+	memset(out, 0, sizeof(*out));
+#ifdef CFGPATH_LINUX
+	const unsigned long long *src = (const unsigned long long *)&cfgpath_stats;
+	unsigned long long *dst = (unsigned long long *)out;
+	size_t i;
+	for (i = 0; i < sizeof(*out) / sizeof(*dst); i++) {
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	}
+#endif
+}
+
+/** Set all the statistics counters back to zero. */
+static inline void cfgpath_stats_reset(void)
+{
+#ifdef CFGPATH_LINUX
+	unsigned long long *counter = (unsigned long long *)&cfgpath_stats;
+	size_t i;
+	for (i = 0; i < sizeof(cfgpath_stats) / sizeof(*counter); i++) {
+		__atomic_store_n(&counter[i], 0, __ATOMIC_RELAXED);
+	}
+#endif
+}
+
+/** Set callbacks to be run around each filesystem operation.
+ *
+ * This allows slow operations to be logged or traced.  The callbacks may be
+ * run from any thread that resolves a path, and must not call back into
+ * cfgpath.h.
+ *
+ * Filesystem operations are currently only reported under Linux.
+ *
+ * @param hooks
+ *   Callbacks to run, or NULL to remove them.  The structure is used in place,
+ *   so it must remain valid until the hooks are removed.
+ */
+static inline void cfgpath_set_fs_hooks(const struct cfgpath_fs_hooks *hooks)
+{
+#ifdef CFGPATH_LINUX
+	__atomic_store_n(&cfgpath_fs_hooks, hooks, __ATOMIC_RELEASE);
+#else
+	(void)hooks;
+#endif
+}
+
+/** Get an absolute path to a single configuration file, specific to this user.
+ *
+ * This function is useful for programs that need only a single configuration
+ * file.  The file is unique to the user account currently logged in.
+ *
+ * Output is typically:
+ *
+ *   Windows: C:\Users\jcitizen\AppData\Roaming\appname.ini
+ *   Linux: /home/jcitizen/.config/appname.conf
+ *   Mac: /Users/jcitizen/Library/Application Support/appname.conf
+ *
+ * @param out
+ *   Buffer to write the path.  On return will contain the path, or an empty
+ *   string on error.
+ *
+ * @param maxlen
+ *   Length of out.  Must be >= MAX_PATH.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @post The file may or may not exist.
+ * @post The folder holding the file is created if needed.
+ */
+static inline void get_user_config_file(char *out, unsigned int maxlen, const char *appname)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_get(CFGPATH_CONFIG_FILE, out, maxlen, appname);
+#elif defined(CFGPATH_WINDOWS)
+	cfgpath_win_build(CFGPATH_CONFIG_FILE, out, maxlen, appname);
+#elif defined(CFGPATH_MAC)
+	FSRef ref;
+	FSFindFolder(kUserDomain, kApplicationSupportFolderType, kCreateFolder, &ref);
+	char home[MAX_PATH];
+	FSRefMakePath(&ref, (UInt8 *)&home, MAX_PATH);
+	/* first +1 is "/", second is terminating null */
+	const char *ext = ".conf";
+	if (strlen(home) + 1 + strlen(appname) + strlen(ext) + 1 > maxlen) {
+		out[0] = 0;
+		return;
+	}
+
+	strcpy(out, home);
+	strcat(out, PATH_SEPARATOR_STRING);
+	strcat(out, appname);
+	strcat(out, ext);
+#endif
+}
+
+/** Get an absolute path to a configuration folder, specific to this user.
+ *
+ * This function is useful for programs that need to store multiple
+ * configuration files.  The output is a folder (which may not exist and will
+ * need to be created) suitable for storing a number of files.
+ *
+ * The returned path will always end in a platform-specific trailing slash, so
+ * that a filename can simply be appended to the path.
+ *
+ * Output is typically:
+ *
+ *   Windows: C:\Users\jcitizen\AppData\Roaming\appname\
+ *   Linux: /home/jcitizen/.config/appname/
+ *   Mac: /Users/jcitizen/Library/Application Support/appname/
+ *
+ * @param out
+ *   Buffer to write the path.  On return will contain the path, or an empty
+ *   string on error.
+ *
+ * @param maxlen
+ *   Length of out.  Must be >= MAX_PATH.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @post The folder is created if needed.
+ */
+static inline void get_user_config_folder(char *out, unsigned int maxlen, const char *appname)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_get(CFGPATH_CONFIG_FOLDER, out, maxlen, appname);
+#elif defined(CFGPATH_WINDOWS)
+	cfgpath_win_folder(CFGPATH_CONFIG_FOLDER, out, maxlen, appname);
+#elif defined(CFGPATH_MAC)
+	FSRef ref;
+	FSFindFolder(kUserDomain, kApplicationSupportFolderType, kCreateFolder, &ref);
+	char home[MAX_PATH];
+	FSRefMakePath(&ref, (UInt8 *)&home, MAX_PATH);
+	/* first +1 is "/", second is trailing "/", third is terminating null */
+	if (strlen(home) + 1 + strlen(appname) + 1 + 1 > maxlen) {
+		out[0] = 0;
+		return;
+	}
+
+	strcpy(out, home);
+	strcat(out, PATH_SEPARATOR_STRING);
+	strcat(out, appname);
+	/* Make the .config/appname folder if it doesn't already exist */
+	mkdir(out, 0755);
+	strcat(out, PATH_SEPARATOR_STRING);
+#endif
+}
+
+/** Get an absolute path to a data storage folder, specific to this user.
+ *
+ * This function is useful for programs that need to store larger amounts of
+ * data specific to each user.  The output is a folder (which may not exist and
+ * will need to be created) suitable for storing a number of data files.
+ *
+ * This path should be used for persistent, important data files the user would
+ * want to keep.  Do not use this path for temporary files, cache files, or
+ * other files that can be recreated if they are deleted.  Use
+ * get_user_cache_folder() for those instead.
+ *
+ * The returned path will always end in a platform-specific trailing slash, so
+ * that a filename can simply be appended to the path.
+ *
+ * Output is typically:
+ *
+ *   Windows: C:\Users\jcitizen\AppData\Roaming\appname-data\
+ *   Linux: /home/jcitizen/.local/share/appname/
+ *   Mac: /Users/jcitizen/Library/Application Support/appname-data/
+ *
+ * @param out
+ *   Buffer to write the path.  On return will contain the path, or an empty
+ *   string on error.
+ *
+ * @param maxlen
+ *   Length of out.  Must be >= MAX_PATH.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @post The folder is created if needed.
+ */
+static inline void get_user_data_folder(char *out, unsigned int maxlen, const char *appname)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_get(CFGPATH_DATA_FOLDER, out, maxlen, appname);
+#elif defined(CFGPATH_WINDOWS) || defined(CFGPATH_MAC)
+	/* No distinction under Windows or OS X */
+	get_user_config_folder(out, maxlen, appname);
+#endif
+}
+
+/** Get an absolute path to a temporary storage folder, specific to this user.
+ *
+ * This function is useful for programs that temporarily need to store larger
+ * amounts of data specific to each user.  The output is a folder (which may
+ * not exist and will need to be created) suitable for storing a number of
+ * temporary files.  The files may be lost or deleted when the program
+ * terminates.
+ *
+ * This path should be used for temporary, unimportant data files that can
+ * safely be deleted after the program terminates.  Do not use this path for
+ * any important files the user would want to keep.  Use get_user_data_folder()
+ * for those instead.
+ *
+ * The returned path will always end in a platform-specific trailing slash, so
+ * that a filename can simply be appended to the path.
+ *
+ * Output is typically:
+ *
+ *   Windows: C:\Users\jcitizen\AppData\Local\appname\
+ *   Linux: /home/jcitizen/.cache/appname/
+ *   Mac: /Users/jcitizen/Library/Application Support/appname/
+ *
+ * @param out
+ *   Buffer to write the path.  On return will contain the path, or an empty
+ *   string on error.
+ *
+ * @param maxlen
+ *   Length of out.  Must be >= MAX_PATH.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @post The folder is created if needed.
+ */
+static inline void get_user_cache_folder(char *out, unsigned int maxlen, const char *appname)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_get(CFGPATH_CACHE_FOLDER, out, maxlen, appname);
+#elif defined(CFGPATH_WINDOWS)
+	cfgpath_win_folder(CFGPATH_CACHE_FOLDER, out, maxlen, appname);
+#elif defined(CFGPATH_MAC)
+	/* No distinction under OS X */
+	get_user_config_folder(out, maxlen, appname);
+#endif
+}
+
+/** Get an absolute path to a runtime folder, specific to this user.
+ *
+ * This function is for files that only matter while the program is running,
+ * such as sockets, named pipes, lock files and PID files.  Under Linux the
+ * folder is normally in memory rather than on disk, so it is fast even when
+ * the home folder is on a network filesystem, and it is emptied when the user
+ * logs out.  Store nothing here that needs to survive that.
+ *
+ * The folder is only accessible by the user (mode 0700).  Under Linux it is in
+ * $XDG_RUNTIME_DIR, which is only used if it is owned by the user and has mode
+ * 0700.  Otherwise a private folder for the user is made in /tmp instead.  If
+ * that folder already exists and belongs to someone else, or is a symlink, an
+ * empty string is returned rather than risk using a folder that another user
+ * controls.
+ *
+ * The returned path will always end in a platform-specific trailing slash, so
+ * that a filename can simply be appended to the path.
+ *
+ * Output is typically:
+ *
+ *   Windows: C:\Users\jcitizen\AppData\Local\appname\
+ *   Linux: /run/user/1000/appname/
+ *   Linux without $XDG_RUNTIME_DIR: /tmp/cfgpath-runtime-1000/appname/
+ *   Mac: /Users/jcitizen/Library/Application Support/appname/
+ *
+ * @param out
+ *   Buffer to write the path.  On return will contain the path, or an empty
+ *   string on error.
+ *
+ * @param maxlen
+ *   Length of out.  Must be >= MAX_PATH.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @post The folder is created if needed, and any group or other permissions
+ *   on it are removed.
+ */
+static inline void get_user_runtime_folder(char *out, unsigned int maxlen,
+	const char *appname)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_runtime(out, maxlen, appname);
+#elif defined(CFGPATH_WINDOWS) || defined(CFGPATH_MAC)
+	/* No separate runtime location, and the cache folder is private already */
+	get_user_cache_folder(out, maxlen, appname);
+#endif
+}
+
+/** Get any kind of path, choosing when the folders are created.
+ *
+ * This is the same as cfgpath_get() below, which always creates the folders
+ * before returning.  Creating a folder can block for a long time if the home folder
+ * is on a slow or unresponsive network filesystem, so flags can be used to
+ * avoid doing it at startup:
+ *
+ *   CFGPATH_CREATE_NOW: create the folders before returning, as cfgpath_get().
+ *
+ *   CFGPATH_CREATE_NONE: only build the path.  The filesystem is not touched,
+ *   so the folders may not exist.
+ *
+ *   CFGPATH_CREATE_DEFERRED: queue the folders to be created by a background
+ *   thread.  Call cfgpath_flush() to wait until this has been done.
+ *
+ *   CFGPATH_CREATE_LAZY: the folders are not created, and the caller promises
+ *   to call cfgpath_ensure_parent() before writing the first file.
+ *
+ * Only Linux looks at the flags.  Elsewhere the folders are in a local profile
+ * and are always created before returning.
+ *
+ * @param flags
+ *   One of the CFGPATH_CREATE_* values.
+ *
+ * See cfgpath_get() for the other parameters and the return value.
+ */
+static inline int cfgpath_get_ex(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname, unsigned int flags)
+{
+	if (((unsigned int)kind >= CFGPATH_KIND_COUNT) || !appname) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_INVALID;
+	}
+#ifdef CFGPATH_LINUX
+	return cfgpath_linux_get_ex(kind, out, maxlen, appname, flags);
+#elif defined(CFGPATH_WINDOWS)
+	(void)flags;
+	if (kind == CFGPATH_CONFIG_FILE) {
+		/* The file goes straight into the known folder, which always exists */
+		return cfgpath_win_build(kind, out, maxlen, appname);
+	}
+	return cfgpath_win_folder(kind, out, maxlen, appname);
+#else
+	/* Paths are limited to MAX_PATH by the system anyway */
+	char path[MAX_PATH];
+	switch (kind) {
+		case CFGPATH_CONFIG_FILE: get_user_config_file(path, sizeof(path), appname); break;
+		case CFGPATH_CONFIG_FOLDER: get_user_config_folder(path, sizeof(path), appname); break;
+		case CFGPATH_DATA_FOLDER: get_user_data_folder(path, sizeof(path), appname); break;
+		default: get_user_cache_folder(path, sizeof(path), appname); break;
+	}
+	unsigned int len = strlen(path);
+	if (len == 0) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_NOHOME;
+	}
+	if (len >= maxlen) {
+		if (maxlen) out[0] = 0;
+	} else {
+		memcpy(out, path, len + 1);
+	}
+	return len;
+#endif
+}
+
+/** Get any kind of path from the appname with its ending already added.
+ *
+ * This is the same as cfgpath_get_ex(), but instead of the appname it takes the
+ * name that goes at the end of the path: the appname followed by ".conf" for
+ * CFGPATH_CONFIG_FILE, or by PATH_SEPARATOR_STRING for the folders, e.g.
+ * "myapp.conf" or "myapp/".  The C++ interface in cfgpath.hpp assembles this at
+ * compile time, so only the base folder has to be measured and copied at
+ * runtime.  The cache, hooks and statistics are shared with cfgpath_get_ex().
+ *
+ * @param suffix
+ *   The appname followed by the ending for kind.  Need not be null terminated.
+ *
+ * @param suffix_len
+ *   Length of suffix.
+ *
+ * @return
+ *   The same as cfgpath_get_ex(), or CFGPATH_ERR_INVALID if suffix does not
+ *   end the right way for kind or has an empty appname.
+ */
+static inline int cfgpath_get_prefixed(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *suffix, unsigned int suffix_len,
+	unsigned int flags)
+{
+	const char *end = (kind == CFGPATH_CONFIG_FILE) ? ".conf" : PATH_SEPARATOR_STRING;
+	unsigned int end_len = strlen(end);
+	if (((unsigned int)kind >= CFGPATH_KIND_COUNT) || !suffix
+		|| (suffix_len <= end_len)
+		|| memcmp(suffix + suffix_len - end_len, end, end_len)
+	) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_INVALID;
+	}
+	unsigned int app_len = suffix_len - end_len;
+#ifdef CFGPATH_LINUX
+	return cfgpath_linux_get_n(kind, out, maxlen, suffix, app_len, suffix_len, flags);
+#else
+	/* Only Linux builds the path in one go, so split the appname back off */
+	char appname[MAX_PATH];
+	if (app_len >= sizeof(appname)) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_INVALID;
+	}
+	memcpy(appname, suffix, app_len);
+	appname[app_len] = 0;
+	return cfgpath_get_ex(kind, out, maxlen, appname, flags);
+#endif
+}
+
+/** Get any kind of path, returning its length like snprintf().
+ *
+ * This is the same as get_user_config_file(), get_user_config_folder(),
+ * get_user_data_folder() and get_user_cache_folder(), selected by kind, but
+ * reports the length of the path so that it does not need to be measured
+ * again, and can tell the different reasons for failure apart.
+ *
+ * To find out how big a buffer is needed, pass NULL and 0 for out and maxlen.
+ * The length is returned without writing anything or creating any folders, so
+ * the caller can allocate exactly length + 1 bytes and call again.  There is no
+ * limit on the length of the path under Linux or Windows, so this also allows
+ * paths longer than MAX_PATH.
+ *
+ * @param kind
+ *   Which path to get.
+ *
+ * @param out
+ *   Buffer to write the path, or NULL if maxlen is 0.  On return will contain
+ *   the path, or an empty string if it does not fit or on error.
+ *
+ * @param maxlen
+ *   Length of out.  May be less than MAX_PATH.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @return Length of the path excluding the terminating null, or a negative
+ *   enum cfgpath_error value.  If the length is maxlen or more the path did not
+ *   fit, and nothing was written other than an empty string.
+ *
+ * @post The folder holding the path (or the folder itself) is created if needed,
+ *   but only if the path fit in out.
+ */
+static inline int cfgpath_get(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname)
+{
+	return cfgpath_get_ex(kind, out, maxlen, appname, CFGPATH_CREATE_NOW);
+}
+
+/** Wait for folders queued by CFGPATH_CREATE_DEFERRED to be created.
+ *
+ * This also waits for any cfgpath_get_async() calls to finish.
+ *
+ * @post Every folder queued before the call has been created, or creating it
+ *   has failed.
+ */
+static inline void cfgpath_flush(void)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_worker_wait();
+#endif
+}
+
+/** Create the folder a file is about to be written into, and its parents.
+ *
+ * This is for use with CFGPATH_CREATE_LAZY, just before a file is first
+ * written.  It can be given the path of the file itself, or a folder path
+ * returned by cfgpath_get_ex() that ends in a trailing slash, as everything
+ * after the last slash is ignored.  If the folder already exists this costs a
+ * single mkdir() call.
+ *
+ * @param path
+ *   Path to a file, or to a folder with a trailing slash.
+ *
+ * @return 0 on success or if the folder already exists, -1 on error with errno
+ *   set.
+ */
+static inline int cfgpath_ensure_parent(const char *path)
+{
+#ifdef CFGPATH_LINUX
+	const char *slash = strrchr(path, '/');
+	if (!slash || (slash == path)) return 0; /* no folder, or the root folder */
+	unsigned int len = slash - path;
+	char buf[MAX_PATH];
+	char *dir = (len < sizeof(buf)) ? buf : (char *)malloc(len + 1);
+	if (!dir) return -1;
+	memcpy(dir, path, len);
+	dir[len] = 0;
+	int ret = cfgpath_mkdir_p(dir, len, 0755);
+	if (dir != buf) {
+		int err = errno;
+		free(dir);
+		errno = err;
+	}
+	return ret;
+#else
+	/* The folders have already been created */
+	(void)path;
+	return 0;
+#endif
+}
+
+/** Function called when cfgpath_get_async() has finished.
+ *
+ * @param result
+ *   Length of the path on success, or CFGPATH_ERR_CREATE with errno set if
+ *   the folder could not be created or is not a folder.
+ *
+ * @param path
+ *   The path, which is only valid until the function returns.
+ *
+ * @param ctx
+ *   Value passed to cfgpath_get_async().
+ */
+typedef void (*cfgpath_async_func)(int result, const char *path, void *ctx);
+
+/** Get any kind of path, creating the folders without blocking.
+ *
+ * The environment is read before returning, but creating and checking the
+ * folders is done by the background thread, which then calls func.  This
+ * avoids the calling thread ever waiting on the filesystem, e.g. in an event
+ * loop.  Use cfgpath_flush() to wait for all outstanding calls to finish.
+ *
+ * func is called on the background thread, so it should do as little as
+ * possible (e.g. wake the event loop) as it holds up any other paths waiting
+ * to be resolved.  Under Windows and OS X there is no background thread, and
+ * func is called before cfgpath_get_async() returns.  The same happens under
+ * Linux if the background thread cannot be started.
+ *
+ * @param kind
+ *   Which path to get.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @param func
+ *   Function to call with the result.
+ *
+ * @param ctx
+ *   Passed to func unchanged.
+ *
+ * @return 0 if func will be called, or a negative enum cfgpath_error value if
+ *   the path could not be resolved, in which case func is not called.
+ */
+static inline int cfgpath_get_async(enum cfgpath_kind kind, const char *appname,
+	cfgpath_async_func func, void *ctx)
+{
+	if (((unsigned int)kind >= CFGPATH_KIND_COUNT) || !appname) {
+		return CFGPATH_ERR_INVALID;
+	}
+#ifdef CFGPATH_LINUX
+	struct cfgpath_stats_scope scope;
+	cfgpath_stats_begin(&scope, kind);
+
+	const char *xdg = cfgpath_linux_getenv(cfgpath_linux_kinds[kind].xdg_env);
+	const char *home = xdg ? NULL : cfgpath_linux_getenv(CFGPATH_ENV_HOME);
+	unsigned int base_len;
+	int len = cfgpath_linux_build(kind, NULL, 0, appname, xdg, home, &base_len);
+	if (len >= 0) {
+		unsigned int appname_len = strlen(appname);
+		struct cfgpath_async_task *t = (struct cfgpath_async_task *)malloc(
+			sizeof(struct cfgpath_async_task) + len + 1 + appname_len + 1);
+		if (!t) {
+			len = CFGPATH_ERR_NOMEM;
+		} else {
+			char *path = (char *)(t + 1);
+			t->task.run = cfgpath_async_task_run;
+			t->kind = kind;
+			t->len = cfgpath_linux_build(kind, path, len + 1, appname, xdg, home,
+				&t->base_len);
+			t->func = func;
+			t->ctx = ctx;
+			memcpy(path + len + 1, appname, appname_len + 1);
+			cfgpath_worker_submit(&t->task);
+		}
+	}
+
+	cfgpath_stats_end(&scope);
+	return (len < 0) ? len : 0;
+#else
+	char path[MAX_PATH];
+	int len = cfgpath_get(kind, path, sizeof(path), appname);
+	if (len < 0) return len;
+	func(len, path, ctx);
+	return 0;
+#endif
+}
+
+#ifdef CFGPATH_LINUX
+/** Get a handle on the configuration folder, specific to this user.
+ *
+ * This is the same folder returned by get_user_config_folder(), but as an open
+ * file descriptor suitable for use with openat(), fstatat() and similar
+ * functions.  Opening many files relative to this handle avoids the kernel
+ * having to look up every folder in the path again for each file, and ensures
+ * all the files end up in the same folder even if the path is renamed.
+ *
+ * The handle is opened on the first call and the same one is returned by later
+ * calls with the same appname.  It is owned by cfgpath.h and must not be closed
+ * by the caller.  It remains valid until cfgpath_close_folder_fds() is called.
+ *
+ * If the environment variable the path came from changes, a handle on the new
+ * folder is returned from then on, but the old handle stays open.
+ *
+ * The handle is opened with O_PATH where available, so it can be used as the
+ * base for *at() functions but cannot be read with fdopendir().
+ *
+ * This function is only available under Linux and BSD.
+ *
+ * @param appname
+ *   Short name of the application.  Avoid using spaces or version numbers, and
+ *   use lowercase if possible.
+ *
+ * @return The file descriptor, or -1 on error with errno set.
+ *
+ * @post The folder is created if needed.
+ */
+static inline int get_user_config_folder_fd(const char *appname)
+{
+	return cfgpath_linux_get_fd(CFGPATH_CONFIG_FOLDER, appname);
+}
+
+/** Get a handle on the data storage folder, specific to this user.
+ *
+ * This is the folder returned by get_user_data_folder().  See
+ * get_user_config_folder_fd() for details.
+ */
+static inline int get_user_data_folder_fd(const char *appname)
+{
+	return cfgpath_linux_get_fd(CFGPATH_DATA_FOLDER, appname);
+}
+
+/** Get a handle on the temporary storage folder, specific to this user.
+ *
+ * This is the folder returned by get_user_cache_folder().  See
+ * get_user_config_folder_fd() for details.
+ */
+static inline int get_user_cache_folder_fd(const char *appname)
+{
+	return cfgpath_linux_get_fd(CFGPATH_CACHE_FOLDER, appname);
+}
+
+/** Close all handles returned by the get_user_*_folder_fd() functions.
+ *
+ * Any handles previously returned become invalid and must not be used.  Later
+ * calls will open the folders again.
+ */
+static inline void cfgpath_close_folder_fds(void)
+{
+	cfgpath_cache_write_begin(&cfgpath_fd_cache);
+	unsigned int i;
+	for (i = 0; i < CFGPATH_CACHE_SIZE; i++) {
+		struct cfgpath_cache_entry *e = &cfgpath_fd_cache.entry[i];
+		if (e->used && (e->fd >= 0)) close(e->fd);
+		e->used = 0;
+	}
+	for (i = 0; i < cfgpath_fd_retired.count; i++) close(cfgpath_fd_retired.fd[i]);
+	cfgpath_fd_retired.count = 0;
+	cfgpath_cache_write_end(&cfgpath_fd_cache);
+}
+#endif
+
+/** Function used to look up environment variables by the get_user_*_env()
+ * functions.
+ *
+ * @param name
+ *   Name of the environment variable, e.g. "HOME".
+ *
+ * @param ctx
+ *   The value passed to the get_user_*_env() function.
+ *
+ * @return The value of the variable, or NULL if it is not set.  The value must
+ *   remain valid until the get_user_*_env() function returns.
+ */
+typedef const char *(*cfgpath_getenv_func)(const char *name, void *ctx);
+
+/** Look up a variable in an environment block.
+ *
+ * This can be passed to the get_user_*_env() functions to resolve paths using
+ * an environment block in the same format as the envp parameter to main() or
+ * execve().  The block itself is passed as ctx.
+ */
+static inline const char *cfgpath_envp_getenv(const char *name, void *ctx)
+{
+	char *const *envp = (char *const *)ctx;
+	size_t name_len = strlen(name);
+	if (!envp) return NULL;
+	for (; *envp; envp++) {
+		if ((strncmp(*envp, name, name_len) == 0) && ((*envp)[name_len] == '=')) {
+			return *envp + name_len + 1;
+		}
+	}
+	return NULL;
+}
+
+#ifdef CFGPATH_LINUX
+/* Resolve a path using a caller-supplied environment.  The environment may
+ * well belong to another user, so nothing is created. */
+static inline void cfgpath_linux_resolve_env(enum cfgpath_kind kind, char *out,
+	unsigned int maxlen, const char *appname, cfgpath_getenv_func getenv_func,
+	void *ctx)
+{
+	struct cfgpath_stats_scope scope;
+	cfgpath_stats_begin(&scope, kind);
+	const char *xdg = getenv_func(
+		cfgpath_env_names[cfgpath_linux_kinds[kind].xdg_env], ctx);
+	const char *home = xdg ? NULL : getenv_func("HOME", ctx);
+	unsigned int len = strlen(appname);
+	cfgpath_linux_resolve_from(kind, out, maxlen, appname, len, len, xdg, home,
+		CFGPATH_CREATE_NONE);
+	cfgpath_stats_end(&scope);
+}
+#endif
+
+/** Get the path to a configuration file for a different environment.
+ *
+ * This is the same as get_user_config_file() except that environment variables
+ * are looked up by calling getenv_func rather than reading the environment of
+ * the current process.  It is useful for resolving paths on behalf of other
+ * processes, such as children about to be started with their own environment.
+ * It does not use or change the cache enabled by cfgpath_cache_enable().
+ *
+ * Unlike get_user_config_file(), no folders are created, because the
+ * environment may point into another user's home folder and anything created
+ * there would be owned by the wrong account.  The caller (or the process the
+ * path is for) should create them if needed, e.g. with cfgpath_ensure_parent().
+ *
+ * Environment variables are only used under Linux.  On other platforms this is
+ * the same as get_user_config_file().
+ *
+ * @param getenv_func
+ *   Function to look up an environment variable.  Use cfgpath_envp_getenv() to
+ *   look up variables in an environment block.
+ *
+ * @param ctx
+ *   Passed through to getenv_func.
+ */
+static inline void get_user_config_file_env(char *out, unsigned int maxlen,
+	const char *appname, cfgpath_getenv_func getenv_func, void *ctx)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_resolve_env(CFGPATH_CONFIG_FILE, out, maxlen, appname,
+		getenv_func, ctx);
+#else
+	(void)getenv_func;
+	(void)ctx;
+	get_user_config_file(out, maxlen, appname);
+#endif
+}
+
+/** Get the path to a configuration folder for a different environment.
+ *
+ * See get_user_config_folder() and get_user_config_file_env().
+ */
+static inline void get_user_config_folder_env(char *out, unsigned int maxlen,
+	const char *appname, cfgpath_getenv_func getenv_func, void *ctx)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_resolve_env(CFGPATH_CONFIG_FOLDER, out, maxlen, appname,
+		getenv_func, ctx);
+#else
+	(void)getenv_func;
+	(void)ctx;
+	get_user_config_folder(out, maxlen, appname);
+#endif
+}
+
+/** Get the path to a data storage folder for a different environment.
+ *
+ * See get_user_data_folder() and get_user_config_file_env().
+ */
+static inline void get_user_data_folder_env(char *out, unsigned int maxlen,
+	const char *appname, cfgpath_getenv_func getenv_func, void *ctx)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_resolve_env(CFGPATH_DATA_FOLDER, out, maxlen, appname,
+		getenv_func, ctx);
+#else
+	(void)getenv_func;
+	(void)ctx;
+	get_user_data_folder(out, maxlen, appname);
+#endif
+}
+
+/** Get the path to a temporary storage folder for a different environment.
+ *
+ * See get_user_cache_folder() and get_user_config_file_env().
+ */
+static inline void get_user_cache_folder_env(char *out, unsigned int maxlen,
+	const char *appname, cfgpath_getenv_func getenv_func, void *ctx)
+{
+#ifdef CFGPATH_LINUX
+	cfgpath_linux_resolve_env(CFGPATH_CACHE_FOLDER, out, maxlen, appname,
+		getenv_func, ctx);
+#else
+	(void)getenv_func;
+	(void)ctx;
+	get_user_cache_folder(out, maxlen, appname);
+#endif
+}
+
+#ifdef CFGPATH_LINUX
+/** Get the path to a configuration file for a given user.
+ *
+ * This is the same as get_user_config_file() except the path is for the user
+ * account uid instead of the current user.  It is useful for services that act
+ * on behalf of many users.
+ *
+ * If uid is the current user and $HOME or $XDG_CONFIG_HOME is set, the result
+ * is exactly the same as get_user_config_file().  Otherwise the home folder is
+ * looked up in the user database with getpwuid_r(), which also makes this
+ * function useful for the current user when $HOME is not set, as is often the
+ * case for system services.
+ *
+ * Home folders are remembered, so each user is only looked up in the user
+ * database once, including users that do not exist.  Call
+ * cfgpath_uid_cache_invalidate() if the user database changes.
+ *
+ * Folders are only created if uid is the effective user of the process, as
+ * they would otherwise be owned by the wrong account.
+ *
+ * This function is only available under Linux and BSD.
+ *
+ * @param uid
+ *   User to get the path for.
+ */
+static inline void get_user_config_file_uid(char *out, unsigned int maxlen,
+	const char *appname, uid_t uid)
+{
+	cfgpath_linux_resolve_uid(CFGPATH_CONFIG_FILE, out, maxlen, appname, uid);
+}
+
+/** Get the path to a configuration folder for a given user.
+ *
+ * See get_user_config_folder() and get_user_config_file_uid().
+ */
+static inline void get_user_config_folder_uid(char *out, unsigned int maxlen,
+	const char *appname, uid_t uid)
+{
+	cfgpath_linux_resolve_uid(CFGPATH_CONFIG_FOLDER, out, maxlen, appname, uid);
+}
+
+/** Get the path to a data storage folder for a given user.
+ *
+ * See get_user_data_folder() and get_user_config_file_uid().
+ */
+static inline void get_user_data_folder_uid(char *out, unsigned int maxlen,
+	const char *appname, uid_t uid)
+{
+	cfgpath_linux_resolve_uid(CFGPATH_DATA_FOLDER, out, maxlen, appname, uid);
+}
+
+/** Get the path to a temporary storage folder for a given user.
+ *
+ * See get_user_cache_folder() and get_user_config_file_uid().
+ */
+static inline void get_user_cache_folder_uid(char *out, unsigned int maxlen,
+	const char *appname, uid_t uid)
+{
+	cfgpath_linux_resolve_uid(CFGPATH_CACHE_FOLDER, out, maxlen, appname, uid);
+}
+
+/** Get the same kind of path for many users at once.
+ *
+ * This is equivalent to calling get_user_config_file_uid() (or one of the other
+ * get_user_*_uid() functions, depending on kind) for each uid in turn, writing
+ * the results into consecutive slots of stride bytes each.  The user database
+ * is queried at most once per distinct uid, as long as the number of distinct
+ * uids does not greatly exceed CFGPATH_UID_CACHE_SIZE.
+ *
+ * This function is only available under Linux and BSD.
+ *
+ * @param kind
+ *   Which kind of path to get.
+ *
+ * @param appname
+ *   Short name of the application.
+ *
+ * @param uids
+ *   Users to get the path for.
+ *
+ * @param count
+ *   Number of entries in uids.
+ *
+ * @param out
+ *   Buffer of count * stride bytes.  On return, slot i (starting at
+ *   out + i * stride) will contain the path for uids[i], or an empty string on
+ *   error.
+ *
+ * @param stride
+ *   Size of each slot in out, typically MAX_PATH.
+ */
+static inline void cfgpath_resolve_uids(enum cfgpath_kind kind,
+	const char *appname, const uid_t *uids, unsigned int count, char *out,
+	unsigned int stride)
+{
+	unsigned int i;
+	for (i = 0; i < count; i++) {
+		/* Repeats of the previous uid are common when input is sorted */
+		if ((i > 0) && (uids[i] == uids[i - 1])) {
+			memcpy(out + i * stride, out + (i - 1) * stride, stride);
+			continue;
+		}
+		cfgpath_linux_resolve_uid(kind, out + i * stride, stride, appname, uids[i]);
+	}
+}
+
+/** Forget the home folders remembered by the get_user_*_uid() functions.
+ *
+ * Call this after the user database has changed, e.g. when an account has
+ * been added or a home folder has moved.
+ */
+static inline void cfgpath_uid_cache_invalidate(void)
+{
+	pthread_mutex_lock(&cfgpath_uid_cache.lock);
+	unsigned int i;
+	for (i = 0; i < CFGPATH_UID_CACHE_SIZE; i++) cfgpath_uid_cache.entry[i].used = 0;
+	pthread_mutex_unlock(&cfgpath_uid_cache.lock);
+}
+
+/** Get the system-wide folders to search for configuration or data files.
+ *
+ * This is $XDG_CONFIG_DIRS or $XDG_DATA_DIRS split into separate folders, or
+ * the default from the XDG Base Directory specification if the variable is
+ * unset.  The folders are in order of importance, and do not include the
+ * user's own folder (see get_user_config_folder() et al.)
+ *
+ * The list is only parsed again when the environment variable changes, so
+ * this is cheap to call repeatedly.  The returned list never changes and stays
+ * valid for the life of the program, even if a later call returns a different
+ * one.
+ *
+ * Example use:
+ *
+ *   const struct cfgpath_dirs *dirs = cfgpath_get_system_dirs(CFGPATH_SEARCH_CONFIG);
+ *   for (unsigned int i = 0; dirs && (i < dirs->count); i++) {
+ *       printf("%s\n", dirs->dir[i]);   // e.g. "/etc/xdg/"
+ *   }
+ *
+ * @param which
+ *   Which list to get.
+ *
+ * @return The list of folders, each ending with a trailing slash, or NULL if
+ *   out of memory.
+ */
+static inline const struct cfgpath_dirs *cfgpath_get_system_dirs(enum cfgpath_search which)
+{
+	if ((unsigned int)which >= CFGPATH_SEARCH_COUNT) return NULL;
+	return cfgpath_linux_dirs(which);
+}
+
+#endif
 
-	unsigned int home_len = strlen(home);
-	unsigned int appname_len = strlen(appname);
-	const int ext_len = strlen(".conf");
+/* Deepest nesting of cfgpath_builder_push() calls. */
+#ifndef CFGPATH_BUILDER_DEPTH
+#define CFGPATH_BUILDER_DEPTH 16
+#endif
 
-	/* first +1 is "/", second is terminating null */
-	if (home_len + 1 + config_len + appname_len + ext_len + 1 > maxlen) {
-		out[0] = 0;
-		return;
-	}
+/** A folder that file names are added to, see cfgpath_builder_init(). */
+struct cfgpath_builder {
+	char *buf;            /**< The folder, or the last file from cfgpath_builder_file() */
+	unsigned int len;     /**< Length of the folder, including the trailing separator */
+	unsigned int maxlen;  /* Length of buf */
+	unsigned int depth;   /* Number of folders pushed */
+	unsigned int mark[CFGPATH_BUILDER_DEPTH];  /* len before each push */
+};
 
-	memcpy(out, home, home_len);
-	out += home_len;
-	*out = '/';
-	out++;
-	if (config_len) {
-		memcpy(out, ".config/", config_len);
-		out += config_len;
-		/* Make the .config folder if it doesn't already exist */
-		*out = '\0';
-		mkdir(out_orig, 0755);
-	}
-	memcpy(out, appname, appname_len);
-	out += appname_len;
-	memcpy(out, ".conf", ext_len);
-	out += ext_len;
-	*out = '\0';
-#elif defined(CFGPATH_WINDOWS)
-	if (maxlen < MAX_PATH) {
-		out[0] = 0;
-		return;
-	}
-	if (!SUCCEEDED(SHGetFolderPath(NULL, CSIDL_APPDATA, NULL, 0, out))) {
-		out[0] = 0;
-		return;
-	}
-	/* We don't try to create the AppData folder as it always exists already */
-	unsigned int appname_len = strlen(appname);
-	if (strlen(out) + 1 + appname_len + strlen(".ini") + 1 > maxlen) {
-		out[0] = 0;
-		return;
+/* Check that a name is a single file or folder name, so it can't be used to
+ * leave the folder it is added to. */
+static inline int cfgpath_builder_valid(const char *name, unsigned int len)
+{
+	if ((len == 0) || ((name[0] == '.')
+		&& ((len == 1) || ((len == 2) && (name[1] == '.'))))
+	) {
+		return 0;
 	}
-	strcat(out, "\\");
-	strcat(out, appname);
-	strcat(out, ".ini");
-#elif defined(CFGPATH_MAC)
-	FSRef ref;
-	FSFindFolder(kUserDomain, kApplicationSupportFolderType, kCreateFolder, &ref);
-	char home[MAX_PATH];
-	FSRefMakePath(&ref, (UInt8 *)&home, MAX_PATH);
-	/* first +1 is "/", second is terminating null */
-	const char *ext = ".conf";
-	if (strlen(home) + 1 + strlen(appname) + strlen(ext) + 1 > maxlen) {
-		out[0] = 0;
-		return;
+	unsigned int i;
+	for (i = 0; i < len; i++) {
+		if ((name[i] == '/') || (name[i] == PATH_SEPARATOR_CHAR)) return 0;
 	}
-
-	strcpy(out, home);
-	strcat(out, PATH_SEPARATOR_STRING);
-	strcat(out, appname);
-	strcat(out, ext);
-#endif
+	return 1;
 }
 
-/** Get an absolute path to a configuration folder, specific to this user.
+/** Start building paths in a folder.
  *
- * This function is useful for programs that need to store multiple
- * configuration files.  The output is a folder (which may not exist and will
- * need to be created) suitable for storing a number of files.
+ * The folder is copied into buf once, along with its length, so that names
+ * can be added to it in place without measuring or copying it again:
  *
- * The returned path will always end in a platform-specific trailing slash, so
- * that a filename can simply be appended to the path.
+ * char path[MAX_PATH];
+ * struct cfgpath_builder b;
+ * if (cfgpath_builder_init(&b, path, sizeof(path), CFGPATH_DATA_FOLDER,
+ *     "myapp") > 0
+ * ) {
+ *     cfgpath_builder_push(&b, "levels");
+ *     for (i = 0; i < count; i++) {
+ *         cfgpath_builder_file(&b, level[i]);  // e.g. ".../myapp/levels/1.dat"
+ *         load(path);
+ *     }
+ *     cfgpath_builder_pop(&b);
+ * }
  *
- * Output is typically:
+ * Nothing is allocated, so the longest path is limited by the size of buf.
  *
- *   Windows: C:\Users\jcitizen\AppData\Roaming\appname\
- *   Linux: /home/jcitizen/.config/appname/
- *   Mac: /Users/jcitizen/Library/Application Support/appname/
+ * @param b
+ *   Builder to set up.
  *
- * @param out
- *   Buffer to write the path.  On return will contain the path, or an empty
- *   string on error.
+ * @param buf
+ *   Buffer for the paths, which must stay valid while b is in use.  On return
+ *   will contain the folder, or an empty string if it does not fit or on
+ *   error.
  *
  * @param maxlen
- *   Length of out.  Must be >= MAX_PATH.
+ *   Length of buf.
+ *
+ * @param kind
+ *   Which folder to start from.  CFGPATH_CONFIG_FILE is not a folder, so is
+ *   not allowed.
  *
  * @param appname
- *   Short name of the application.  Avoid using spaces or version numbers, and
- *   use lowercase if possible.
+ *   Short name of the application, as for cfgpath_get().
  *
- * @post The folder is created if needed.
+ * @return Length of the folder as for cfgpath_get().  If this is not more than
+ *   0 and less than maxlen, b cannot be used.
  */
-static inline void get_user_config_folder(char *out, unsigned int maxlen, const char *appname)
+static inline int cfgpath_builder_init(struct cfgpath_builder *b, char *buf,
+	unsigned int maxlen, enum cfgpath_kind kind, const char *appname)
 {
-#ifdef CFGPATH_LINUX
-	const char *out_orig = out;
-	char *home = getenv("XDG_CONFIG_HOME");
-	unsigned int config_len = 0;
-	if (!home) {
-		home = getenv("HOME");
-		if (!home) {
-			// Can't find home directory
-			out[0] = 0;
-			return;
-		}
-		config_len = strlen(".config/");
+	b->buf = buf;
+	b->len = 0;
+	b->maxlen = maxlen;
+	b->depth = 0;
+	if (kind == CFGPATH_CONFIG_FILE) {
+		if (maxlen) buf[0] = 0;
+		return CFGPATH_ERR_INVALID;
 	}
+	int len = cfgpath_get(kind, buf, maxlen, appname);
+	if ((len > 0) && ((unsigned int)len < maxlen)) b->len = len;
+	return len;
+}
 
-	unsigned int home_len = strlen(home);
-	unsigned int appname_len = strlen(appname);
-
-	/* first +1 is "/", second is trailing "/", third is terminating null */
-	if (home_len + 1 + config_len + appname_len + 1 + 1 > maxlen) {
-		out[0] = 0;
-		return;
-	}
+/** Start building paths in a given folder.
+ *
+ * This is the same as cfgpath_builder_init(), but starting from any folder.
+ * A trailing separator is added if it is missing.
+ *
+ * @param folder
+ *   Folder to start from.
+ *
+ * @return Length of the folder, including the trailing separator.  If this is
+ *   maxlen or more it did not fit, and b cannot be used.  CFGPATH_ERR_INVALID
+ *   is returned if folder is empty.
+ */
+static inline int cfgpath_builder_init_folder(struct cfgpath_builder *b,
+	char *buf, unsigned int maxlen, const char *folder)
+{
+	b->buf = buf;
+	b->len = 0;
+	b->maxlen = maxlen;
+	b->depth = 0;
+	if (maxlen) buf[0] = 0;
+	unsigned int len = strlen(folder);
+	if (len == 0) return CFGPATH_ERR_INVALID;
+	int sep = (folder[len - 1] != '/') && (folder[len - 1] != PATH_SEPARATOR_CHAR);
+	if (len + sep >= maxlen) return len + sep;
+	memcpy(buf, folder, len);
+	if (sep) buf[len++] = PATH_SEPARATOR_CHAR;
+	buf[len] = 0;
+	b->len = len;
+	return len;
+}
 
-	memcpy(out, home, home_len);
-	out += home_len;
-	*out = '/';
-	out++;
-	if (config_len) {
-		memcpy(out, ".config/", config_len);
-		out += config_len;
-		/* Make the .config folder if it doesn't already exist */
-		*out = '\0';
-		mkdir(out_orig, 0755);
-	}
-	memcpy(out, appname, appname_len);
-	out += appname_len;
-	/* Make the .config/appname folder if it doesn't already exist */
-	*out = '\0';
-	mkdir(out_orig, 0755);
-	*out = '/';
-	out++;
-	*out = '\0';
-#elif defined(CFGPATH_WINDOWS)
-	if (maxlen < MAX_PATH) {
-		out[0] = 0;
-		return;
-	}
-	if (!SUCCEEDED(SHGetFolderPath(NULL, CSIDL_APPDATA, NULL, 0, out))) {
-		out[0] = 0;
-		return;
+/* Add a subfolder name of a given length, see cfgpath_builder_push(). */
+static inline int cfgpath_builder_push_n(struct cfgpath_builder *b,
+	const char *name, unsigned int name_len)
+{
+	if (!b->len || (b->depth >= CFGPATH_BUILDER_DEPTH)
+		|| !cfgpath_builder_valid(name, name_len)
+	) {
+		return CFGPATH_ERR_INVALID;
 	}
-	/* We don't try to create the AppData folder as it always exists already */
-	unsigned int appname_len = strlen(appname);
-	if (strlen(out) + 1 + appname_len + 1 + 1 > maxlen) {
-		out[0] = 0;
-		return;
+	unsigned int len = b->len + name_len + 1;
+	if (len >= b->maxlen) {
+		b->buf[b->len] = 0;
+		return len;
 	}
-	strcat(out, "\\");
-	strcat(out, appname);
-	/* Make the AppData\appname folder if it doesn't already exist */
-	mkdir(out);
-	strcat(out, "\\");
-#elif defined(CFGPATH_MAC)
-	FSRef ref;
-	FSFindFolder(kUserDomain, kApplicationSupportFolderType, kCreateFolder, &ref);
-	char home[MAX_PATH];
-	FSRefMakePath(&ref, (UInt8 *)&home, MAX_PATH);
-	/* first +1 is "/", second is trailing "/", third is terminating null */
-	if (strlen(home) + 1 + strlen(appname) + 1 + 1 > maxlen) {
-		out[0] = 0;
-		return;
+	memcpy(b->buf + b->len, name, name_len);
+	b->buf[len - 1] = PATH_SEPARATOR_CHAR;
+	b->buf[len] = 0;
+	b->mark[b->depth++] = b->len;
+	b->len = len;
+	return len;
+}
+
+/** Go into a subfolder.
+ *
+ * The subfolder and a separator are added to the end of the folder.  The
+ * subfolder is not created.
+ *
+ * @param name
+ *   Name of the subfolder.  It must be a single name, not "." or "..", and not
+ *   contain a separator.
+ *
+ * @return Length of the new folder.  If this is maxlen or more it did not
+ *   fit, and the folder is unchanged.  CFGPATH_ERR_INVALID is returned if name
+ *   is not allowed, CFGPATH_BUILDER_DEPTH subfolders have already been pushed,
+ *   or b could not be set up.
+ */
+static inline int cfgpath_builder_push(struct cfgpath_builder *b, const char *name)
+{
+	return cfgpath_builder_push_n(b, name, strlen(name));
+}
+
+/* Go into each folder named in a relative path, e.g. ".local/share/".  Empty
+ * names are skipped.  Returns as for cfgpath_builder_push(), stopping at the
+ * first name that can't be added. */
+static inline int cfgpath_builder_push_path(struct cfgpath_builder *b,
+	const char *path, unsigned int path_len)
+{
+	int len = b->len ? (int)b->len : CFGPATH_ERR_INVALID;
+	unsigned int start = 0, i;
+	for (i = 0; i <= path_len; i++) {
+		if ((i < path_len) && (path[i] != '/')) continue;
+		if (i > start) {
+			len = cfgpath_builder_push_n(b, path + start, i - start);
+			if ((len < 0) || ((unsigned int)len >= b->maxlen)) return len;
+		}
+		start = i + 1;
 	}
+	return len;
+}
 
-	strcpy(out, home);
-	strcat(out, PATH_SEPARATOR_STRING);
-	strcat(out, appname);
-	/* Make the .config/appname folder if it doesn't already exist */
-	mkdir(out, 0755);
-	strcat(out, PATH_SEPARATOR_STRING);
-#endif
+/** Go back to the folder before the last cfgpath_builder_push().
+ *
+ * @return Length of the folder, or CFGPATH_ERR_INVALID if there is nothing to
+ *   go back from.
+ */
+static inline int cfgpath_builder_pop(struct cfgpath_builder *b)
+{
+	if (b->depth == 0) return CFGPATH_ERR_INVALID;
+	b->len = b->mark[--b->depth];
+	b->buf[b->len] = 0;
+	return b->len;
 }
 
-/** Get an absolute path to a data storage folder, specific to this user.
+/** Get the path of a file in the current folder.
  *
- * This function is useful for programs that need to store larger amounts of
- * data specific to each user.  The output is a folder (which may not exist and
- * will need to be created) suitable for storing a number of data files.
+ * The name is written after the folder in buf, replacing the previous file if
+ * any.  The folder is left as it was, so this can be called again straight
+ * away for the next file.
  *
- * This path should be used for persistent, important data files the user would
- * want to keep.  Do not use this path for temporary files, cache files, or
- * other files that can be recreated if they are deleted.  Use
- * get_user_cache_folder() for those instead.
+ * @param name
+ *   Name of the file.  It must be a single name, as for cfgpath_builder_push().
  *
- * The returned path will always end in a platform-specific trailing slash, so
- * that a filename can simply be appended to the path.
+ * @return Length of the path in buf.  If this is maxlen or more it did not
+ *   fit, and buf only contains the folder.  CFGPATH_ERR_INVALID is returned if
+ *   name is not allowed or b could not be set up.
+ */
+static inline int cfgpath_builder_file(struct cfgpath_builder *b, const char *name)
+{
+	unsigned int name_len = strlen(name);
+	if (!b->len || !cfgpath_builder_valid(name, name_len)) {
+		if (b->len) b->buf[b->len] = 0;
+		return CFGPATH_ERR_INVALID;
+	}
+	unsigned int len = b->len + name_len;
+	if (len >= b->maxlen) {
+		b->buf[b->len] = 0;
+		return len;
+	}
+	memcpy(b->buf + b->len, name, name_len + 1);
+	return len;
+}
+
+#ifdef CFGPATH_LINUX
+/** Find the most important readable copy of a file.
  *
- * Output is typically:
+ * The user's folder ($XDG_CONFIG_HOME or $XDG_DATA_HOME, or their defaults) is
+ * checked first, followed by each folder from cfgpath_get_system_dirs() in
+ * turn.  No folders are created.  Only one file is checked at a time, so if
+ * there are many folders on slow filesystems, consider building the paths and
+ * using cfgpath_probe_first() from cfgpath-probe.h instead.
  *
- *   Windows: C:\Users\jcitizen\AppData\Roaming\appname-data\
- *   Linux: /home/jcitizen/.local/share/appname/
- *   Mac: /Users/jcitizen/Library/Application Support/appname-data/
+ * @param which
+ *   Which folders to search.
+ *
+ * @param relpath
+ *   Path of the file relative to each folder, e.g. "myapp/settings.conf".
+ *   Each name in it must be allowed by cfgpath_builder_push(), so it can't
+ *   leave the folder being searched.
  *
  * @param out
- *   Buffer to write the path.  On return will contain the path, or an empty
- *   string on error.
+ *   Buffer to write the path of the file found, or NULL if maxlen is 0.  On
+ *   return will contain the path, or an empty string if it does not fit or on
+ *   error.
  *
  * @param maxlen
- *   Length of out.  Must be >= MAX_PATH.
- *
- * @param appname
- *   Short name of the application.  Avoid using spaces or version numbers, and
- *   use lowercase if possible.
+ *   Length of out.
  *
- * @post The folder is created if needed.
+ * @return Length of the path as for cfgpath_get(), CFGPATH_ERR_NOTFOUND if
+ *   no readable file was found, or CFGPATH_ERR_INVALID if relpath is not
+ *   allowed.
  */
-static inline void get_user_data_folder(char *out, unsigned int maxlen, const char *appname)
+static inline int cfgpath_find_file(enum cfgpath_search which,
+	const char *relpath, char *out, unsigned int maxlen)
 {
-#ifdef CFGPATH_LINUX
-	const char *out_orig = out;
-	char *home = getenv("XDG_DATA_HOME");
-	unsigned int config_len = 0;
-	if (!home) {
-		home = getenv("HOME");
-		if (!home) {
-			// Can't find home directory
-			out[0] = 0;
-			return;
-		}
-		config_len = strlen(".local/share/");
+	if (((unsigned int)which >= CFGPATH_SEARCH_COUNT) || !relpath) {
+		if (maxlen) out[0] = 0;
+		return CFGPATH_ERR_INVALID;
 	}
+	enum cfgpath_kind kind = (which == CFGPATH_SEARCH_CONFIG)
+		? CFGPATH_CONFIG_FOLDER : CFGPATH_DATA_FOLDER;
+	struct cfgpath_stats_scope scope;
+	cfgpath_stats_begin(&scope, kind);
 
-	unsigned int home_len = strlen(home);
-	unsigned int appname_len = strlen(appname);
+	char stack_buf[MAX_PATH];
+	char *buf = stack_buf;
+	unsigned int buf_size = sizeof(stack_buf);
+	unsigned int rel_len = strlen(relpath);
+	const char *name = strrchr(relpath, '/');
+	name = name ? name + 1 : relpath;
+	int len = CFGPATH_ERR_NOTFOUND;
 
-	/* first +1 is "/", second is trailing "/", third is terminating null */
-	if (home_len + 1 + config_len + appname_len + 1 + 1 > maxlen) {
-		out[0] = 0;
-		return;
+	/* The user's folder comes first, e.g. $XDG_CONFIG_HOME, or $HOME with
+	 * ".config/" pushed onto it */
+	const char *xdg = cfgpath_linux_getenv(cfgpath_linux_kinds[kind].xdg_env);
+	const char *home = xdg ? NULL : cfgpath_linux_getenv(CFGPATH_ENV_HOME);
+	const char *sub = xdg ? "" : cfgpath_linux_kinds[kind].home_dir;
+	const struct cfgpath_dirs *dirs = cfgpath_linux_dirs(which);
+	unsigned int i, count = dirs ? dirs->count : 0;
+	/* i == 0 is the user's folder, i > 0 is dirs->dir[i - 1] */
+	for (i = (xdg || home) ? 0 : 1; i <= count; i++) {
+		const char *dir = i ? dirs->dir[i - 1] : (xdg ? xdg : home);
+		unsigned int sub_len = i ? 0 : strlen(sub);
+		/* +1 for a separator added after dir, +1 for the terminating null */
+		unsigned int size = (i ? dirs->len[i - 1] : strlen(dir)) + sub_len + rel_len + 2;
+		if (size > buf_size) {
+			if (buf != stack_buf) free(buf);
+			buf_size = size;
+			buf = (char *)malloc(buf_size);
+			if (!buf) {
+				len = CFGPATH_ERR_NOMEM;
+				break;
+			}
+		}
+		struct cfgpath_builder b;
+		if (cfgpath_builder_init_folder(&b, buf, buf_size, dir) <= 0) continue;
+		cfgpath_builder_push_path(&b, sub, sub_len);
+		int file_len = cfgpath_builder_push_path(&b, relpath, name - relpath);
+		if (file_len >= 0) file_len = cfgpath_builder_file(&b, name);
+		if (file_len < 0) {
+			len = file_len;
+			break;
+		}
+		if (cfgpath_fs_access(buf, R_OK) == 0) {
+			len = file_len;
+			break;
+		}
 	}
 
-	memcpy(out, home, home_len);
-	out += home_len;
-	*out = '/';
-	out++;
-	if (config_len) {
-		memcpy(out, ".local/share/", config_len);
-		out += config_len;
-		/* Make the .local/share folder if it doesn't already exist */
-		*out = '\0';
-		mkdir(out_orig, 0755);
-	}
-	memcpy(out, appname, appname_len);
-	out += appname_len;
-	/* Make the .local/share/appname folder if it doesn't already exist */
-	*out = '\0';
-	mkdir(out_orig, 0755);
-	*out = '/';
-	out++;
-	*out = '\0';
-#elif defined(CFGPATH_WINDOWS) || defined(CFGPATH_MAC)
-	/* No distinction under Windows or OS X */
-	get_user_config_folder(out, maxlen, appname);
-#endif
+	if (len < 0) {
+		if (maxlen) out[0] = 0;
+	} else if ((unsigned int)len >= maxlen) {
+		if (maxlen) out[0] = 0;
+	} else {
+		memcpy(out, buf, len + 1);
+	}
+	if (buf && (buf != stack_buf)) free(buf);
+
+	cfgpath_stats_end(&scope);
+	return len;
 }
+#endif
 
-/** Get an absolute path to a temporary storage folder, specific to this user.
- *
- * This function is useful for programs that temporarily need to store larger
- * amounts of data specific to each user.  The output is a folder (which may
- * not exist and will need to be created) suitable for storing a number of
- * temporary files.  The files may be lost or deleted when the program
- * terminates.
- *
- * This path should be used for temporary, unimportant data files that can
- * safely be deleted after the program terminates.  Do not use this path for
- * any important files the user would want to keep.  Use get_user_data_folder()
- * for those instead.
- *
- * The returned path will always end in a platform-specific trailing slash, so
- * that a filename can simply be appended to the path.
+/** All the paths for an application, as filled in by cfgpath_resolve_all(). */
+struct cfgpath_all {
+	char config_file[MAX_PATH];   /**< As from get_user_config_file() */
+	char config_folder[MAX_PATH]; /**< As from get_user_config_folder() */
+	char data_folder[MAX_PATH];   /**< As from get_user_data_folder() */
+	char cache_folder[MAX_PATH];  /**< As from get_user_cache_folder() */
+};
+
+/** Get all the paths for an application in a single call.
  *
- * Output is typically:
+ * This is equivalent to calling get_user_config_file(),
+ * get_user_config_folder(), get_user_data_folder() and get_user_cache_folder()
+ * one after the other, but is cheaper as the environment is only examined
+ * once and folders shared between the paths are only created once.  It is
+ * useful for programs that need most of the paths at startup.
  *
- *   Windows: C:\Users\jcitizen\AppData\Local\appname\
- *   Linux: /home/jcitizen/.cache/appname/
- *   Mac: /Users/jcitizen/Library/Application Support/appname/
+ * The cache enabled by cfgpath_cache_enable() is neither consulted nor updated.
  *
  * @param out
- *   Buffer to write the path.  On return will contain the path, or an empty
- *   string on error.
- *
- * @param maxlen
- *   Length of out.  Must be >= MAX_PATH.
+ *   Structure to fill.  Each member will contain the path, or an empty string
+ *   if that path could not be obtained.
  *
  * @param appname
  *   Short name of the application.  Avoid using spaces or version numbers, and
  *   use lowercase if possible.
  *
- * @post The folder is created if needed.
+ * @post The folders are created if needed.
  */
-static inline void get_user_cache_folder(char *out, unsigned int maxlen, const char *appname)
+static inline void cfgpath_resolve_all(struct cfgpath_all *out, const char *appname)
 {
 #ifdef CFGPATH_LINUX
-	const char *out_orig = out;
-	char *home = getenv("XDG_CACHE_HOME");
-	unsigned int config_len = 0;
-	if (!home) {
-		home = getenv("HOME");
-		if (!home) {
-			// Can't find home directory
-			out[0] = 0;
-			return;
-		}
-		config_len = strlen(".cache/");
+	struct cfgpath_stats_scope scope;
+	unsigned int base_len;
+	int len;
+
+	/* Statistics for the shared environment lookups go to the config folder */
+	cfgpath_stats_begin(&scope, CFGPATH_CONFIG_FOLDER);
+	const char *home = cfgpath_linux_getenv(CFGPATH_ENV_HOME);
+	const char *xdg_config = cfgpath_linux_getenv(CFGPATH_ENV_XDG_CONFIG_HOME);
+	const char *xdg_data = cfgpath_linux_getenv(CFGPATH_ENV_XDG_DATA_HOME);
+	const char *xdg_cache = cfgpath_linux_getenv(CFGPATH_ENV_XDG_CACHE_HOME);
+	len = cfgpath_linux_build(CFGPATH_CONFIG_FOLDER, out->config_folder,
+		sizeof(out->config_folder), appname, xdg_config, home, &base_len);
+	/* Creating the config folder also creates the config file's parent */
+	if (cfgpath_fits(len, sizeof(out->config_folder))) {
+		cfgpath_linux_create(CFGPATH_CONFIG_FOLDER, out->config_folder, len, base_len);
 	}
+	cfgpath_stats_end(&scope);
 
-	unsigned int home_len = strlen(home);
-	unsigned int appname_len = strlen(appname);
+	cfgpath_stats_begin(&scope, CFGPATH_CONFIG_FILE);
+	cfgpath_linux_build(CFGPATH_CONFIG_FILE, out->config_file,
+		sizeof(out->config_file), appname, xdg_config, home, &base_len);
+	cfgpath_stats_end(&scope);
 
-	/* first +1 is "/", second is trailing "/", third is terminating null */
-	if (home_len + 1 + config_len + appname_len + 1 + 1 > maxlen) {
-		out[0] = 0;
-		return;
+	cfgpath_stats_begin(&scope, CFGPATH_DATA_FOLDER);
+	len = cfgpath_linux_build(CFGPATH_DATA_FOLDER, out->data_folder,
+		sizeof(out->data_folder), appname, xdg_data, home, &base_len);
+	if (cfgpath_fits(len, sizeof(out->data_folder))) {
+		cfgpath_linux_create(CFGPATH_DATA_FOLDER, out->data_folder, len, base_len);
 	}
+	cfgpath_stats_end(&scope);
 
-	memcpy(out, home, home_len);
-	out += home_len;
-	*out = '/';
-	out++;
-	if (config_len) {
-		memcpy(out, ".cache/", config_len);
-		out += config_len;
-		/* Make the .cache folder if it doesn't already exist */
-		*out = '\0';
-		mkdir(out_orig, 0755);
-	}
-	memcpy(out, appname, appname_len);
-	out += appname_len;
-	/* Make the .cache/appname folder if it doesn't already exist */
-	*out = '\0';
-	mkdir(out_orig, 0755);
-	*out = '/';
-	out++;
-	*out = '\0';
-#elif defined(CFGPATH_WINDOWS)
-	if (maxlen < MAX_PATH) {
-		out[0] = 0;
-		return;
-	}
-	if (!SUCCEEDED(SHGetFolderPath(NULL, CSIDL_LOCAL_APPDATA, NULL, 0, out))) {
-		out[0] = 0;
-		return;
-	}
-	/* We don't try to create the AppData folder as it always exists already */
-	unsigned int appname_len = strlen(appname);
-	if (strlen(out) + 1 + appname_len + 1 + 1 > maxlen) {
-		out[0] = 0;
-		return;
+	cfgpath_stats_begin(&scope, CFGPATH_CACHE_FOLDER);
+	len = cfgpath_linux_build(CFGPATH_CACHE_FOLDER, out->cache_folder,
+		sizeof(out->cache_folder), appname, xdg_cache, home, &base_len);
+	if (cfgpath_fits(len, sizeof(out->cache_folder))) {
+		cfgpath_linux_create(CFGPATH_CACHE_FOLDER, out->cache_folder, len, base_len);
 	}
-	strcat(out, "\\");
-	strcat(out, appname);
-	/* Make the AppData\appname folder if it doesn't already exist */
-	mkdir(out);
-	strcat(out, "\\");
-#elif defined(CFGPATH_MAC)
-	/* No distinction under OS X */
-	get_user_config_folder(out, maxlen, appname);
+	cfgpath_stats_end(&scope);
+#else
+	get_user_config_file(out->config_file, sizeof(out->config_file), appname);
+	get_user_config_folder(out->config_folder, sizeof(out->config_folder), appname);
+#if defined(CFGPATH_WINDOWS)
+	/* Same as the config folder, see get_user_data_folder() */
+	strcpy(out->data_folder, out->config_folder);
+	get_user_cache_folder(out->cache_folder, sizeof(out->cache_folder), appname);
+#else
+	/* All the same under OS X, see get_user_cache_folder() */
+	strcpy(out->data_folder, out->config_folder);
+	strcpy(out->cache_folder, out->config_folder);
+#endif
 #endif
 }
 
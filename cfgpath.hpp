@@ -0,0 +1,226 @@
+/**
+ * @file  cfgpath.hpp
+ * @brief C++ interface to cfgpath.h with the appname fixed at compile time.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Requires C++20.  Example use:
+ *
+ * auto cfg = cfgpath::config_file<"myapp">();
+ * if (cfg.empty()) {
+ *     std::cerr << "Unable to find home directory.\n";
+ *     return 1;
+ * }
+ * std::cout << "Saving configuration file to " << cfg.view() << "\n";
+ *
+ * As the appname is a template parameter, the end of each path (e.g.
+ * "myapp.conf" or "myapp/") is assembled by the compiler along with its length.
+ * At runtime only the base folder is looked up and copied, and the result is
+ * returned in a fixed size buffer without any heap allocation.
+ *
+ * The paths are resolved by cfgpath_get_prefixed(), so they are the same as
+ * those from the equivalent get_user_*() functions in cfgpath.h, which can
+ * still be used alongside, and share the cache, filesystem hooks and
+ * statistics.
+ *
+ * Each function also has an _async() version for use in a coroutine, which
+ * creates the folders without blocking the caller, see cfgpath_get_async():
+ *
+ * cfgpath::path cache = co_await cfgpath::cache_folder_async<"myapp">();
+ */
+
+#ifndef CFGPATH_HPP_
+#define CFGPATH_HPP_
+
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include "cfgpath.h"
+
+namespace cfgpath {
+
+/// String literal usable as a template parameter, e.g. config_file<"myapp">().
+template <std::size_t N>
+struct fixed_string {
+	char value[N];
+
+	constexpr fixed_string(const char (&str)[N])
+	{
+		for (std::size_t i = 0; i < N; i++) value[i] = str[i];
+	}
+
+	/// Length excluding the terminating null.
+	static constexpr std::size_t size() { return N - 1; }
+};
+
+/// Null-terminated string stored inline, with a fixed maximum capacity.
+template <std::size_t Capacity>
+class inline_string {
+	public:
+		constexpr inline_string() : len(0), buf{} {}
+
+		const char *c_str() const { return this->buf; }
+		std::size_t size() const { return this->len; }
+		bool empty() const { return this->len == 0; }
+		std::string_view view() const { return std::string_view(this->buf, this->len); }
+		operator std::string_view() const { return this->view(); }
+
+		/// Buffer to write into directly, of Capacity bytes.
+		char *data() { return this->buf; }
+
+		/// Set the length after writing to data(), which must be null terminated.
+		void set_size(std::size_t n) { this->len = n; }
+
+		static constexpr std::size_t capacity() { return Capacity; }
+
+	private:
+		std::size_t len;
+		char buf[Capacity];
+};
+
+/// Type returned by the path functions.
+using path = inline_string<MAX_PATH>;
+
+namespace detail {
+
+/// Concatenation of several string literals, computed at compile time.
+template <std::size_t N>
+struct literal {
+	char value[N + 1];
+	static constexpr std::size_t size() { return N; }
+};
+
+/// The end of the path for a given kind and appname, as expected by
+/// cfgpath_get_prefixed(): the appname followed by ".conf" for the config
+/// file, or by the path separator for the folders.
+template <cfgpath_kind Kind, fixed_string App>
+struct suffix {
+	static constexpr const char *ext() {
+		return (Kind == CFGPATH_CONFIG_FILE) ? ".conf" : PATH_SEPARATOR_STRING;
+	}
+	static constexpr std::size_t strlen(const char *s) {
+		std::size_t n = 0;
+		while (s[n]) n++;
+		return n;
+	}
+
+	static constexpr auto make()
+	{
+		constexpr std::size_t n = App.size() + strlen(ext());
+		literal<n> out{};
+		std::size_t pos = 0;
+		for (std::size_t i = 0; i < App.size(); i++) out.value[pos++] = App.value[i];
+		for (const char *e = ext(); *e; e++) out.value[pos++] = *e;
+		out.value[pos] = 0;
+		return out;
+	}
+
+	static constexpr auto value = make();
+};
+
+template <cfgpath_kind Kind, fixed_string App>
+inline path get()
+{
+	constexpr const auto &sfx = suffix<Kind, App>::value;
+	path out;
+	int len = cfgpath_get_prefixed(Kind, out.data(), path::capacity(), sfx.value,
+		sfx.size(), CFGPATH_CREATE_NOW);
+	if ((len > 0) && (static_cast<std::size_t>(len) < path::capacity())) {
+		out.set_size(len);
+	}
+	return out;
+}
+
+/// Awaitable returned by the *_async() functions.
+///
+/// The coroutine is resumed on cfgpath's background thread once the folders
+/// have been created.  It carries on in the calling thread without being
+/// suspended if the path cannot be resolved, or if the work was done before
+/// cfgpath_get_async() returned (on other platforms, or if the background
+/// thread could not be started).
+class get_awaiter {
+	public:
+		get_awaiter(cfgpath_kind kind, const char *appname)
+			: kind(kind), appname(appname), finished(0)
+		{
+		}
+
+		bool await_ready() const noexcept { return false; }
+
+		bool await_suspend(std::coroutine_handle<> h) noexcept
+		{
+			this->handle = h;
+			if (cfgpath_get_async(this->kind, this->appname, &get_awaiter::done,
+				this) != 0) return false;
+			// Whichever of this and done() gets here second resumes the coroutine.
+			// If done() was first, it has already finished in this thread, so it
+			// is resumed by returning false.  Otherwise done() may resume and
+			// destroy the coroutine (and this object with it) at any moment, so
+			// nothing can be touched after.
+			return !__atomic_exchange_n(&this->finished, 1, __ATOMIC_ACQ_REL);
+		}
+
+		/// The path, or an empty path on error.
+		path await_resume() noexcept { return this->result; }
+
+	private:
+		static void done(int len, const char *p, void *ctx)
+		{
+			get_awaiter *self = static_cast<get_awaiter *>(ctx);
+			if ((len > 0) && (static_cast<std::size_t>(len) < path::capacity())) {
+				std::memcpy(self->result.data(), p, len + 1);
+				self->result.set_size(len);
+			}
+			if (__atomic_exchange_n(&self->finished, 1, __ATOMIC_ACQ_REL)) {
+				self->handle.resume();
+			}
+		}
+
+		cfgpath_kind kind;
+		const char *appname;
+		int finished;  ///< Set by the first of await_suspend() and done()
+		std::coroutine_handle<> handle;
+		path result;
+};
+
+} // namespace detail
+
+/// Same as get_user_config_file(), returning an empty path on error.
+template <fixed_string App>
+inline path config_file() { return detail::get<CFGPATH_CONFIG_FILE, App>(); }
+
+/// Same as get_user_config_folder(), returning an empty path on error.
+template <fixed_string App>
+inline path config_folder() { return detail::get<CFGPATH_CONFIG_FOLDER, App>(); }
+
+/// Same as get_user_data_folder(), returning an empty path on error.
+template <fixed_string App>
+inline path data_folder() { return detail::get<CFGPATH_DATA_FOLDER, App>(); }
+
+/// Same as get_user_cache_folder(), returning an empty path on error.
+template <fixed_string App>
+inline path cache_folder() { return detail::get<CFGPATH_CACHE_FOLDER, App>(); }
+
+/// Same as config_file(), without blocking the coroutine's thread.
+template <fixed_string App>
+inline detail::get_awaiter config_file_async() { return { CFGPATH_CONFIG_FILE, App.value }; }
+
+/// Same as config_folder(), without blocking the coroutine's thread.
+template <fixed_string App>
+inline detail::get_awaiter config_folder_async() { return { CFGPATH_CONFIG_FOLDER, App.value }; }
+
+/// Same as data_folder(), without blocking the coroutine's thread.
+template <fixed_string App>
+inline detail::get_awaiter data_folder_async() { return { CFGPATH_DATA_FOLDER, App.value }; }
+
+/// Same as cache_folder(), without blocking the coroutine's thread.
+template <fixed_string App>
+inline detail::get_awaiter cache_folder_async() { return { CFGPATH_CACHE_FOLDER, App.value }; }
+
+} // namespace cfgpath
+
+#endif /* CFGPATH_HPP_ */
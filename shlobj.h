@@ -12,8 +12,9 @@
 #error This file should not be used under Windows, use the system version instead!
 #endif
 
-#define CSIDL_APPDATA       26 /* roaming appdata */
-#define CSIDL_LOCAL_APPDATA 28
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
 
 #define S_OK 0
 #define S_FALSE 1
@@ -22,3 +23,84 @@
 #define SUCCEEDED(hr) ((hr) >= 0)
 
 #define MAX_PATH 256
+
+typedef long HRESULT;
+typedef unsigned long DWORD;
+typedef void *HANDLE;
+typedef wchar_t *PWSTR;
+typedef const wchar_t *LPCWSTR;
+
+typedef struct {
+	unsigned long Data1;
+	unsigned short Data2;
+	unsigned short Data3;
+	unsigned char Data4[8];
+} KNOWNFOLDERID;
+typedef const KNOWNFOLDERID *REFKNOWNFOLDERID;
+
+static const KNOWNFOLDERID FOLDERID_RoamingAppData = { 0x3EB685DB, 0x65F9, 0x4CF6,
+	{ 0xA0, 0x3A, 0xE3, 0xEF, 0x65, 0x72, 0x9F, 0x3D } };
+static const KNOWNFOLDERID FOLDERID_LocalAppData = { 0xF1B32785, 0x6FBA, 0x4FCF,
+	{ 0x9D, 0x55, 0x7B, 0x8E, 0x7F, 0x15, 0x70, 0x91 } };
+
+typedef int BOOL;
+#define TRUE 1
+#define FALSE 0
+
+#define KF_FLAG_DEFAULT 0
+#define CP_ACP 0
+#define WC_NO_BEST_FIT_CHARS 0x400
+#define MB_ERR_INVALID_CHARS 0x8
+
+/* Supplied by the test code */
+HRESULT SHGetKnownFolderPath(REFKNOWNFOLDERID rfid, DWORD dwFlags,
+	HANDLE hToken, PWSTR *ppszPath);
+BOOL CreateDirectoryW(LPCWSTR lpPathName, void *lpSecurityAttributes);
+
+static inline void CoTaskMemFree(void *pv)
+{
+	free(pv);
+}
+
+/* Acts as if the ANSI code page were ASCII, anything else becoming '?' */
+static inline int WideCharToMultiByte(unsigned int CodePage, DWORD dwFlags,
+	LPCWSTR lpWideCharStr, int cchWideChar, char *lpMultiByteStr,
+	int cbMultiByte, const char *lpDefaultChar, BOOL *lpUsedDefaultChar)
+{
+	(void)CodePage;
+	(void)dwFlags;
+	(void)lpDefaultChar;
+	int len = (cchWideChar < 0) ? (int)wcslen(lpWideCharStr) + 1 : cchWideChar;
+	int i;
+	if (lpUsedDefaultChar) {
+		*lpUsedDefaultChar = FALSE;
+		for (i = 0; i < len; i++) {
+			if ((unsigned int)lpWideCharStr[i] > 0x7F) *lpUsedDefaultChar = TRUE;
+		}
+	}
+	if (cbMultiByte == 0) return len;
+	if (cbMultiByte < len) return 0;
+	for (i = 0; i < len; i++) {
+		lpMultiByteStr[i] = ((unsigned int)lpWideCharStr[i] > 0x7F)
+			? '?' : (char)lpWideCharStr[i];
+	}
+	return len;
+}
+
+/* Acts as if the ANSI code page were ASCII, failing on anything else */
+static inline int MultiByteToWideChar(unsigned int CodePage, DWORD dwFlags,
+	const char *lpMultiByteStr, int cbMultiByte, wchar_t *lpWideCharStr,
+	int cchWideChar)
+{
+	(void)CodePage;
+	(void)dwFlags;
+	int len = (cbMultiByte < 0) ? (int)strlen(lpMultiByteStr) + 1 : cbMultiByte;
+	int i;
+	for (i = 0; i < len; i++) {
+		if ((unsigned char)lpMultiByteStr[i] > 0x7F) return 0;
+	}
+	if (cchWideChar == 0) return len;
+	if (cchWideChar < len) return 0;
+	for (i = 0; i < len; i++) lpWideCharStr[i] = (unsigned char)lpMultiByteStr[i];
+	return len;
+}
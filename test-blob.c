@@ -0,0 +1,143 @@
+/**
+ * @file  test-blob.c
+ * @brief cfgpath-blob.h test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cfgpath-blob.h"
+#include "test.h"
+
+char tmpdir[] = "/tmp/test-blob-XXXXXX";
+
+int main(void)
+{
+	struct cfgpath_blob_store store;
+	struct cfgpath_view view;
+	char key[CFGPATH_BLOB_KEY_LEN + 1];
+	char name[CFGPATH_BLOB_NAME_LEN + 1];
+	char path[256];
+	char small[64];
+	struct stat st;
+
+	/* Standard SHA-256 test vectors */
+	cfgpath_blob_key("", 0, key);
+	CHECK(!strcmp(key, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855"),
+		"cfgpath_blob_key() hashes an empty blob.");
+	cfgpath_blob_key("abc", 3, key);
+	CHECK(!strcmp(key, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"),
+		"cfgpath_blob_key() hashes a blob of one block.");
+	const char *two = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	cfgpath_blob_key(two, strlen(two), key);
+	CHECK(!strcmp(key, "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1"),
+		"cfgpath_blob_key() hashes a blob padded to two blocks.");
+	size_t big_len = 1000000;
+	char *big = (char *)malloc(big_len);
+	memset(big, 'a', big_len);
+	cfgpath_blob_key(big, big_len, key);
+	CHECK(!strcmp(key, "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0"),
+		"cfgpath_blob_key() hashes a blob of many blocks.");
+
+	CHECK(cfgpath_blob_name(key, name) == 0,
+		"cfgpath_blob_name() accepts a valid key.");
+	CHECK(!strncmp(name, "cd/c7/cdc76e5c", 14),
+		"cfgpath_blob_name() puts the blob in shard folders.");
+	CHECK(cfgpath_blob_name("../etc/passwd", name) != 0,
+		"cfgpath_blob_name() rejects a key that leaves the store.");
+	CHECK(cfgpath_blob_name("CDC76E5C9914FB9281A1C7E284D73E67F1809A48A497200E046D39CCC7112CD0",
+		name) != 0, "cfgpath_blob_name() rejects an uppercase key.");
+
+	CHECK(mkdtemp(tmpdir) != NULL, "mkdtemp() creates the test folder.");
+	snprintf(path, sizeof(path), "%s/store", tmpdir);
+	CHECK(cfgpath_blob_open(&store, path) == 0,
+		"cfgpath_blob_open() opens a new store.");
+	CHECK(stat(path, &st) == 0, "cfgpath_blob_open() creates the store folder.");
+
+	CHECK(cfgpath_blob_put(&store, "abc", 3, key) == 0,
+		"cfgpath_blob_put() stores a new blob.");
+	CHECK(!strcmp(key, "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad"),
+		"cfgpath_blob_put() returns the key of the blob.");
+	snprintf(path, sizeof(path), "%s/store/ba/78/%s", tmpdir, key);
+	CHECK(stat(path, &st) == 0,
+		"cfgpath_blob_put() stores the blob in shard folders.");
+	ino_t ino = st.st_ino;
+	CHECK(cfgpath_blob_exists(&store, key),
+		"cfgpath_blob_exists() finds a stored blob.");
+	CHECK(cfgpath_blob_put(&store, "abc", 3, NULL) == 1,
+		"cfgpath_blob_put() returns 1 for a blob already stored.");
+	CHECK((stat(path, &st) == 0) && (st.st_ino == ino),
+		"cfgpath_blob_put() leaves a blob already stored alone.");
+
+	CHECK(cfgpath_blob_get(&store, key, &view, small, sizeof(small)) == 0,
+		"cfgpath_blob_get() reads a stored blob.");
+	CHECK((view.len == 3) && !memcmp(view.data, "abc", 3),
+		"cfgpath_blob_get() returns the contents of the blob.");
+	CHECK(view.data == small,
+		"cfgpath_blob_get() reads a small blob into the buffer.");
+	cfgpath_view_release(&view);
+
+	CHECK(cfgpath_blob_put(&store, big, big_len, key) == 0,
+		"cfgpath_blob_put() stores a large blob.");
+	CHECK(cfgpath_blob_get(&store, key, &view, small, sizeof(small)) == 0,
+		"cfgpath_blob_get() reads a large blob.");
+	CHECK((view.len == big_len) && (view.map != NULL),
+		"cfgpath_blob_get() maps a large blob.");
+	CHECK(!memcmp(view.data, big, big_len),
+		"cfgpath_blob_get() returns the contents of a large blob.");
+
+	/* A mapping outlives the blob being removed */
+	CHECK(cfgpath_blob_remove(&store, key) == 0,
+		"cfgpath_blob_remove() removes a stored blob.");
+	CHECK(!cfgpath_blob_exists(&store, key),
+		"cfgpath_blob_exists() no longer finds a removed blob.");
+	CHECK(view.data[big_len - 1] == 'a',
+		"cfgpath_blob_remove() leaves an existing mapping readable.");
+	cfgpath_view_release(&view);
+	CHECK((cfgpath_blob_remove(&store, key) != 0) && (errno == ENOENT),
+		"cfgpath_blob_remove() fails with ENOENT for a missing blob.");
+	CHECK((cfgpath_blob_get(&store, key, &view, NULL, 0) != 0) && (errno == ENOENT),
+		"cfgpath_blob_get() fails with ENOENT for a missing blob.");
+	CHECK((cfgpath_blob_get(&store, "nothex", &view, NULL, 0) != 0) && (errno == EINVAL),
+		"cfgpath_blob_get() fails with EINVAL for a bad key.");
+
+	CHECK(cfgpath_blob_put(&store, "", 0, key) == 0,
+		"cfgpath_blob_put() stores an empty blob.");
+	CHECK((cfgpath_blob_get(&store, key, &view, NULL, 0) == 0) && (view.len == 0),
+		"cfgpath_blob_get() reads an empty blob.");
+	cfgpath_view_release(&view);
+	cfgpath_blob_close(&store);
+
+	/* Reopening finds the blobs already there */
+	snprintf(path, sizeof(path), "%s/store/", tmpdir);
+	CHECK(cfgpath_blob_open(&store, path) == 0,
+		"cfgpath_blob_open() reopens a store, with a trailing slash.");
+	CHECK(cfgpath_blob_put(&store, "abc", 3, key) == 1,
+		"cfgpath_blob_put() finds blobs stored before reopening.");
+	cfgpath_blob_close(&store);
+
+	/* The store in the cache folder */
+	setenv("XDG_CACHE_HOME", tmpdir, 1);
+	cfgpath_cache_invalidate();
+	CHECK(cfgpath_blob_open_app(&store, "test-blob") == 0,
+		"cfgpath_blob_open_app() opens the application's store.");
+	CHECK(cfgpath_blob_put(&store, "abc", 3, key) == 0,
+		"cfgpath_blob_put() stores a blob in the application's store.");
+	snprintf(path, sizeof(path), "%s/test-blob/blobs/ba/78/%s", tmpdir, key);
+	CHECK(stat(path, &st) == 0,
+		"cfgpath_blob_open_app() keeps the store in the cache folder.");
+	cfgpath_blob_close(&store);
+
+	free(big);
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", tmpdir);
+	if (system(cmd) != 0) printf("Could not clean up %s\n", tmpdir);
+
+	printf("All tests passed for cfgpath-blob.h.\n");
+	return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * @file  test-conf.c
+ * @brief cfgpath-conf.h test code.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cfgpath-conf.h"
+#include "test.h"
+
+#define CHECK_VALUE(section, key, result, msg) { \
+	int len = cfgpath_conf_get(&conf, section, key, value, sizeof(value)); \
+	if ((len != (int)strlen(result)) || (strcmp(value, result) != 0)) { \
+		printf("FAIL: %s:%d cfgpath_conf_get() " msg "\n" \
+			"Expected: %s\nGot: %s\n", __FILE__, __LINE__, result, value); \
+		return 1; \
+	} else { \
+		printf("PASS: cfgpath_conf_get() " msg "\n"); \
+	} \
+}
+
+/* Not null terminated, to check nothing reads past the end */
+const char test_file[] =
+	"# Comment\n"
+	"name = global\n"
+	"\n"
+	"[window]\r\n"
+	"  title\t=  My App  \r\n"
+	"width=640\n"
+	"; width = 800\n"
+	"height = 0x1E0\n"
+	"empty =\n"
+	"not a key\n"
+	"= no key\n"
+	"[ other ]\n"
+	"name = other\n"
+	"title = \"  quoted \\\"text\\\"\\n\"\n"
+	"name = replaced";
+
+int main(void)
+{
+	struct cfgpath_conf conf;
+	char value[64];
+
+	CHECK(cfgpath_conf_parse(&conf, test_file, sizeof(test_file) - 1) == 0,
+		"cfgpath_conf_parse() succeeds.");
+	CHECK(conf.count == 8, "cfgpath_conf_parse() finds every key.");
+
+	CHECK_VALUE(NULL, "name", "global", "finds keys before the first section.");
+	CHECK_VALUE("", "name", "global", "treats \"\" as no section.");
+	CHECK_VALUE("window", "title", "My App", "trims spaces and CRLF.");
+	CHECK_VALUE("window", "width", "640", "works without spaces.");
+	CHECK_VALUE("window", "empty", "", "works with empty values.");
+	CHECK_VALUE("other", "title", "  quoted \"text\"\n", "decodes quoted values.");
+	CHECK_VALUE("other", "name", "replaced", "uses the last of a repeated key.");
+
+	CHECK(cfgpath_conf_get(&conf, "window", "name", value, sizeof(value))
+		== CFGPATH_ERR_NOTFOUND && (value[0] == 0),
+		"cfgpath_conf_get() keeps sections apart.");
+	CHECK(cfgpath_conf_get(&conf, "Window", "title", value, sizeof(value))
+		== CFGPATH_ERR_NOTFOUND, "cfgpath_conf_get() is case sensitive.");
+	CHECK(cfgpath_conf_get(&conf, "window", "not a key", value, sizeof(value))
+		== CFGPATH_ERR_NOTFOUND, "cfgpath_conf_get() skips lines without '='.");
+
+	CHECK((cfgpath_conf_get(&conf, "window", "title", NULL, 0) == 6),
+		"cfgpath_conf_get() returns the length with no buffer.");
+	CHECK((cfgpath_conf_get(&conf, "other", "title", value, 5) == 16)
+		&& (value[0] == 0),
+		"cfgpath_conf_get() returns an empty string when the buffer is too small.");
+
+	unsigned int raw_len;
+	const struct cfgpath_conf_entry *entry = cfgpath_conf_find(&conf, "other", "title");
+	const char *raw = cfgpath_conf_raw(&conf, entry, &raw_len);
+	CHECK((raw > test_file) && (raw < test_file + sizeof(test_file))
+		&& (raw_len == 21) && (raw[0] == '"'),
+		"cfgpath_conf_raw() points into the parsed text.");
+
+	CHECK(cfgpath_conf_get_long(&conf, "window", "width", -1) == 640,
+		"cfgpath_conf_get_long() reads decimal values.");
+	CHECK(cfgpath_conf_get_long(&conf, "window", "height", -1) == 480,
+		"cfgpath_conf_get_long() reads hex values.");
+	CHECK(cfgpath_conf_get_long(&conf, "window", "title", -1) == -1,
+		"cfgpath_conf_get_long() returns the default for text.");
+	CHECK(cfgpath_conf_get_long(&conf, "window", "depth", 24) == 24,
+		"cfgpath_conf_get_long() returns the default for missing keys.");
+	cfgpath_conf_free(&conf);
+
+	CHECK((cfgpath_conf_parse(&conf, "[a]\n# b = c\n", 12) == 0)
+		&& (conf.count == 0) && !cfgpath_conf_find(&conf, "a", "b"),
+		"cfgpath_conf_parse() works with no keys.");
+	cfgpath_conf_free(&conf);
+
+	/* Enough keys to fill the table several times over if it didn't grow */
+	char big[100 * 32];
+	int i, pos = 0;
+	for (i = 0; i < 100; i++) {
+		pos += snprintf(big + pos, sizeof(big) - pos, "key%d = %d\n", i, i * 3);
+	}
+	CHECK(cfgpath_conf_parse(&conf, big, pos) == 0,
+		"cfgpath_conf_parse() succeeds with many keys.");
+	for (i = 0; i < 100; i++) {
+		char key[16];
+		snprintf(key, sizeof(key), "key%d", i);
+		if (cfgpath_conf_get_long(&conf, NULL, key, -1) != i * 3) break;
+	}
+	CHECK(i == 100, "cfgpath_conf_get_long() finds every one of many keys.");
+	cfgpath_conf_free(&conf);
+
+	printf("All tests passed for cfgpath-conf.h.\n");
+	return 0;
+}
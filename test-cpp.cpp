@@ -0,0 +1,187 @@
+/**
+ * @file  test-cpp.cpp
+ * @brief cfgpath.hpp test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#ifndef __linux__
+#define __linux__
+#endif
+#undef WIN32
+#define mkdir test_mkdir
+#define pthread_create test_pthread_create
+#include "cfgpath.hpp"
+
+/* The end of each path is assembled at compile time */
+static_assert(cfgpath::detail::suffix<CFGPATH_CONFIG_FILE, "app">::value.size() == strlen("app.conf"));
+static_assert(cfgpath::detail::suffix<CFGPATH_DATA_FOLDER, "app">::value.value[3] == '/');
+
+/* <cstdlib> removes any getenv macro, so the real environment is used */
+void set_env(int xdg_valid, int home_valid)
+{
+	if (xdg_valid) {
+		setenv("XDG_CONFIG_HOME", "/home/test/.config", 1);
+	} else {
+		unsetenv("XDG_CONFIG_HOME");
+	}
+	if (home_valid) {
+		setenv("HOME", "/home/test", 1);
+	} else {
+		unsetenv("HOME");
+	}
+	unsetenv("XDG_DATA_HOME");
+	unsetenv("XDG_CACHE_HOME");
+}
+
+int test_mkdir_calls;    /* Number of times mkdir() has been called */
+int test_mkdir_real;     /* Pass mkdir() calls through to the real function? */
+
+#undef mkdir
+extern "C" int mkdir(const char *path, mode_t mode) noexcept;
+
+int test_mkdir(const char *path, mode_t mode) noexcept
+{
+	test_mkdir_calls++;
+	if (test_mkdir_real) return mkdir(path, mode);
+	return 0;
+}
+
+int test_pthread_fail;   /* Make pthread_create() fail? */
+
+#undef pthread_create
+extern "C" int pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+	void *(*start)(void *), void *arg) noexcept;
+
+extern "C" int test_pthread_create(pthread_t *thread, const pthread_attr_t *attr,
+	void *(*start)(void *), void *arg) noexcept
+{
+	if (test_pthread_fail) return EAGAIN;
+	return pthread_create(thread, attr, start, arg);
+}
+
+/* Coroutine that runs until it finishes, without being waited on */
+struct detached {
+	struct promise_type {
+		detached get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() {}
+	};
+};
+
+cfgpath::path test_async_result;
+
+detached test_async()
+{
+	test_async_result = co_await cfgpath::data_folder_async<"test-cpp">();
+}
+
+#define TOSTRING_X(x) #x
+#define TOSTRING(x) TOSTRING_X(x)
+#define RUN_TEST(result, msg) \
+	CHECK_RESULT(TEST_FUNC<"test-cpp">(), result, msg)
+
+#define CHECK_RESULT(value, result, msg) { \
+	cfgpath::path p = value; \
+	if ((strcmp(p.c_str(), result) != 0) || (p.size() != strlen(result))) { \
+		printf("FAIL: %s:%d " TOSTRING(TEST_FUNC) "() returned the wrong value.\n" \
+			"Expected: %s\nGot: %s\n", __FILE__, __LINE__, result, p.c_str()); \
+		return 1; \
+	} else { \
+		printf("PASS: " TOSTRING(TEST_FUNC) "() " msg "\n"); \
+	} \
+}
+
+int main()
+{
+	char expected_c[256];
+#define TEST_FUNC cfgpath::config_file
+	set_env(1, 1);
+	RUN_TEST("/home/test/.config/test-cpp.conf", "works with $XDG_CONFIG_HOME.");
+	set_env(0, 1);
+	test_mkdir_calls = 0;
+	RUN_TEST("/home/test/.config/test-cpp.conf", "works with $HOME and not $XDG_CONFIG_HOME.");
+	if (test_mkdir_calls != 1) {
+		printf("FAIL: %s:%d expected 1 call to mkdir(), got %d.\n", __FILE__,
+			__LINE__, test_mkdir_calls);
+		return 1;
+	}
+	set_env(0, 0);
+	RUN_TEST("", "returns empty string when $XDG_CONFIG_HOME and $HOME are absent.");
+#undef TEST_FUNC
+
+#define TEST_FUNC cfgpath::config_folder
+	set_env(0, 1);
+	RUN_TEST("/home/test/.config/test-cpp/", "works with $HOME.");
+
+	/* Shares the cache with the C functions */
+	struct cfgpath_stats stats;
+	cfgpath_stats_enable(1);
+	cfgpath_cache_enable(1);
+	test_mkdir_calls = 0;
+	get_user_config_folder(expected_c, sizeof(expected_c), "test-cpp");
+	RUN_TEST("/home/test/.config/test-cpp/", "works with a cached path.");
+	cfgpath_cache_enable(0);
+	cfgpath_stats_enable(0);
+	cfgpath_stats_get(&stats);
+	if ((test_mkdir_calls != 1) || (stats.kind[CFGPATH_CONFIG_FOLDER].calls != 2)
+		|| (stats.kind[CFGPATH_CONFIG_FOLDER].cache_hits != 1)
+	) {
+		printf("FAIL: %s:%d cache not shared: mkdir=%d calls=%llu hits=%llu\n",
+			__FILE__, __LINE__, test_mkdir_calls, stats.kind[CFGPATH_CONFIG_FOLDER].calls,
+			stats.kind[CFGPATH_CONFIG_FOLDER].cache_hits);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() shares the cache and statistics.\n");
+#undef TEST_FUNC
+
+#define TEST_FUNC cfgpath::data_folder
+	RUN_TEST("/home/test/.local/share/test-cpp/", "works with $HOME.");
+#undef TEST_FUNC
+
+#define TEST_FUNC cfgpath::cache_folder
+	RUN_TEST("/home/test/.cache/test-cpp/", "works with $HOME.");
+#undef TEST_FUNC
+
+#define TEST_FUNC cfgpath::data_folder_async
+	char tmpdir[] = "/tmp/test-cpp-XXXXXX";
+	char expected[256];
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	setenv("XDG_DATA_HOME", tmpdir, 1);
+	snprintf(expected, sizeof(expected), "%s/test-cpp/", tmpdir);
+	test_mkdir_real = 1;
+	/* Without the background thread it all happens inside co_await */
+	test_pthread_fail = 1;
+	test_async_result = cfgpath::path();
+	test_async();
+	test_pthread_fail = 0;
+	CHECK_RESULT(test_async_result, expected,
+		"works when finished before the coroutine is suspended.");
+	test_async_result = cfgpath::path();
+	test_async();
+	cfgpath_flush();
+	test_mkdir_real = 0;
+	CHECK_RESULT(test_async_result, expected, "works in a coroutine.");
+
+	unsetenv("XDG_DATA_HOME");
+	set_env(0, 0);
+	test_async();
+	CHECK_RESULT(test_async_result, "", "returns empty string when $HOME is absent.");
+#undef TEST_FUNC
+	snprintf(expected, sizeof(expected), "rm -rf '%s'", tmpdir);
+	if (system(expected) != 0) return 1;
+
+	printf("All tests passed for C++ on platform: Linux.\n");
+	return 0;
+}
@@ -0,0 +1,225 @@
+/**
+ * @file  test-file.c
+ * @brief cfgpath-file.h test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+
+#include "cfgpath-file.h"
+#include "test.h"
+
+/* Write a file containing len bytes of a repeating pattern */
+int write_file(const char *path, size_t len)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) return -1;
+	size_t i;
+	for (i = 0; i < len; i++) fputc('a' + (i % 26), f);
+	return fclose(f);
+}
+
+/* Check the view holds what write_file() wrote */
+int check_view(const struct cfgpath_view *view, size_t len)
+{
+	size_t i;
+	if (view->len != len) return 0;
+	for (i = 0; i < len; i++) if (view->data[i] != (char)('a' + (i % 26))) return 0;
+	return 1;
+}
+
+/* Count the entries in a folder, including hidden ones */
+int count_files(const char *path)
+{
+	int count = 0;
+	DIR *dir = opendir(path);
+	if (!dir) return -1;
+	struct dirent *de;
+	while ((de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") && strcmp(de->d_name, "..")) count++;
+	}
+	closedir(dir);
+	return count;
+}
+
+/* Folder whose opening is being looked for by test_before() */
+const char *test_open_path;
+int test_open_seen;
+
+void test_before(enum cfgpath_fs_op op, const char *path, void *ctx)
+{
+	(void)ctx;
+	if ((op == CFGPATH_FS_OPEN) && !strcmp(path, test_open_path)) test_open_seen++;
+}
+
+/* Replace a file with len bytes of the write_file() pattern */
+int replace_file(const char *path, size_t len)
+{
+	struct cfgpath_writer w;
+	char data[26];
+	size_t i;
+	for (i = 0; i < 26; i++) data[i] = 'a' + i;
+	if (cfgpath_write_begin(&w, path) != 0) return -1;
+	for (i = 0; i < len; i += 26) {
+		if (cfgpath_write(&w, data, (len - i < 26) ? len - i : 26) != 0) {
+			cfgpath_write_abort(&w);
+			return -1;
+		}
+	}
+	return cfgpath_write_commit(&w);
+}
+
+int main(void)
+{
+	char tmpdir[] = "/tmp/test-file-XXXXXX";
+	char path[256], buf[4096];
+	struct cfgpath_view view;
+
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "%s/small.conf", tmpdir);
+	write_file(path, 100);
+	CHECK((cfgpath_map_file(path, &view, buf, sizeof(buf)) == 0)
+		&& (view.data == buf) && !view.map && check_view(&view, 100),
+		"cfgpath_map_file() reads a small file into the buffer.");
+	cfgpath_view_release(&view);
+
+	CHECK((cfgpath_map_file(path, &view, NULL, 0) == 0)
+		&& view.map && (view.data == view.map) && check_view(&view, 100),
+		"cfgpath_map_file() maps a file when there is no buffer.");
+	cfgpath_view_release(&view);
+	CHECK(!view.data && !view.map, "cfgpath_view_release() clears the view.");
+
+	snprintf(path, sizeof(path), "%s/large.conf", tmpdir);
+	write_file(path, 100000);
+	CHECK((cfgpath_map_file(path, &view, buf, sizeof(buf)) == 0)
+		&& view.map && check_view(&view, 100000),
+		"cfgpath_map_file() maps a file too big for the buffer.");
+	cfgpath_view_release(&view);
+
+	snprintf(path, sizeof(path), "%s/exact.conf", tmpdir);
+	write_file(path, sizeof(buf));
+	CHECK((cfgpath_map_file(path, &view, buf, sizeof(buf)) == 0)
+		&& view.map && check_view(&view, sizeof(buf)),
+		"cfgpath_map_file() maps a file the same size as the buffer.");
+	cfgpath_view_release(&view);
+
+	snprintf(path, sizeof(path), "%s/empty.conf", tmpdir);
+	write_file(path, 0);
+	CHECK((cfgpath_map_file(path, &view, NULL, 0) == 0) && view.data
+		&& (view.len == 0),
+		"cfgpath_map_file() works with an empty file.");
+	cfgpath_view_release(&view);
+
+	snprintf(path, sizeof(path), "%s/missing.conf", tmpdir);
+	CHECK((cfgpath_map_file(path, &view, buf, sizeof(buf)) == -1)
+		&& (errno == ENOENT) && !view.data,
+		"cfgpath_map_file() fails with ENOENT for a missing file.");
+	CHECK((cfgpath_map_file(tmpdir, &view, buf, sizeof(buf)) == -1)
+		&& (errno == EISDIR),
+		"cfgpath_map_file() fails with EISDIR for a folder.");
+
+	setenv("XDG_CONFIG_HOME", tmpdir, 1);
+	snprintf(path, sizeof(path), "%s/test-file.conf", tmpdir);
+	write_file(path, 1000);
+	CHECK((cfgpath_map_config_file("test-file", &view, buf, sizeof(buf)) == 0)
+		&& check_view(&view, 1000),
+		"cfgpath_map_config_file() reads the user's config file.");
+	cfgpath_view_release(&view);
+	unsetenv("XDG_CONFIG_HOME");
+	unsetenv("HOME");
+	CHECK((cfgpath_map_config_file("test-file", &view, buf, sizeof(buf)) == -1)
+		&& (errno == ENOENT),
+		"cfgpath_map_config_file() fails with ENOENT without a home folder.");
+
+	char dir[sizeof(tmpdir) + 16];
+	struct cfgpath_writer w;
+	snprintf(dir, sizeof(dir), "%s/write/sub", tmpdir);
+	snprintf(path, sizeof(path), "%s/new.conf", dir);
+	/* The new "write" folder is synced into the test folder */
+	struct cfgpath_fs_hooks hooks = { test_before, NULL, NULL };
+	test_open_path = tmpdir;
+	cfgpath_set_fs_hooks(&hooks);
+	CHECK((replace_file(path, 500) == 0)
+		&& (cfgpath_map_file(path, &view, NULL, 0) == 0) && check_view(&view, 500),
+		"cfgpath_write_commit() creates a new file and its folder.");
+	cfgpath_set_fs_hooks(NULL);
+	CHECK(test_open_seen == 1,
+		"cfgpath_write_begin() syncs the folder holding a folder it creates.");
+
+	/* The old contents stay readable through the mapping */
+	CHECK((replace_file(path, 1000) == 0) && check_view(&view, 500),
+		"cfgpath_write_commit() leaves mapped old contents alone.");
+	cfgpath_view_release(&view);
+	CHECK((cfgpath_map_file(path, &view, NULL, 0) == 0) && check_view(&view, 1000),
+		"cfgpath_write_commit() replaces an existing file.");
+	cfgpath_view_release(&view);
+
+	struct stat st;
+	CHECK((chmod(path, 0600) == 0) && (replace_file(path, 1000) == 0)
+		&& (stat(path, &st) == 0) && ((st.st_mode & 07777) == 0600)
+		&& (st.st_uid == geteuid()),
+		"cfgpath_write_commit() keeps the permissions of the file it replaces.");
+
+	CHECK((cfgpath_write_begin(&w, path) == 0)
+		&& (cfgpath_write(&w, "partial", 7) == 0),
+		"cfgpath_write_begin() succeeds.");
+	cfgpath_write_abort(&w);
+	CHECK((cfgpath_map_file(path, &view, NULL, 0) == 0) && check_view(&view, 1000)
+		&& (count_files(dir) == 1),
+		"cfgpath_write_abort() leaves the old file and nothing else.");
+	cfgpath_view_release(&view);
+
+	/* This is built without _GNU_SOURCE, which must not stop the batch from
+	 * starting writeback on every file before waiting for any */
+#if defined(__linux__) && defined(__LP64__)
+#ifndef CFGPATH_SYNC_FILE_RANGE
+#error cfgpath_write_commit_batch() does not start writeback without _GNU_SOURCE
+#endif
+	int fd = open(path, O_RDONLY);
+	CHECK((fd >= 0) && (CFGPATH_SYNC_FILE_RANGE(fd) == 0),
+		"cfgpath_write_commit_batch() can start writeback without _GNU_SOURCE.");
+	close(fd);
+#endif
+
+	struct cfgpath_writer batch[20];
+	int i, ok = 1;
+	for (i = 0; i < 20; i++) {
+		snprintf(path, sizeof(path), "%s/batch%d.conf", dir, i);
+		if ((cfgpath_write_begin(&batch[i], path) != 0)
+			|| (cfgpath_write(&batch[i], "abcdefghijklmnopqrstuvwxyz", 1 + i) != 0)
+		) {
+			ok = 0;
+		}
+	}
+	CHECK(ok && (cfgpath_write_commit_batch(batch, 20) == 0),
+		"cfgpath_write_commit_batch() succeeds.");
+	for (i = 0; ok && (i < 20); i++) {
+		snprintf(path, sizeof(path), "%s/batch%d.conf", dir, i);
+		ok = (cfgpath_map_file(path, &view, buf, sizeof(buf)) == 0)
+			&& check_view(&view, 1 + i);
+		cfgpath_view_release(&view);
+	}
+	CHECK(ok && (count_files(dir) == 21),
+		"cfgpath_write_commit_batch() replaces every file and leaves nothing else.");
+
+	snprintf(path, sizeof(path), "%s/", dir);
+	CHECK((cfgpath_write_begin(&w, path) == -1) && (errno == EISDIR),
+		"cfgpath_write_begin() fails with EISDIR for a folder.");
+
+	char cmd[64 + sizeof(tmpdir)];
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", tmpdir);
+	if (system(cmd) != 0) return 1;
+
+	printf("All tests passed for cfgpath-file.h.\n");
+	return 0;
+}
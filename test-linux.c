@@ -17,28 +17,122 @@
 #undef WIN32
 #define getenv test_getenv
 #define mkdir test_mkdir
+#define getpwuid_r test_getpwuid_r
 #include "cfgpath.h"
 
 int test_env_xdg_valid;  /* Does $XDG_CONFIG_HOME exist? */
 int test_env_home_valid; /* Does $HOME exist? */
 
-char getenv_buffer[256];
+const char *test_xdg = "/home/test/.config"; /* Value of $XDG_CONFIG_HOME */
+const char *test_home = "/home/test"; /* Value of $HOME */
+const char *test_config_dirs; /* Value of $XDG_CONFIG_DIRS, or NULL if unset */
+const char *test_runtime_dir; /* Value of $XDG_RUNTIME_DIR, or NULL if unset */
+int test_mkdir_calls; /* Number of times mkdir() has been called */
+int test_mkdir_real;  /* Pass mkdir() calls through to the real function? */
+
+char getenv_buffer[1024];
 
 char *test_getenv(const char *var)
 {
 	if (test_env_xdg_valid && (strcmp(var, "XDG_CONFIG_HOME") == 0)) {
-		strcpy(getenv_buffer, "/home/test/.config");
+		strcpy(getenv_buffer, test_xdg);
 		return getenv_buffer;
 	}
 	if (test_env_home_valid && (strcmp(var, "HOME") == 0)) {
-		strcpy(getenv_buffer, "/home/test");
+		strcpy(getenv_buffer, test_home);
 		return getenv_buffer;
 	}
+	if (test_config_dirs && (strcmp(var, "XDG_CONFIG_DIRS") == 0)) {
+		/* Not copied, so that it can be longer than getenv_buffer */
+		return (char *)test_config_dirs;
+	}
+	if (test_runtime_dir && (strcmp(var, "XDG_RUNTIME_DIR") == 0)) {
+		return (char *)test_runtime_dir;
+	}
 	return NULL;
 }
 
+/* Fake user database */
+struct {
+	uid_t uid;
+	const char *home;
+} test_passwd[] = {
+	{ 1000, "/home/alice" },
+	{ 1001, "/home/bob" },
+};
+int test_getpwuid_r_calls; /* Number of times getpwuid_r() has been called */
+
+int test_getpwuid_r(uid_t uid, struct passwd *pwd, char *buf, size_t buflen,
+	struct passwd **result)
+{
+	unsigned int i;
+	test_getpwuid_r_calls++;
+	*result = NULL;
+	for (i = 0; i < sizeof(test_passwd) / sizeof(test_passwd[0]); i++) {
+		if (test_passwd[i].uid == uid) {
+			if (strlen(test_passwd[i].home) + 1 > buflen) return ERANGE;
+			memset(pwd, 0, sizeof(*pwd));
+			strcpy(buf, test_passwd[i].home);
+			pwd->pw_uid = uid;
+			pwd->pw_dir = buf;
+			*result = pwd;
+			return 0;
+		}
+	}
+	return 0;
+}
+
+/* Background task that waits until test_block is cleared */
+int test_block;
+
+void test_block_run(struct cfgpath_task *task)
+{
+	(void)task;
+	while (__atomic_load_n(&test_block, __ATOMIC_ACQUIRE)) usleep(1000);
+}
+
+/* Filesystem hooks that record the last operation */
+int test_hook_before, test_hook_after;
+enum cfgpath_fs_op test_hook_op;
+char test_hook_path[256];
+
+void test_before(enum cfgpath_fs_op op, const char *path, void *ctx)
+{
+	(void)ctx;
+	test_hook_before++;
+	test_hook_op = op;
+	strcpy(test_hook_path, path ? path : "");
+}
+
+void test_after(enum cfgpath_fs_op op, const char *path, int result, int err,
+	unsigned long long elapsed_ns, void *ctx)
+{
+	(void)op;
+	(void)path;
+	(void)result;
+	(void)err;
+	(void)elapsed_ns;
+	(void)ctx;
+	test_hook_after++;
+}
+
+int test_async_result;        /* Result passed to test_async_done() */
+char test_async_path[256];    /* Path passed to test_async_done() */
+
+void test_async_done(int result, const char *path, void *ctx)
+{
+	test_async_result = result;
+	strcpy(test_async_path, path);
+	(*(int *)ctx)++;
+}
+
+#undef mkdir
+int mkdir(const char *path, mode_t mode);
+
 int test_mkdir(const char *path, mode_t mode)
 {
+	test_mkdir_calls++;
+	if (test_mkdir_real) return mkdir(path, mode);
 	return 0;
 }
 
@@ -57,7 +151,7 @@ int test_mkdir(const char *path, mode_t mode)
 		printf("PASS: " TOSTRING(TEST_FUNC) "() " msg "\n"); \
 	}
 
-int main(int argc, char *argv[])
+int main(void)
 {
 	char buffer[256];
 
@@ -169,6 +263,912 @@ int main(int argc, char *argv[])
 #undef TEST_FUNC
 #undef TEST_RESULT
 
+/*
+ * cfgpath_cache_enable()
+ */
+
+#define TEST_RESULT "/home/test/.config/test-linux/"
+#define TEST_FUNC get_user_config_folder
+
+	cfgpath_cache_enable(1);
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	test_mkdir_calls = 0;
+	RUN_TEST(TEST_RESULT, "works with the cache enabled.");
+	if (test_mkdir_calls == 0) {
+		printf("FAIL: %s:%d cache miss did not create the folder.\n", __FILE__, __LINE__);
+		return 1;
+	}
+
+	test_mkdir_calls = 0;
+	RUN_TEST(TEST_RESULT, "returns the cached path.");
+	if (test_mkdir_calls != 0) {
+		printf("FAIL: %s:%d cache hit called mkdir() %d times.\n", __FILE__, __LINE__,
+			test_mkdir_calls);
+		return 1;
+	}
+
+	/* A reader gives up rather than spinning forever on a stuck writer */
+	cfgpath_cache.seq++;
+	if (cfgpath_cache_read(&cfgpath_cache, CFGPATH_CONFIG_FOLDER, "test-linux",
+		strlen("test-linux"), buffer, sizeof(buffer)) != -1
+	) {
+		printf("FAIL: %s:%d cache read did not give up while the cache was busy.\n",
+			__FILE__, __LINE__);
+		return 1;
+	}
+	cfgpath_cache.seq++;
+	printf("PASS: cfgpath_cache_read() gives up while the cache is busy.\n");
+
+	test_home = "/home/other";
+	RUN_TEST("/home/other/.config/test-linux/", "notices when $HOME changes.");
+	test_home = "/home/test";
+
+	test_env_xdg_valid = 1;
+	RUN_TEST(TEST_RESULT, "notices when $XDG_CONFIG_HOME is set.");
+
+	test_mkdir_calls = 0;
+	cfgpath_cache_invalidate();
+	RUN_TEST(TEST_RESULT, "resolves again after cfgpath_cache_invalidate().");
+	if (test_mkdir_calls == 0) {
+		printf("FAIL: %s:%d invalidated cache did not create the folder.\n", __FILE__, __LINE__);
+		return 1;
+	}
+
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 0;
+	RUN_TEST("", "returns empty string when $HOME goes away.");
+	cfgpath_cache_enable(0);
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * cfgpath_resolve_all()
+ */
+
+#define TEST_FUNC cfgpath_resolve_all
+
+	struct cfgpath_all all;
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	test_mkdir_calls = 0;
+	TEST_FUNC(&all, "test-linux");
+	strcpy(buffer, all.config_file);
+	CHECK_RESULT("/home/test/.config/test-linux.conf", "returns the config file.");
+	strcpy(buffer, all.config_folder);
+	CHECK_RESULT("/home/test/.config/test-linux/", "returns the config folder.");
+	strcpy(buffer, all.data_folder);
+	CHECK_RESULT("/home/test/.local/share/test-linux/", "returns the data folder.");
+	strcpy(buffer, all.cache_folder);
+	CHECK_RESULT("/home/test/.cache/test-linux/", "returns the cache folder.");
+	if (test_mkdir_calls != 3) {
+		printf("FAIL: %s:%d expected 3 calls to mkdir(), got %d.\n", __FILE__,
+			__LINE__, test_mkdir_calls);
+		return 1;
+	}
+
+	test_env_xdg_valid = 1;
+	test_env_home_valid = 0;
+	TEST_FUNC(&all, "test-linux");
+	strcpy(buffer, all.config_folder);
+	CHECK_RESULT("/home/test/.config/test-linux/", "works with only $XDG_CONFIG_HOME.");
+	strcpy(buffer, all.cache_folder);
+	CHECK_RESULT("", "returns empty cache folder without $HOME.");
+
+#undef TEST_FUNC
+
+/*
+ * Folder creation
+ */
+
+#define TEST_FUNC get_user_config_folder
+
+	char tmpdir[] = "/tmp/test-linux-XXXXXX";
+	char expected[512];
+	struct stat st;
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(getenv_buffer, sizeof(getenv_buffer), "%s/a//b/c", tmpdir);
+	char deep_xdg[256];
+	strcpy(deep_xdg, getenv_buffer);
+	test_xdg = deep_xdg;
+	test_env_xdg_valid = 1;
+	test_mkdir_real = 1;
+	snprintf(expected, sizeof(expected), "%s/test-linux/", deep_xdg);
+	RUN_TEST(expected, "works when $XDG_CONFIG_HOME does not exist.");
+	if ((stat(buffer, &st) != 0) || !S_ISDIR(st.st_mode)) {
+		printf("FAIL: %s:%d %s was not created.\n", __FILE__, __LINE__, buffer);
+		return 1;
+	}
+
+	test_mkdir_calls = 0;
+	RUN_TEST(expected, "works when the folder already exists.");
+	if (test_mkdir_calls != 1) {
+		printf("FAIL: %s:%d expected 1 call to mkdir(), got %d.\n", __FILE__,
+			__LINE__, test_mkdir_calls);
+		return 1;
+	}
+
+#undef TEST_FUNC
+#define TEST_FUNC get_user_config_file
+
+	snprintf(getenv_buffer, sizeof(getenv_buffer), "%s/d/e", tmpdir);
+	strcpy(deep_xdg, getenv_buffer);
+	snprintf(expected, sizeof(expected), "%s/test-linux.conf", deep_xdg);
+	RUN_TEST(expected, "creates a missing $XDG_CONFIG_HOME.");
+	if ((stat(deep_xdg, &st) != 0) || !S_ISDIR(st.st_mode)) {
+		printf("FAIL: %s:%d %s was not created.\n", __FILE__, __LINE__, deep_xdg);
+		return 1;
+	}
+
+#undef TEST_FUNC
+
+/*
+ * get_user_config_folder_fd()
+ */
+
+	int fd = get_user_config_folder_fd("test-linux");
+	if (fd < 0) {
+		printf("FAIL: %s:%d get_user_config_folder_fd() failed.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	if (get_user_config_folder_fd("test-linux") != fd) {
+		printf("FAIL: %s:%d get_user_config_folder_fd() did not reuse the handle.\n",
+			__FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: get_user_config_folder_fd() reuses the handle.\n");
+	int file = openat(fd, "test.conf", O_WRONLY | O_CREAT, 0644);
+	snprintf(expected, sizeof(expected), "%s/test-linux/test.conf", deep_xdg);
+	if ((file < 0) || (stat(expected, &st) != 0)) {
+		printf("FAIL: %s:%d openat() did not create %s.\n", __FILE__, __LINE__,
+			expected);
+		return 1;
+	}
+	close(file);
+	printf("PASS: get_user_config_folder_fd() works with openat().\n");
+
+	/* Push the first handle out of the cache */
+	int other;
+	for (other = 0; other < CFGPATH_CACHE_SIZE + 4; other++) {
+		char other_name[32];
+		snprintf(other_name, sizeof(other_name), "test-linux-%d", other);
+		if (get_user_config_folder_fd(other_name) < 0) return 1;
+	}
+	if ((fcntl(fd, F_GETFD) < 0) || (fstat(fd, &st) != 0) || !S_ISDIR(st.st_mode)) {
+		printf("FAIL: %s:%d handle closed while still in use.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: get_user_config_folder_fd() keeps handles open until "
+		"cfgpath_close_folder_fds().\n");
+	cfgpath_close_folder_fds();
+	if (fcntl(fd, F_GETFD) >= 0) {
+		printf("FAIL: %s:%d cfgpath_close_folder_fds() left a handle open.\n",
+			__FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_close_folder_fds() closes replaced handles.\n");
+
+	test_mkdir_real = 0;
+	test_xdg = "/home/test/.config";
+	snprintf(expected, sizeof(expected), "rm -rf '%s'", tmpdir);
+	if (system(expected) != 0) return 1;
+
+/*
+ * cfgpath_env_refresh()
+ */
+
+#define TEST_RESULT "/home/test/.config/test-linux/"
+#define TEST_FUNC get_user_config_folder
+
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	cfgpath_env_refresh();
+	test_home = "/home/other";
+	RUN_TEST(TEST_RESULT, "uses the snapshot from cfgpath_env_refresh().");
+
+	cfgpath_env_refresh();
+	RUN_TEST("/home/other/.config/test-linux/", "sees changes after cfgpath_env_refresh().");
+
+	cfgpath_cache_enable(1);
+	RUN_TEST("/home/other/.config/test-linux/", "caches a path from the snapshot.");
+	test_home = "/home/test";
+	cfgpath_env_refresh();
+	RUN_TEST(TEST_RESULT, "does not use a cached path from an old snapshot.");
+	cfgpath_cache_enable(0);
+
+	cfgpath_env_release();
+	test_env_home_valid = 0;
+	RUN_TEST("", "reads the environment after cfgpath_env_release().");
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * get_user_*_env()
+ */
+
+	char *envp[] = {
+		"PATH=/bin",
+		"HOMEDIR=/wrong",
+		"HOME=/home/child",
+		"XDG_CACHE_HOME=/var/cache/child",
+		NULL
+	};
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 0;
+
+#define TEST_FUNC get_user_config_file_env
+	test_mkdir_calls = 0;
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", cfgpath_envp_getenv, envp);
+	CHECK_RESULT("/home/child/.config/test-linux.conf", "works with $HOME in envp.");
+	if (test_mkdir_calls != 0) {
+		printf("FAIL: %s:%d " TOSTRING(TEST_FUNC) "() created folders in another "
+			"environment.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() does not create any folders.\n");
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", cfgpath_envp_getenv, NULL);
+	CHECK_RESULT("", "returns empty string with no environment.");
+#undef TEST_FUNC
+
+#define TEST_FUNC get_user_cache_folder_env
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", cfgpath_envp_getenv, envp);
+	CHECK_RESULT("/var/cache/child/test-linux/", "works with $XDG_CACHE_HOME in envp.");
+#undef TEST_FUNC
+
+/*
+ * get_user_*_uid()
+ */
+
+#define TEST_FUNC get_user_config_file_uid
+
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 0;
+	test_getpwuid_r_calls = 0;
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", 1000);
+	CHECK_RESULT("/home/alice/.config/test-linux.conf", "looks up the home folder.");
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", 1001);
+	CHECK_RESULT("/home/bob/.config/test-linux.conf", "works for a second user.");
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", 1000);
+	CHECK_RESULT("/home/alice/.config/test-linux.conf", "works for a cached user.");
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", 4242);
+	CHECK_RESULT("", "returns empty string for an unknown user.");
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", 4242);
+	CHECK_RESULT("", "returns empty string for a cached unknown user.");
+	if (test_getpwuid_r_calls != 3) {
+		printf("FAIL: %s:%d expected 3 calls to getpwuid_r(), got %d.\n", __FILE__,
+			__LINE__, test_getpwuid_r_calls);
+		return 1;
+	}
+
+	test_env_home_valid = 1;
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", getuid());
+	CHECK_RESULT("/home/test/.config/test-linux.conf", "uses $HOME for the current user.");
+	TEST_FUNC(buffer, sizeof(buffer), "test-linux", 1001);
+	CHECK_RESULT("/home/bob/.config/test-linux.conf", "ignores $HOME for other users.");
+
+#undef TEST_FUNC
+#define TEST_FUNC cfgpath_resolve_uids
+
+	uid_t uids[] = { 1001, 1001, 4242, 1000 };
+	char uid_paths[4][64];
+	test_env_home_valid = 0;
+	test_getpwuid_r_calls = 0;
+	cfgpath_uid_cache_invalidate();
+	TEST_FUNC(CFGPATH_CACHE_FOLDER, "test-linux", uids, 4, uid_paths[0],
+		sizeof(uid_paths[0]));
+	strcpy(buffer, uid_paths[1]);
+	CHECK_RESULT("/home/bob/.cache/test-linux/", "handles repeated uids.");
+	strcpy(buffer, uid_paths[2]);
+	CHECK_RESULT("", "returns empty string for an unknown user.");
+	strcpy(buffer, uid_paths[3]);
+	CHECK_RESULT("/home/alice/.cache/test-linux/", "handles every uid.");
+	if (test_getpwuid_r_calls != 3) {
+		printf("FAIL: %s:%d expected 3 calls to getpwuid_r(), got %d.\n", __FILE__,
+			__LINE__, test_getpwuid_r_calls);
+		return 1;
+	}
+
+#undef TEST_FUNC
+
+/*
+ * cfgpath_stats_get()
+ */
+
+#define TEST_RESULT "/home/test/.config/test-linux/"
+#define TEST_FUNC get_user_config_folder
+
+	struct cfgpath_stats stats;
+	struct cfgpath_kind_stats *ks = &stats.kind[CFGPATH_CONFIG_FOLDER];
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	cfgpath_stats_enable(1);
+	cfgpath_cache_enable(1);
+	RUN_TEST(TEST_RESULT, "works with statistics enabled.");
+	RUN_TEST(TEST_RESULT, "works with statistics enabled and a cached path.");
+	cfgpath_cache_enable(0);
+	cfgpath_stats_enable(0);
+	RUN_TEST(TEST_RESULT, "works with statistics disabled.");
+	cfgpath_stats_get(&stats);
+	if ((ks->calls != 2) || (ks->cache_hits != 1) || (ks->mkdir_calls != 1)
+		|| (ks->getenv_calls == 0) || (stats.kind[CFGPATH_CACHE_FOLDER].calls != 0)
+	) {
+		printf("FAIL: %s:%d wrong statistics: calls=%llu cache_hits=%llu "
+			"mkdir_calls=%llu getenv_calls=%llu\n", __FILE__, __LINE__, ks->calls,
+			ks->cache_hits, ks->mkdir_calls, ks->getenv_calls);
+		return 1;
+	}
+	printf("PASS: cfgpath_stats_get() counts calls, cache hits and mkdir().\n");
+	cfgpath_stats_reset();
+	cfgpath_stats_get(&stats);
+	if (ks->calls != 0) {
+		printf("FAIL: %s:%d cfgpath_stats_reset() did not reset.\n", __FILE__, __LINE__);
+		return 1;
+	}
+
+	struct cfgpath_fs_hooks hooks = { test_before, test_after, NULL };
+	cfgpath_set_fs_hooks(&hooks);
+	RUN_TEST(TEST_RESULT, "works with filesystem hooks.");
+	cfgpath_set_fs_hooks(NULL);
+	if ((test_hook_before != 1) || (test_hook_after != 1)
+		|| (test_hook_op != CFGPATH_FS_MKDIR)
+		|| strcmp(test_hook_path, "/home/test/.config/test-linux")
+	) {
+		printf("FAIL: %s:%d hooks not called correctly: before=%d after=%d path=%s\n",
+			__FILE__, __LINE__, test_hook_before, test_hook_after, test_hook_path);
+		return 1;
+	}
+	printf("PASS: cfgpath_set_fs_hooks() hooks are called around mkdir().\n");
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * cfgpath_get()
+ */
+
+#define TEST_RESULT "/home/test/.config/test-linux/"
+#define TEST_FUNC cfgpath_get
+
+	int len;
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	test_mkdir_calls = 0;
+	len = cfgpath_get(CFGPATH_CONFIG_FOLDER, NULL, 0, "test-linux");
+	if ((len != strlen(TEST_RESULT)) || (test_mkdir_calls != 0)) {
+		printf("FAIL: %s:%d size query returned %d with %d mkdir() calls.\n",
+			__FILE__, __LINE__, len, test_mkdir_calls);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() returns the length without creating folders.\n");
+
+	len = cfgpath_get(CFGPATH_CONFIG_FOLDER, buffer, len, "test-linux");
+	CHECK_RESULT("", "returns empty string when buffer is one byte too small.");
+	if (len != strlen(TEST_RESULT)) {
+		printf("FAIL: %s:%d expected length %d, got %d.\n", __FILE__, __LINE__,
+			(int)strlen(TEST_RESULT), len);
+		return 1;
+	}
+
+	len = cfgpath_get(CFGPATH_CONFIG_FOLDER, buffer, len + 1, "test-linux");
+	CHECK_RESULT(TEST_RESULT, "works with a buffer of exactly the right size.");
+	if ((len != strlen(TEST_RESULT)) || (test_mkdir_calls != 1)) {
+		printf("FAIL: %s:%d returned %d with %d mkdir() calls.\n", __FILE__,
+			__LINE__, len, test_mkdir_calls);
+		return 1;
+	}
+
+	test_env_home_valid = 0;
+	len = cfgpath_get(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux");
+	CHECK_RESULT("", "returns empty string when $HOME is absent.");
+	if (len != CFGPATH_ERR_NOHOME) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_NOHOME, got %d.\n", __FILE__,
+			__LINE__, len);
+		return 1;
+	}
+	if (cfgpath_get(CFGPATH_KIND_COUNT, buffer, sizeof(buffer), "test-linux")
+		!= CFGPATH_ERR_INVALID
+	) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_INVALID.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() returns distinct error codes.\n");
+
+	/* Paths longer than MAX_PATH work when the buffer is big enough */
+	char long_home[MAX_PATH + 100];
+	memset(long_home, 'x', sizeof(long_home) - 1);
+	long_home[0] = '/';
+	long_home[sizeof(long_home) - 1] = 0;
+	test_home = long_home;
+	test_env_home_valid = 1;
+	len = cfgpath_get(CFGPATH_CACHE_FOLDER, NULL, 0, "test-linux");
+	char *long_path = malloc(len + 1);
+	if ((len <= MAX_PATH)
+		|| (cfgpath_get(CFGPATH_CACHE_FOLDER, long_path, len + 1, "test-linux") != len)
+		|| (strlen(long_path) != (size_t)len)
+		|| strcmp(long_path + len - strlen("/.cache/test-linux/"), "/.cache/test-linux/")
+	) {
+		printf("FAIL: %s:%d paths longer than MAX_PATH don't work.\n", __FILE__,
+			__LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() works with paths longer than MAX_PATH.\n");
+	free(long_path);
+	test_home = "/home/test";
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * cfgpath_get_ex()
+ */
+
+#define TEST_RESULT "/home/test/.config/test-linux/"
+#define TEST_FUNC cfgpath_get_ex
+
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	test_mkdir_calls = 0;
+	TEST_FUNC(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux",
+		CFGPATH_CREATE_NONE);
+	CHECK_RESULT(TEST_RESULT, "works with CFGPATH_CREATE_NONE.");
+	TEST_FUNC(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux",
+		CFGPATH_CREATE_LAZY);
+	CHECK_RESULT(TEST_RESULT, "works with CFGPATH_CREATE_LAZY.");
+	if (test_mkdir_calls != 0) {
+		printf("FAIL: %s:%d expected no calls to mkdir(), got %d.\n", __FILE__,
+			__LINE__, test_mkdir_calls);
+		return 1;
+	}
+
+	if ((cfgpath_ensure_parent(buffer) != 0) || (test_mkdir_calls != 1)) {
+		printf("FAIL: %s:%d cfgpath_ensure_parent() made %d calls to mkdir().\n",
+			__FILE__, __LINE__, test_mkdir_calls);
+		return 1;
+	}
+	printf("PASS: cfgpath_ensure_parent() creates the folder.\n");
+
+	test_mkdir_calls = 0;
+	TEST_FUNC(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux",
+		CFGPATH_CREATE_DEFERRED);
+	CHECK_RESULT(TEST_RESULT, "works with CFGPATH_CREATE_DEFERRED.");
+	cfgpath_flush();
+	if (test_mkdir_calls != 1) {
+		printf("FAIL: %s:%d expected 1 deferred call to mkdir(), got %d.\n",
+			__FILE__, __LINE__, test_mkdir_calls);
+		return 1;
+	}
+	printf("PASS: cfgpath_flush() waits for deferred folder creation.\n");
+
+	/* Hold up the background thread so the requests pile up */
+	struct cfgpath_task block = { NULL, test_block_run };
+	test_block = 1;
+	cfgpath_worker_submit(&block);
+	test_mkdir_calls = 0;
+	int repeat;
+	for (repeat = 0; repeat < 10; repeat++) {
+		TEST_FUNC(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux",
+			CFGPATH_CREATE_DEFERRED);
+	}
+	__atomic_store_n(&test_block, 0, __ATOMIC_RELEASE);
+	cfgpath_flush();
+	if (test_mkdir_calls != 1) {
+		printf("FAIL: %s:%d expected 1 deferred call to mkdir(), got %d.\n",
+			__FILE__, __LINE__, test_mkdir_calls);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() only queues each folder once.\n");
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * cfgpath_get_prefixed()
+ */
+
+#define TEST_FUNC cfgpath_get_prefixed
+
+	TEST_FUNC(CFGPATH_CONFIG_FILE, buffer, sizeof(buffer), "test-linux.conf.x",
+		strlen("test-linux.conf"), CFGPATH_CREATE_NONE);
+	CHECK_RESULT("/home/test/.config/test-linux.conf", "works with a config file.");
+	TEST_FUNC(CFGPATH_DATA_FOLDER, buffer, sizeof(buffer), "test-linux/",
+		strlen("test-linux/"), CFGPATH_CREATE_NONE);
+	CHECK_RESULT("/home/test/.local/share/test-linux/", "works with a folder.");
+	if ((TEST_FUNC(CFGPATH_CONFIG_FILE, buffer, sizeof(buffer), "test-linux/",
+			strlen("test-linux/"), CFGPATH_CREATE_NONE) != CFGPATH_ERR_INVALID)
+		|| (TEST_FUNC(CFGPATH_DATA_FOLDER, buffer, sizeof(buffer), "/", 1,
+			CFGPATH_CREATE_NONE) != CFGPATH_ERR_INVALID)
+	) {
+		printf("FAIL: %s:%d accepted a suffix with the wrong ending.\n", __FILE__,
+			__LINE__);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() rejects a suffix with the wrong ending.\n");
+
+	/* Shares cache entries with the null terminated appname */
+	cfgpath_cache_enable(1);
+	test_mkdir_calls = 0;
+	cfgpath_get_ex(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux",
+		CFGPATH_CREATE_NOW);
+	TEST_FUNC(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-linux/",
+		strlen("test-linux/"), CFGPATH_CREATE_NOW);
+	cfgpath_cache_enable(0);
+	CHECK_RESULT("/home/test/.config/test-linux/", "works with a cached path.");
+	if (test_mkdir_calls != 1) {
+		printf("FAIL: %s:%d expected 1 call to mkdir(), got %d.\n", __FILE__,
+			__LINE__, test_mkdir_calls);
+		return 1;
+	}
+
+#undef TEST_FUNC
+
+/*
+ * cfgpath_get_async()
+ */
+
+#define TEST_FUNC cfgpath_get_async
+
+	int async_calls = 0;
+	if (!mkdtemp(strcpy(tmpdir, "/tmp/test-linux-XXXXXX"))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	test_xdg = tmpdir;
+	test_env_xdg_valid = 1;
+	test_mkdir_real = 1;
+	snprintf(expected, sizeof(expected), "%s/test-linux/", tmpdir);
+	if (TEST_FUNC(CFGPATH_CONFIG_FOLDER, "test-linux", test_async_done,
+		&async_calls) != 0
+	) {
+		printf("FAIL: %s:%d cfgpath_get_async() failed.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	cfgpath_flush();
+	strcpy(buffer, test_async_path);
+	CHECK_RESULT(expected, "passes the path to the callback.");
+	if ((async_calls != 1) || ((size_t)test_async_result != strlen(expected))
+		|| (stat(buffer, &st) != 0) || !S_ISDIR(st.st_mode)
+	) {
+		printf("FAIL: %s:%d callback called %d times with result %d.\n", __FILE__,
+			__LINE__, async_calls, test_async_result);
+		return 1;
+	}
+	printf("PASS: cfgpath_get_async() creates the folder.\n");
+
+	/* A file where the folder should be */
+	snprintf(expected, sizeof(expected), "%s/test-linux-file", tmpdir);
+	close(open(expected, O_CREAT | O_WRONLY, 0644));
+	TEST_FUNC(CFGPATH_CONFIG_FOLDER, "test-linux-file", test_async_done,
+		&async_calls);
+	cfgpath_flush();
+	if ((async_calls != 2) || (test_async_result != CFGPATH_ERR_CREATE)) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_CREATE, got %d.\n", __FILE__,
+			__LINE__, test_async_result);
+		return 1;
+	}
+	printf("PASS: cfgpath_get_async() reports a file in the way of the folder.\n");
+
+	test_mkdir_real = 0;
+	test_xdg = "/home/test/.config";
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 0;
+	if ((TEST_FUNC(CFGPATH_CONFIG_FOLDER, "test-linux", test_async_done,
+		&async_calls) != CFGPATH_ERR_NOHOME) || (async_calls != 2)
+	) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_NOHOME and no callback.\n",
+			__FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_get_async() returns errors without calling back.\n");
+	snprintf(expected, sizeof(expected), "rm -rf '%s'", tmpdir);
+	if (system(expected) != 0) return 1;
+
+#undef TEST_FUNC
+
+/*
+ * cfgpath_get_system_dirs()
+ */
+
+#define TEST_FUNC cfgpath_get_system_dirs
+
+	const struct cfgpath_dirs *dirs = TEST_FUNC(CFGPATH_SEARCH_CONFIG);
+	if (!dirs || (dirs->count != 1) || strcmp(dirs->dir[0], "/etc/xdg/")
+		|| (dirs->len[0] != 9)
+	) {
+		printf("FAIL: %s:%d wrong default for $XDG_CONFIG_DIRS.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	dirs = TEST_FUNC(CFGPATH_SEARCH_DATA);
+	if (!dirs || (dirs->count != 2) || strcmp(dirs->dir[0], "/usr/local/share/")
+		|| strcmp(dirs->dir[1], "/usr/share/")
+	) {
+		printf("FAIL: %s:%d wrong default for $XDG_DATA_DIRS.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() returns the defaults.\n");
+
+	test_config_dirs = "/etc/a:relative::/etc/b//:/";
+	const struct cfgpath_dirs *first = TEST_FUNC(CFGPATH_SEARCH_CONFIG);
+	if (!first || (first->count != 3) || strcmp(first->dir[0], "/etc/a/")
+		|| strcmp(first->dir[1], "/etc/b/") || (first->len[1] != 7)
+		|| strcmp(first->dir[2], "/")
+	) {
+		printf("FAIL: %s:%d $XDG_CONFIG_DIRS not split correctly.\n", __FILE__,
+			__LINE__);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() splits $XDG_CONFIG_DIRS.\n");
+	if (TEST_FUNC(CFGPATH_SEARCH_CONFIG) != first) {
+		printf("FAIL: %s:%d list was parsed again.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() only parses the list once.\n");
+
+	/* A long list, as set in some containers */
+	char long_dirs[4096] = "";
+	unsigned int n;
+	for (n = 0; n < 200; n++) {
+		snprintf(long_dirs + strlen(long_dirs), sizeof(long_dirs) - strlen(long_dirs),
+			"%s/opt/%u", n ? ":" : "", n);
+	}
+	test_config_dirs = long_dirs;
+	dirs = TEST_FUNC(CFGPATH_SEARCH_CONFIG);
+	if (!dirs || (dirs->count != 200) || strcmp(dirs->dir[199], "/opt/199/")
+		|| (first->count != 3)
+	) {
+		printf("FAIL: %s:%d long $XDG_CONFIG_DIRS not handled.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() reparses a changed list.\n");
+
+#undef TEST_FUNC
+
+/*
+ * cfgpath_find_file()
+ */
+
+#define TEST_FUNC cfgpath_find_file
+
+	if (!mkdtemp(strcpy(tmpdir, "/tmp/test-linux-XXXXXX"))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	char search_dirs[256];
+	snprintf(search_dirs, sizeof(search_dirs), "%s/sys1:%s/sys2", tmpdir, tmpdir);
+	test_config_dirs = search_dirs;
+	snprintf(deep_xdg, sizeof(deep_xdg), "%s/user", tmpdir);
+	test_xdg = deep_xdg;
+	test_env_xdg_valid = 1;
+	snprintf(expected, sizeof(expected), "mkdir -p '%s/user/app' '%s/sys1/app' "
+		"'%s/sys2/app' && touch '%s/sys2/app/app.conf'", tmpdir, tmpdir, tmpdir,
+		tmpdir);
+	if (system(expected) != 0) return 1;
+
+	snprintf(expected, sizeof(expected), "%s/sys2/app/app.conf", tmpdir);
+	len = TEST_FUNC(CFGPATH_SEARCH_CONFIG, "app/app.conf", buffer, sizeof(buffer));
+	CHECK_RESULT(expected, "finds a file in the last system folder.");
+	if ((size_t)len != strlen(expected)) {
+		printf("FAIL: %s:%d wrong length %d.\n", __FILE__, __LINE__, len);
+		return 1;
+	}
+
+	snprintf(expected, sizeof(expected), "%s/user/app/app.conf", tmpdir);
+	close(open(expected, O_CREAT | O_WRONLY, 0644));
+	TEST_FUNC(CFGPATH_SEARCH_CONFIG, "app/app.conf", buffer, sizeof(buffer));
+	CHECK_RESULT(expected, "prefers the user's own file.");
+
+	len = TEST_FUNC(CFGPATH_SEARCH_CONFIG, "app/missing.conf", buffer, sizeof(buffer));
+	CHECK_RESULT("", "returns empty string when no file is found.");
+	if (len != CFGPATH_ERR_NOTFOUND) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_NOTFOUND, got %d.\n", __FILE__,
+			__LINE__, len);
+		return 1;
+	}
+
+	len = TEST_FUNC(CFGPATH_SEARCH_CONFIG, "../user/app/app.conf", buffer, sizeof(buffer));
+	CHECK_RESULT("", "returns empty string for a path leaving the folder.");
+	if (len != CFGPATH_ERR_INVALID) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_INVALID, got %d.\n", __FILE__,
+			__LINE__, len);
+		return 1;
+	}
+
+	/* Without $XDG_CONFIG_HOME the user's folder is under $HOME */
+	test_env_xdg_valid = 0;
+	int home_valid = test_env_home_valid;
+	test_env_home_valid = 1;
+	test_home = tmpdir;
+	snprintf(expected, sizeof(expected), "mkdir -p '%s/.config/app' "
+		"&& touch '%s/.config/app/app.conf'", tmpdir, tmpdir);
+	if (system(expected) != 0) return 1;
+	snprintf(expected, sizeof(expected), "%s/.config/app/app.conf", tmpdir);
+	TEST_FUNC(CFGPATH_SEARCH_CONFIG, "app/app.conf", buffer, sizeof(buffer));
+	CHECK_RESULT(expected, "finds the user's file under $HOME.");
+	test_env_home_valid = home_valid;
+	test_home = "/home/test";
+
+	test_config_dirs = NULL;
+	test_env_xdg_valid = 0;
+	test_xdg = "/home/test/.config";
+	snprintf(expected, sizeof(expected), "rm -rf '%s'", tmpdir);
+	if (system(expected) != 0) return 1;
+
+#undef TEST_FUNC
+
+/*
+ * get_user_runtime_folder()
+ */
+
+#define TEST_FUNC get_user_runtime_folder
+
+	if (!mkdtemp(strcpy(tmpdir, "/tmp/test-linux-XXXXXX"))) {
+		perror("mkdtemp");
+		return 1;
+	}
+	test_runtime_dir = tmpdir;
+	test_mkdir_real = 1;
+	snprintf(expected, sizeof(expected), "%s/test-linux/", tmpdir);
+	test_hook_before = test_hook_after = 0;
+	cfgpath_set_fs_hooks(&hooks);
+	RUN_TEST(expected, "works with $XDG_RUNTIME_DIR.");
+	cfgpath_set_fs_hooks(NULL);
+	if ((stat(expected, &st) != 0) || ((st.st_mode & 0777) != 0700)) {
+		printf("FAIL: %s:%d folder not created with mode 0700.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	/* open, fstat, mkdirat, open and fstat again */
+	if ((test_hook_before != 5) || (test_hook_after != 5)
+		|| (test_hook_op != CFGPATH_FS_STAT) || strcmp(test_hook_path, "test-linux")
+	) {
+		printf("FAIL: %s:%d hooks not called correctly: before=%d after=%d path=%s\n",
+			__FILE__, __LINE__, test_hook_before, test_hook_after, test_hook_path);
+		return 1;
+	}
+	printf("PASS: " TOSTRING(TEST_FUNC) "() reports every operation to the hooks.\n");
+	chmod(expected, 0755);
+	RUN_TEST(expected, "works when the folder exists.");
+	if ((stat(expected, &st) != 0) || ((st.st_mode & 0777) != 0700)) {
+		printf("FAIL: %s:%d folder permissions not tightened.\n", __FILE__, __LINE__);
+		return 1;
+	}
+
+	char runtime_fallback[64];
+	snprintf(runtime_fallback, sizeof(runtime_fallback), "/tmp/cfgpath-runtime-%u",
+		(unsigned int)geteuid());
+	/* Only removed afterwards if the test created it */
+	int fallback_existed = (stat(runtime_fallback, &st) == 0);
+	snprintf(expected, sizeof(expected), "%s/test-linux/", runtime_fallback);
+	chmod(tmpdir, 0755);
+	RUN_TEST(expected, "ignores $XDG_RUNTIME_DIR if others can use it.");
+	chmod(tmpdir, 0700);
+	test_runtime_dir = "relative";
+	RUN_TEST(expected, "ignores a relative $XDG_RUNTIME_DIR.");
+	test_runtime_dir = NULL;
+	RUN_TEST(expected, "works without $XDG_RUNTIME_DIR.");
+	if ((stat(runtime_fallback, &st) != 0) || ((st.st_mode & 0777) != 0700)) {
+		printf("FAIL: %s:%d fallback folder not private.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	if (geteuid() == 0) {
+		/* Pretend another user got there first */
+		if (chown(runtime_fallback, 12345, 12345) != 0) return 1;
+		RUN_TEST("", "refuses a fallback folder owned by someone else.");
+		if (chown(runtime_fallback, 0, 0) != 0) return 1;
+	}
+	if (fallback_existed) {
+		snprintf(expected, sizeof(expected), "rm -rf '%s/test-linux'", runtime_fallback);
+	} else {
+		snprintf(expected, sizeof(expected), "rm -rf '%s'", runtime_fallback);
+	}
+	if (system(expected) != 0) return 1;
+
+	test_runtime_dir = tmpdir;
+	TEST_FUNC(buffer, 10, "test-linux");
+	CHECK_RESULT("", "returns empty string when the buffer is too small.");
+	test_runtime_dir = NULL;
+	test_mkdir_real = 0;
+	snprintf(expected, sizeof(expected), "rm -rf '%s'", tmpdir);
+	if (system(expected) != 0) return 1;
+
+#undef TEST_FUNC
+
+/*
+ * cfgpath_builder_*()
+ */
+
+#define TEST_FUNC cfgpath_builder_push
+
+	struct cfgpath_builder builder;
+	test_env_xdg_valid = 0;
+	test_env_home_valid = 1;
+	len = cfgpath_builder_init(&builder, buffer, sizeof(buffer),
+		CFGPATH_DATA_FOLDER, "test-linux");
+	CHECK_RESULT("/home/test/.local/share/test-linux/", "starts from the data folder.");
+	if ((len != (int)strlen(buffer)) || (builder.len != (unsigned int)len)) {
+		printf("FAIL: %s:%d wrong length %d.\n", __FILE__, __LINE__, len);
+		return 1;
+	}
+	cfgpath_builder_push(&builder, "levels");
+	CHECK_RESULT("/home/test/.local/share/test-linux/levels/", "adds a subfolder.");
+	len = cfgpath_builder_file(&builder, "1.dat");
+	CHECK_RESULT("/home/test/.local/share/test-linux/levels/1.dat", "adds a file.");
+	if (len != (int)strlen(buffer)) {
+		printf("FAIL: %s:%d wrong length %d.\n", __FILE__, __LINE__, len);
+		return 1;
+	}
+	cfgpath_builder_file(&builder, "22.dat");
+	CHECK_RESULT("/home/test/.local/share/test-linux/levels/22.dat", "replaces the file.");
+	cfgpath_builder_push(&builder, "extra");
+	CHECK_RESULT("/home/test/.local/share/test-linux/levels/extra/",
+		"replaces the file with a subfolder.");
+	cfgpath_builder_pop(&builder);
+	CHECK_RESULT("/home/test/.local/share/test-linux/levels/", "goes back a folder.");
+	cfgpath_builder_pop(&builder);
+	CHECK_RESULT("/home/test/.local/share/test-linux/", "goes back to the start.");
+	if (cfgpath_builder_pop(&builder) != CFGPATH_ERR_INVALID) {
+		printf("FAIL: %s:%d popped past the start.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	if ((cfgpath_builder_push(&builder, "..") != CFGPATH_ERR_INVALID)
+		|| (cfgpath_builder_push(&builder, ".") != CFGPATH_ERR_INVALID)
+		|| (cfgpath_builder_push(&builder, "") != CFGPATH_ERR_INVALID)
+		|| (cfgpath_builder_push(&builder, "a/b") != CFGPATH_ERR_INVALID)
+		|| (cfgpath_builder_file(&builder, "../passwd") != CFGPATH_ERR_INVALID)
+	) {
+		printf("FAIL: %s:%d accepted a name that leaves the folder.\n", __FILE__,
+			__LINE__);
+		return 1;
+	}
+	CHECK_RESULT("/home/test/.local/share/test-linux/",
+		"rejects names that leave the folder.");
+	cfgpath_builder_file(&builder, "..hidden");
+	CHECK_RESULT("/home/test/.local/share/test-linux/..hidden",
+		"allows names starting with dots.");
+
+	if (cfgpath_builder_init(&builder, buffer, sizeof(buffer), CFGPATH_CONFIG_FILE,
+		"test-linux") != CFGPATH_ERR_INVALID
+	) {
+		printf("FAIL: %s:%d started from a file.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_builder_init() refuses CFGPATH_CONFIG_FILE.\n");
+
+	char small[16];
+	len = cfgpath_builder_init_folder(&builder, small, sizeof(small), "/short");
+	strcpy(buffer, small);
+	CHECK_RESULT("/short/", "adds a missing separator.");
+	len = cfgpath_builder_push(&builder, "toolonger");
+	strcpy(buffer, small);
+	CHECK_RESULT("/short/", "is unchanged when a subfolder does not fit.");
+	if (len != 17) {
+		printf("FAIL: %s:%d expected length 17, got %d.\n", __FILE__, __LINE__, len);
+		return 1;
+	}
+	cfgpath_builder_push(&builder, "sixsix");
+	cfgpath_builder_file(&builder, "12");
+	strcpy(buffer, small);
+	CHECK_RESULT("/short/sixsix/", "leaves the folder when a file does not fit.");
+	cfgpath_builder_file(&builder, "1");
+	strcpy(buffer, small);
+	CHECK_RESULT("/short/sixsix/1", "fills the buffer exactly.");
+
+	unsigned int i;
+	cfgpath_builder_init_folder(&builder, buffer, sizeof(buffer), "/");
+	for (i = 0; i < CFGPATH_BUILDER_DEPTH; i++) {
+		if (cfgpath_builder_push(&builder, "d") <= 0) return 1;
+	}
+	if (cfgpath_builder_push(&builder, "d") != CFGPATH_ERR_INVALID) {
+		printf("FAIL: %s:%d pushed too deep.\n", __FILE__, __LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_builder_push() stops at CFGPATH_BUILDER_DEPTH.\n");
+
+#undef TEST_FUNC
+
 	printf("All tests passed for platform: Linux.\n");
 	return 0;
 }
@@ -0,0 +1,188 @@
+/**
+ * @file  test-lru.c
+ * @brief cfgpath-lru.h test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cfgpath-lru.h"
+#include "test.h"
+
+char tmpdir[] = "/tmp/test-lru-XXXXXX";
+
+/* Create a file of the given size in the cache folder. */
+void make_file(const char *name, int size)
+{
+	char path[256];
+	char data[1024];
+	snprintf(path, sizeof(path), "%s/%s", tmpdir, name);
+	memset(data, 'x', sizeof(data));
+	FILE *f = fopen(path, "w");
+	fwrite(data, 1, size, f);
+	fclose(f);
+}
+
+int exists(const char *name)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", tmpdir, name);
+	return access(path, F_OK) == 0;
+}
+
+long index_size(void)
+{
+	char path[256];
+	struct stat st;
+	snprintf(path, sizeof(path), "%s/" CFGPATH_LRU_INDEX, tmpdir);
+	if (stat(path, &st) != 0) return -1;
+	return st.st_size;
+}
+
+int main(void)
+{
+	struct cfgpath_lru c, other;
+	uint64_t bytes, entries;
+	char name[32];
+	int i;
+
+	CHECK(mkdtemp(tmpdir) != NULL, "mkdtemp() creates the test folder.");
+
+	CHECK(cfgpath_lru_open(&c, tmpdir, 1000, 5) == 0,
+		"cfgpath_lru_open() opens an empty folder.");
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 0) && (entries == 0),
+		"cfgpath_lru_usage() reports nothing in an empty folder.");
+	CHECK(index_size() == sizeof(CFGPATH_LRU_MAGIC) - 1,
+		"cfgpath_lru_open() creates the index file.");
+	CHECK((cfgpath_lru_open(&other, tmpdir, 1000, 5) != 0) && (errno == EWOULDBLOCK),
+		"cfgpath_lru_open() fails with EWOULDBLOCK for a folder already in use.");
+
+	for (i = 0; i < 5; i++) {
+		snprintf(name, sizeof(name), "f%d", i);
+		make_file(name, 100);
+		CHECK(cfgpath_lru_insert(&c, name, 100) == 0,
+			"cfgpath_lru_insert() records a new file.");
+	}
+	cfgpath_flush();
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 500) && (entries == 5),
+		"cfgpath_lru_usage() counts the files inserted.");
+	CHECK(exists("f0"), "cfgpath_lru_insert() removes nothing at the limit.");
+
+	CHECK(cfgpath_lru_touch(&c, "f0") == 0,
+		"cfgpath_lru_touch() succeeds for a known file.");
+	CHECK(cfgpath_lru_touch(&c, "missing") != 0,
+		"cfgpath_lru_touch() fails for an unknown file.");
+	make_file("f5", 100);
+	CHECK(cfgpath_lru_insert(&c, "f5", 100) == 0,
+		"cfgpath_lru_insert() succeeds past the file limit.");
+	cfgpath_flush();
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	/* Back under 90% of the limit of 5 */
+	CHECK(entries == 4,
+		"cfgpath_lru_insert() evicts down to 90 percent of the file limit.");
+	CHECK(!exists("f1") && !exists("f2"),
+		"cfgpath_lru_insert() removes the least recently used files.");
+	CHECK(exists("f0") && exists("f3") && exists("f4") && exists("f5"),
+		"cfgpath_lru_insert() keeps the recently used files.");
+
+	make_file("big", 700);
+	CHECK(cfgpath_lru_insert(&c, "big", 700) == 0,
+		"cfgpath_lru_insert() succeeds past the size limit.");
+	cfgpath_flush();
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK(bytes <= 900,
+		"cfgpath_lru_insert() evicts down to 90 percent of the size limit.");
+	CHECK(exists("big") && exists("f0") && !exists("f3") && !exists("f4"),
+		"cfgpath_lru_insert() removes the oldest files to free space.");
+
+	CHECK(cfgpath_lru_remove(&c, "big") == 0,
+		"cfgpath_lru_remove() succeeds for a known file.");
+	CHECK(!exists("big"), "cfgpath_lru_remove() deletes the file.");
+	CHECK(cfgpath_lru_remove(&c, "big") != 0,
+		"cfgpath_lru_remove() fails for an unknown file.");
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 200) && (entries == 2),
+		"cfgpath_lru_usage() no longer counts a removed file.");
+	cfgpath_lru_close(&c);
+
+	/* Not recorded, so should not be seen when loading the index */
+	make_file("unknown", 50);
+	CHECK(cfgpath_lru_open(&c, tmpdir, 1000, 5) == 0,
+		"cfgpath_lru_open() reopens a folder after cfgpath_lru_close().");
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 200) && (entries == 2),
+		"cfgpath_lru_open() loads the files from the index.");
+	CHECK(cfgpath_lru_touch(&c, "f0") == 0,
+		"cfgpath_lru_touch() works for a file loaded from the index.");
+	cfgpath_lru_close(&c);
+
+	/* An incomplete record from a crash is ignored */
+	long size = index_size();
+	char path[256];
+	snprintf(path, sizeof(path), "%s/" CFGPATH_LRU_INDEX, tmpdir);
+	FILE *f = fopen(path, "a");
+	fwrite("\x01\x00\x00", 1, 3, f);
+	fclose(f);
+	CHECK(index_size() == size + 3,
+		"fwrite() appends an incomplete record to the index.");
+	CHECK(cfgpath_lru_open(&c, tmpdir, 1000, 5) == 0,
+		"cfgpath_lru_open() succeeds with an incomplete record.");
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 200) && (entries == 2),
+		"cfgpath_lru_open() ignores an incomplete record.");
+	cfgpath_lru_close(&c);
+
+	/* Without an index, the folder is scanned */
+	CHECK(unlink(path) == 0, "unlink() removes the index file.");
+	snprintf(path, sizeof(path), "%s/sub", tmpdir);
+	CHECK(mkdir(path, 0700) == 0, "mkdir() creates a subfolder.");
+	make_file("sub/nested", 30);
+	CHECK(cfgpath_lru_open(&c, tmpdir, 1000, 5) == 0,
+		"cfgpath_lru_open() succeeds without an index.");
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 280) && (entries == 4),
+		"cfgpath_lru_open() scans the folder and subfolders without an index.");
+	CHECK(cfgpath_lru_remove(&c, "sub/nested") == 0,
+		"cfgpath_lru_remove() succeeds for a file in a subfolder.");
+	CHECK(!exists("sub/nested"),
+		"cfgpath_lru_remove() deletes a file in a subfolder.");
+
+	/* Replacing the same file over and over must not grow the index forever */
+	for (i = 0; i < 5000; i++) {
+		if (cfgpath_lru_insert(&c, "f0", 100) != 0) break;
+	}
+	CHECK(i == 5000, "cfgpath_lru_insert() can replace the same file many times.");
+	cfgpath_lru_close(&c);
+	CHECK(index_size() < 2000 * (long)sizeof(struct cfgpath_lru_record),
+		"cfgpath_lru_close() shrinks an index with many old records.");
+	CHECK(cfgpath_lru_open(&c, tmpdir, 1000, 5) == 0,
+		"cfgpath_lru_open() opens a shrunk index.");
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK((bytes == 250) && (entries == 3),
+		"cfgpath_lru_open() loads the files from a shrunk index.");
+	cfgpath_lru_close(&c);
+
+	/* Opening with smaller limits evicts straight away */
+	CHECK(cfgpath_lru_open(&c, tmpdir, 1000, 1) == 0,
+		"cfgpath_lru_open() succeeds with a lower limit.");
+	cfgpath_flush();
+	cfgpath_lru_usage(&c, &bytes, &entries);
+	CHECK(entries == 0, "cfgpath_lru_open() evicts down to a lower limit.");
+	CHECK(!exists("f0") && !exists("f5") && !exists("unknown"),
+		"cfgpath_lru_open() deletes the files it evicts.");
+	cfgpath_lru_close(&c);
+
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "rm -rf %s", tmpdir);
+	if (system(cmd) != 0) printf("Could not clean up %s\n", tmpdir);
+
+	printf("All tests passed for cfgpath-lru.h.\n");
+	return 0;
+}
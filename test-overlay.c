@@ -0,0 +1,145 @@
+/**
+ * @file  test-overlay.c
+ * @brief cfgpath-overlay.h test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cfgpath-overlay.h"
+#include "test.h"
+
+#define CHECK_VALUE(snap, section, key, result, msg) { \
+	char value[64]; \
+	cfgpath_conf_get(&(snap)->conf, section, key, value, sizeof(value)); \
+	if (strcmp(value, result) != 0) { \
+		printf("FAIL: %s:%d " msg "\n" \
+			"Expected: %s\nGot: %s\n", __FILE__, __LINE__, result, value); \
+		return 1; \
+	} else { \
+		printf("PASS: " msg "\n"); \
+	} \
+}
+
+char tmpdir[] = "/tmp/test-overlay-XXXXXX";
+
+int write_file(const char *relpath, const char *content)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", tmpdir, relpath);
+	FILE *f = fopen(path, "w");
+	if (!f) return -1;
+	fputs(content, f);
+	return fclose(f);
+}
+
+int make_dir(const char *relpath)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", tmpdir, relpath);
+	return mkdir(path, 0755);
+}
+
+struct cfgpath_overlay ov;
+int reload_done;
+
+void *reload_thread(void *arg)
+{
+	(void)arg;
+	cfgpath_overlay_reload(&ov);
+	__atomic_store_n(&reload_done, 1, __ATOMIC_SEQ_CST);
+	return NULL;
+}
+
+int main(void)
+{
+	char env[256];
+
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	make_dir("sys1");
+	make_dir("sys2");
+	make_dir("user");
+	make_dir("sys1/test-overlay.conf.d");
+	make_dir("user/test-overlay.conf.d");
+	snprintf(env, sizeof(env), "%s/sys1:%s/sys2", tmpdir, tmpdir);
+	setenv("XDG_CONFIG_DIRS", env, 1);
+	snprintf(env, sizeof(env), "%s/user", tmpdir);
+	setenv("XDG_CONFIG_HOME", env, 1);
+
+	write_file("sys2/test-overlay.conf",
+		"a = sys2\nb = sys2\nc = sys2\nd = sys2\ne = sys2\n[s]\nk = sys2\n");
+	write_file("sys1/test-overlay.conf", "b = sys1\n[s]\nk = sys1\n");
+	write_file("sys1/test-overlay.conf.d/10-x.conf", "c = sys1.d\n");
+	write_file("user/test-overlay.conf", "[s]\nk = user\n");
+	write_file("user/test-overlay.conf.d/20-y.conf", "e = 20-y\n");
+	write_file("user/test-overlay.conf.d/10-z.conf", "d = 10-z\ne = 10-z\n");
+	write_file("user/test-overlay.conf.d/ignored.txt", "a = ignored\n");
+
+	CHECK(cfgpath_overlay_init(&ov, "test-overlay") == 0,
+		"cfgpath_overlay_init() succeeds.");
+
+	unsigned int token = cfgpath_overlay_enter(&ov);
+	const struct cfgpath_snapshot *snap = cfgpath_overlay_current(&ov);
+	CHECK((snap->generation == 1) && (snap->files == 6),
+		"cfgpath_overlay_init() reads every file.");
+	CHECK_VALUE(snap, NULL, "a", "sys2", "the least important folder is used alone.");
+	CHECK_VALUE(snap, NULL, "b", "sys1", "more important folders override it.");
+	CHECK_VALUE(snap, NULL, "c", "sys1.d", "conf.d fragments override their file.");
+	CHECK_VALUE(snap, NULL, "d", "10-z", "the user's conf.d is used.");
+	CHECK_VALUE(snap, NULL, "e", "20-y", "conf.d fragments are read in order.");
+	CHECK_VALUE(snap, "s", "k", "user", "the user's file overrides system files.");
+
+	/* The reload can't finish until this reader has left */
+	write_file("user/test-overlay.conf", "[s]\nk = reloaded\n");
+	pthread_t thread;
+	pthread_create(&thread, NULL, reload_thread, NULL);
+	while (cfgpath_overlay_current(&ov) == snap) sched_yield();
+	usleep(50000);
+	CHECK(!__atomic_load_n(&reload_done, __ATOMIC_SEQ_CST),
+		"cfgpath_overlay_reload() waits for readers of the old snapshot.");
+	CHECK_VALUE(snap, "s", "k", "user", "the old snapshot is unchanged during a reload.");
+	cfgpath_overlay_leave(&ov, token);
+	pthread_join(thread, NULL);
+	CHECK(reload_done, "cfgpath_overlay_reload() finishes once readers leave.");
+
+	token = cfgpath_overlay_enter(&ov);
+	snap = cfgpath_overlay_current(&ov);
+	CHECK(snap->generation == 2, "cfgpath_overlay_reload() increments the generation.");
+	CHECK_VALUE(snap, "s", "k", "reloaded", "cfgpath_overlay_reload() reads the new file.");
+	cfgpath_overlay_leave(&ov, token);
+
+	write_file("user/test-overlay.conf", "[s]\nk = async\n");
+	cfgpath_overlay_reload_async(&ov);
+	cfgpath_overlay_reload_async(&ov);
+	cfgpath_flush();
+	token = cfgpath_overlay_enter(&ov);
+	snap = cfgpath_overlay_current(&ov);
+	/* The second call is merged into the first unless it has already started */
+	CHECK((snap->generation == 3) || (snap->generation == 4),
+		"cfgpath_overlay_reload_async() replaces the snapshot.");
+	CHECK_VALUE(snap, "s", "k", "async", "cfgpath_overlay_reload_async() reads the new file.");
+	cfgpath_overlay_leave(&ov, token);
+	cfgpath_overlay_free(&ov);
+
+	snprintf(env, sizeof(env), "%s/none", tmpdir);
+	setenv("XDG_CONFIG_DIRS", env, 1);
+	setenv("XDG_CONFIG_HOME", env, 1);
+	CHECK((cfgpath_overlay_init(&ov, "test-overlay") == 0)
+		&& (ov.current->files == 0) && (ov.current->conf.count == 0),
+		"cfgpath_overlay_init() works without any files.");
+	cfgpath_overlay_free(&ov);
+
+	snprintf(env, sizeof(env), "rm -rf '%s'", tmpdir);
+	if (system(env) != 0) return 1;
+
+	printf("All tests passed for cfgpath-overlay.h.\n");
+	return 0;
+}
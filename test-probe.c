@@ -0,0 +1,127 @@
+/**
+ * @file  test-probe.c
+ * @brief cfgpath-probe.h test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ *
+ * Build with -DCFGPATH_NO_IO_URING to test the thread pool instead.
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cfgpath-probe.h"
+#include "test.h"
+
+#ifdef CFGPATH_NO_IO_URING
+#define TEST_BACKEND "thread pool"
+#else
+/* Falls back to the thread pool if the kernel doesn't allow io_uring */
+#define TEST_BACKEND ((cfgpath_uring.state == 1) ? "io_uring" : "thread pool")
+#endif
+
+#define TEST_CANDIDATES 40
+
+int test_hook_before, test_hook_after; /* Number of times each hook was called */
+
+void test_before(enum cfgpath_fs_op op, const char *path, void *ctx)
+{
+	(void)op;
+	(void)path;
+	(void)ctx;
+	__atomic_fetch_add(&test_hook_before, 1, __ATOMIC_RELAXED);
+}
+
+void test_after(enum cfgpath_fs_op op, const char *path, int result, int err,
+	unsigned long long elapsed_ns, void *ctx)
+{
+	(void)op;
+	(void)path;
+	(void)result;
+	(void)err;
+	(void)elapsed_ns;
+	(void)ctx;
+	__atomic_fetch_add(&test_hook_after, 1, __ATOMIC_RELAXED);
+}
+
+const char *test_paths[TEST_CANDIDATES];
+int test_thread_failed;
+
+/* Probe over and over, while other threads do the same */
+void *probe_thread(void *arg)
+{
+	(void)arg;
+	int exists[TEST_CANDIDATES];
+	int n;
+	for (n = 0; n < 200; n++) {
+		if ((cfgpath_probe(test_paths, TEST_CANDIDATES, exists) != 3)
+			|| !exists[1] || !exists[2] || !exists[37]
+		) {
+			__atomic_store_n(&test_thread_failed, 1, __ATOMIC_RELAXED);
+		}
+	}
+	return NULL;
+}
+
+/* Create an empty file */
+int touch(const char *path)
+{
+	int fd = open(path, O_CREAT | O_WRONLY, 0644);
+	if (fd < 0) return -1;
+	return close(fd);
+}
+
+int main(void)
+{
+	char tmpdir[] = "/tmp/test-probe-XXXXXX";
+	char names[TEST_CANDIDATES][64];
+	const char *paths[TEST_CANDIDATES];
+	int exists[TEST_CANDIDATES];
+	unsigned int i;
+
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+	for (i = 0; i < TEST_CANDIDATES; i++) {
+		snprintf(names[i], sizeof(names[i]), "%s/candidate-%u", tmpdir, i);
+		paths[i] = names[i];
+		test_paths[i] = names[i];
+	}
+	touch(names[1]);
+	touch(names[2]);
+	touch(names[37]);
+
+	CHECK(cfgpath_probe_first(paths, 3) == 1,
+		"cfgpath_probe_first() returns the first existing candidate.");
+	CHECK(cfgpath_probe_first(paths, 1) == -1,
+		"cfgpath_probe_first() returns -1 if no candidates exist.");
+	CHECK(cfgpath_probe_first(paths + 3, TEST_CANDIDATES - 3) == 34,
+		"cfgpath_probe_first() works with more than one batch of candidates.");
+
+	struct cfgpath_fs_hooks hooks = { test_before, test_after, NULL };
+	cfgpath_set_fs_hooks(&hooks);
+	unsigned int found = cfgpath_probe(paths, TEST_CANDIDATES, exists);
+	cfgpath_set_fs_hooks(NULL);
+	CHECK((found == 3) && !exists[0] && exists[1] && exists[2] && !exists[3]
+		&& exists[37] && !exists[TEST_CANDIDATES - 1],
+		"cfgpath_probe() reports every candidate.");
+	CHECK((test_hook_before == TEST_CANDIDATES) && (test_hook_after == TEST_CANDIDATES),
+		"cfgpath_probe() calls the filesystem hooks for each candidate.");
+
+	pthread_t threads[4];
+	for (i = 0; i < 4; i++) pthread_create(&threads[i], NULL, probe_thread, NULL);
+	for (i = 0; i < 4; i++) pthread_join(threads[i], NULL);
+	CHECK(!test_thread_failed,
+		"cfgpath_probe() gives the right answer in several threads at once.");
+
+	char cmd[64 + sizeof(tmpdir)];
+	snprintf(cmd, sizeof(cmd), "rm -rf '%s'", tmpdir);
+	if (system(cmd) != 0) return 1;
+
+	printf("All tests passed for cfgpath-probe.h using %s.\n", TEST_BACKEND);
+	return 0;
+}
@@ -0,0 +1,145 @@
+/**
+ * @file  test-watch.c
+ * @brief cfgpath-watch.h test code for the Linux platform.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#include <string.h>
+#include <stdio.h>
+
+#include "cfgpath-watch.h"
+#include "test.h"
+
+#define DEBOUNCE_MS 100
+
+char tmpdir[] = "/tmp/test-watch-XXXXXX";
+int changes;
+int wait_ms;  /* Longest a change can take to be reported */
+
+void test_changed(void *ctx)
+{
+	__atomic_add_fetch((int *)ctx, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Wait long enough for any change to have been reported, and return how many
+ * were. */
+int wait_changes(void)
+{
+	usleep(wait_ms * 1000);
+	return __atomic_exchange_n(&changes, 0, __ATOMIC_SEQ_CST);
+}
+
+int write_file(const char *name, const char *content)
+{
+	char path[256];
+	snprintf(path, sizeof(path), "%s/%s", tmpdir, name);
+	FILE *f = fopen(path, "w");
+	if (!f) return -1;
+	fputs(content, f);
+	return fclose(f);
+}
+
+int rename_file(const char *from, const char *to)
+{
+	char from_path[256], to_path[256];
+	snprintf(from_path, sizeof(from_path), "%s/%s", tmpdir, from);
+	snprintf(to_path, sizeof(to_path), "%s/%s", tmpdir, to);
+	return rename(from_path, to_path);
+}
+
+int main(void)
+{
+	struct cfgpath_watch watch;
+	int i;
+
+	if (!mkdtemp(tmpdir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	CHECK(cfgpath_watch_start(&watch, tmpdir, NULL, DEBOUNCE_MS, test_changed,
+		&changes) == 0, "cfgpath_watch_start() succeeds.");
+	const char *backend = cfgpath_watch_is_inotify(&watch) ? "inotify" : "polling";
+	wait_ms = cfgpath_watch_is_inotify(&watch)
+		? DEBOUNCE_MS * 4 : (DEBOUNCE_MS + CFGPATH_WATCH_POLL_MS) * 3;
+	CHECK(wait_changes() == 0, "cfgpath_watch_start() reports nothing until a change.");
+
+	write_file("test.conf", "a = 1\n");
+	CHECK(wait_changes() == 1, "writing a file is reported once.");
+
+	for (i = 0; i < 10; i++) {
+		write_file("test.conf", "a = 2\n");
+		usleep(DEBOUNCE_MS * 1000 / 4);
+	}
+	CHECK(wait_changes() == 1, "a burst of writes is reported once.");
+
+	/* How vim saves a file */
+	write_file(".test.conf.swp", "");
+	rename_file("test.conf", "test.conf~");
+	write_file("test.conf", "a = 3\n");
+	CHECK(wait_changes() == 1, "saving with a backup file is reported once.");
+
+	/* How most other editors save a file */
+	write_file("test.conf.tmp", "a = 4\n");
+	rename_file("test.conf.tmp", "test.conf");
+	CHECK(wait_changes() == 1, "renaming over a file is reported once.");
+
+	write_file(".hidden", "");
+	write_file("test.conf~", "");
+	CHECK(wait_changes() == 0, "hidden and backup files are ignored.");
+
+	cfgpath_watch_stop(&watch);
+	write_file("test.conf", "a = 5\n");
+	CHECK(wait_changes() == 0, "cfgpath_watch_stop() stops reporting changes.");
+
+	CHECK(cfgpath_watch_start(&watch, tmpdir, "test.conf", DEBOUNCE_MS,
+		test_changed, &changes) == 0, "cfgpath_watch_start() succeeds with a name.");
+	write_file("other.conf", "");
+	CHECK(wait_changes() == 0, "other files are ignored when a name is given.");
+	write_file("test.conf.tmp", "a = 6\n");
+	rename_file("test.conf.tmp", "test.conf");
+	CHECK(wait_changes() == 1, "the named file is still reported.");
+	cfgpath_watch_stop(&watch);
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/test.conf", tmpdir);
+	CHECK((cfgpath_watch_start(&watch, path, NULL, DEBOUNCE_MS, test_changed,
+		&changes) == -1) && (errno == ENOTDIR),
+		"cfgpath_watch_start() fails with ENOTDIR for a file.");
+
+	setenv("XDG_CONFIG_HOME", tmpdir, 1);
+	CHECK(cfgpath_watch_config(&watch, "test-watch", DEBOUNCE_MS, test_changed,
+		&changes) == 0, "cfgpath_watch_config() succeeds.");
+	write_file("test-watch/settings.conf", "");
+	CHECK(wait_changes() == 1, "cfgpath_watch_config() watches the config folder.");
+	cfgpath_watch_stop(&watch);
+
+	/* The files read by cfgpath-overlay.h */
+	CHECK(cfgpath_watch_config_file(&watch, "test-watch", DEBOUNCE_MS, test_changed,
+		&changes) == 0, "cfgpath_watch_config_file() succeeds.");
+	CHECK(cfgpath_get(CFGPATH_CONFIG_FILE, path, sizeof(path), "test-watch") > 0,
+		"cfgpath_get() finds the config file.");
+	FILE *f = fopen(path, "w");
+	CHECK(f && (fputs("a = 1\n", f) >= 0) && (fclose(f) == 0),
+		"the config file can be written.");
+	CHECK(wait_changes() == 1, "cfgpath_watch_config_file() watches the config file.");
+	write_file("test.conf", "a = 7\n");
+	write_file("test-watch/settings.conf", "a = 7\n");
+	CHECK(wait_changes() == 0, "cfgpath_watch_config_file() ignores other files.");
+	strcat(path, ".d");
+	CHECK(mkdir(path, 0700) == 0, "the fragment folder can be created.");
+	CHECK(wait_changes() == 1, "creating the fragment folder is reported.");
+	write_file("test-watch.conf.d/10-local.conf", "a = 8\n");
+	CHECK(wait_changes() == 1, "cfgpath_watch_config_file() watches the fragments.");
+	cfgpath_watch_stop(&watch);
+
+	snprintf(path, sizeof(path), "rm -rf '%s'", tmpdir);
+	if (system(path) != 0) return 1;
+
+	printf("All tests passed for cfgpath-watch.h using %s.\n", backend);
+	return 0;
+}
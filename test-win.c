@@ -11,47 +11,62 @@
 #include <string.h>
 #include <stdio.h>
 
-#define SHGetFolderPath test_SHGetFolderPath
+#define SHGetKnownFolderPath test_SHGetKnownFolderPath
 #define mkdir test_mkdir
 #undef __linux__
 #ifndef WIN32
 #define WIN32
 #endif
+int test_mkdir(const char *path);
+
 #include "cfgpath.h"
 
 const char *set_appdata;
 const char *set_appdata_local;
 int set_retval;
+int known_folder_calls;
 
-/* Fake implementation of SHGetFolderPath() that fails when and how we want */
-int test_SHGetFolderPath(void *hwndOwner, int nFolder, void *hToken,
-	int dwFlags, char *pszPath)
+/* Fake implementation of SHGetKnownFolderPath() that fails when and how we
+ * want, and counts how often it is called */
+HRESULT test_SHGetKnownFolderPath(REFKNOWNFOLDERID rfid, DWORD dwFlags,
+	HANDLE hToken, PWSTR *ppszPath)
 {
-	/* Hopefully trigger an error if the buffer is too small */
-	pszPath[MAX_PATH - 1] = 0;
-
-	switch (nFolder) {
-		case CSIDL_APPDATA:
-			if (set_appdata) {
-				strcpy(pszPath, set_appdata);
-				return set_retval;
-			}
-			break;
-		case CSIDL_LOCAL_APPDATA:
-			if (set_appdata_local) {
-				strcpy(pszPath, set_appdata_local);
-				return set_retval;
-			}
-			break;
-	}
-	return E_FAIL;
+	(void)dwFlags;
+	(void)hToken;
+	const char *path = NULL;
+	known_folder_calls++;
+	*ppszPath = NULL;
+	if (rfid == &FOLDERID_RoamingAppData) path = set_appdata;
+	if (rfid == &FOLDERID_LocalAppData) path = set_appdata_local;
+	if (!path) return E_FAIL;
+
+	size_t i, len = strlen(path);
+	*ppszPath = (PWSTR)malloc((len + 1) * sizeof(wchar_t));
+	for (i = 0; i <= len; i++) (*ppszPath)[i] = (unsigned char)path[i];
+	return set_retval;
 }
 
+int test_mkdir_calls;
+char test_mkdir_wide[1024];  /* Last path passed to CreateDirectoryW(), as ASCII */
+
 int test_mkdir(const char *path)
 {
+	(void)path;
+	test_mkdir_calls++;
 	return 0;
 }
 
+BOOL CreateDirectoryW(LPCWSTR lpPathName, void *lpSecurityAttributes)
+{
+	(void)lpSecurityAttributes;
+	size_t i;
+	for (i = 0; lpPathName[i] && (i < sizeof(test_mkdir_wide) - 1); i++) {
+		test_mkdir_wide[i] = (char)lpPathName[i];
+	}
+	test_mkdir_wide[i] = 0;
+	return TRUE;
+}
+
 #define TOSTRING_X(x) #x
 #define TOSTRING(x) TOSTRING_X(x)
 #define RUN_TEST(result, msg)	  \
@@ -68,7 +83,7 @@ int test_mkdir(const char *path)
 		printf("PASS: " TOSTRING(TEST_FUNC) "() " msg "\n"); \
 	}
 
-int main(int argc, char *argv[])
+int main(void)
 {
 	char buffer[256];
 
@@ -85,13 +100,15 @@ int main(int argc, char *argv[])
 	TEST_FUNC(buffer, 5, "test-win");
 	CHECK_RESULT("", "returns empty string when buffer is too small.");
 
-	RUN_TEST(TEST_RESULT, "works with CSIDL_APPDATA.");
+	RUN_TEST(TEST_RESULT, "works with FOLDERID_RoamingAppData.");
 
 	set_retval = S_FALSE;
+	cfgpath_cache_invalidate();
 	RUN_TEST(TEST_RESULT, "works if folder doesn't exist (S_FALSE).");
 
 	set_appdata = NULL;
-	RUN_TEST("", "fails with missing CSIDL_APPDATA.");
+	cfgpath_cache_invalidate();
+	RUN_TEST("", "fails with missing FOLDERID_RoamingAppData.");
 
 #undef TEST_FUNC
 #undef TEST_RESULT
@@ -109,13 +126,15 @@ int main(int argc, char *argv[])
 	TEST_FUNC(buffer, 5, "test-win");
 	CHECK_RESULT("", "returns empty string when buffer is too small.");
 
-	RUN_TEST(TEST_RESULT, "works with CSIDL_APPDATA.");
+	RUN_TEST(TEST_RESULT, "works with FOLDERID_RoamingAppData.");
 
 	set_retval = S_FALSE;
+	cfgpath_cache_invalidate();
 	RUN_TEST(TEST_RESULT, "works if folder doesn't exist (S_FALSE).");
 
 	set_appdata = NULL;
-	RUN_TEST("", "fails with missing CSIDL_APPDATA.");
+	cfgpath_cache_invalidate();
+	RUN_TEST("", "fails with missing FOLDERID_RoamingAppData.");
 
 #undef TEST_FUNC
 #undef TEST_RESULT
@@ -133,13 +152,15 @@ int main(int argc, char *argv[])
 	TEST_FUNC(buffer, 5, "test-win");
 	CHECK_RESULT("", "returns empty string when buffer is too small.");
 
-	RUN_TEST(TEST_RESULT, "works with CSIDL_APPDATA.");
+	RUN_TEST(TEST_RESULT, "works with FOLDERID_RoamingAppData.");
 
 	set_retval = S_FALSE;
+	cfgpath_cache_invalidate();
 	RUN_TEST(TEST_RESULT, "works if folder doesn't exist (S_FALSE).");
 
 	set_appdata = NULL;
-	RUN_TEST("", "fails with missing CSIDL_APPDATA.");
+	cfgpath_cache_invalidate();
+	RUN_TEST("", "fails with missing FOLDERID_RoamingAppData.");
 
 #undef TEST_FUNC
 #undef TEST_RESULT
@@ -157,17 +178,210 @@ int main(int argc, char *argv[])
 	TEST_FUNC(buffer, 5, "test-win");
 	CHECK_RESULT("", "returns empty string when buffer is too small.");
 
-	RUN_TEST(TEST_RESULT, "works with CSIDL_LOCAL_APPDATA.");
+	RUN_TEST(TEST_RESULT, "works with FOLDERID_LocalAppData.");
 
 	set_retval = S_FALSE;
+	cfgpath_cache_invalidate();
 	RUN_TEST(TEST_RESULT, "works if folder doesn't exist (S_FALSE).");
 
 	set_appdata_local = NULL;
-	RUN_TEST("", "fails with missing CSIDL_LOCAL_APPDATA.");
+	cfgpath_cache_invalidate();
+	RUN_TEST("", "fails with missing FOLDERID_LocalAppData.");
 
 #undef TEST_FUNC
 #undef TEST_RESULT
 
+/*
+ * get_user_runtime_folder()
+ */
+
+#define TEST_RESULT "C:\\Users\\test-win\\AppData\\Local\\test-win\\"
+#define TEST_FUNC get_user_runtime_folder
+
+	set_retval = S_OK;
+	set_appdata_local = "C:\\Users\\test-win\\AppData\\Local";
+	RUN_TEST(TEST_RESULT, "works with FOLDERID_LocalAppData.");
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * cfgpath_resolve_all()
+ */
+
+#define TEST_FUNC cfgpath_resolve_all
+
+	struct cfgpath_all all;
+	set_retval = S_OK;
+	set_appdata = "C:\\Users\\test-win\\AppData\\Roaming";
+	set_appdata_local = "C:\\Users\\test-win\\AppData\\Local";
+	TEST_FUNC(&all, "test-win");
+	strcpy(buffer, all.config_file);
+	CHECK_RESULT("C:\\Users\\test-win\\AppData\\Roaming\\test-win.ini", "returns the config file.");
+	strcpy(buffer, all.data_folder);
+	CHECK_RESULT("C:\\Users\\test-win\\AppData\\Roaming\\test-win\\", "returns the data folder.");
+	strcpy(buffer, all.cache_folder);
+	CHECK_RESULT("C:\\Users\\test-win\\AppData\\Local\\test-win\\", "returns the cache folder.");
+
+#undef TEST_FUNC
+
+/*
+ * cfgpath_get()
+ */
+
+#define TEST_RESULT "C:\\Users\\test-win\\AppData\\Local\\test-win\\"
+#define TEST_FUNC cfgpath_get
+
+	int len = cfgpath_get(CFGPATH_CACHE_FOLDER, NULL, 0, "test-win");
+	if (len != strlen(TEST_RESULT)) {
+		printf("FAIL: %s:%d size query returned %d.\n", __FILE__, __LINE__, len);
+		return 1;
+	}
+	len = cfgpath_get(CFGPATH_CACHE_FOLDER, buffer, len + 1, "test-win");
+	CHECK_RESULT(TEST_RESULT, "works with a buffer of exactly the right size.");
+
+	set_appdata_local = NULL;
+	cfgpath_cache_invalidate();
+	len = cfgpath_get(CFGPATH_CACHE_FOLDER, buffer, sizeof(buffer), "test-win");
+	if (len != CFGPATH_ERR_NOHOME) {
+		printf("FAIL: %s:%d expected CFGPATH_ERR_NOHOME, got %d.\n", __FILE__,
+			__LINE__, len);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() returns an error with missing FOLDERID_LocalAppData.\n");
+
+#undef TEST_FUNC
+#undef TEST_RESULT
+
+/*
+ * Known folder cache
+ */
+
+	set_retval = S_OK;
+	set_appdata = "C:\\Users\\test-win\\AppData\\Roaming";
+	set_appdata_local = "C:\\Users\\test-win\\AppData\\Local";
+	cfgpath_cache_invalidate();
+	known_folder_calls = 0;
+	get_user_config_file(buffer, sizeof(buffer), "test-win");
+	get_user_config_folder(buffer, sizeof(buffer), "test-win");
+	get_user_data_folder(buffer, sizeof(buffer), "test-win");
+	get_user_cache_folder(buffer, sizeof(buffer), "test-win");
+	get_user_runtime_folder(buffer, sizeof(buffer), "test-win");
+	cfgpath_resolve_all(&all, "test-win");
+	cfgpath_get(CFGPATH_CONFIG_FILE, buffer, sizeof(buffer), "other");
+	cfgpath_get(CFGPATH_DATA_FOLDER, buffer, sizeof(buffer), "other");
+	cfgpath_get(CFGPATH_CACHE_FOLDER, buffer, sizeof(buffer), "other");
+	if (known_folder_calls != 2) {
+		printf("FAIL: %s:%d expected 2 SHGetKnownFolderPath() calls, got %d.\n",
+			__FILE__, __LINE__, known_folder_calls);
+		return 1;
+	}
+	printf("PASS: SHGetKnownFolderPath() is called once per known folder.\n");
+
+#define TEST_FUNC get_user_config_folder
+
+	set_appdata = "D:\\Roaming";
+	RUN_TEST("C:\\Users\\test-win\\AppData\\Roaming\\test-win\\",
+		"keeps using the remembered folder.");
+	cfgpath_cache_invalidate();
+	RUN_TEST("D:\\Roaming\\test-win\\", "looks the folder up again after invalidating.");
+	if (known_folder_calls != 3) {
+		printf("FAIL: %s:%d expected 3 SHGetKnownFolderPath() calls, got %d.\n",
+			__FILE__, __LINE__, known_folder_calls);
+		return 1;
+	}
+
+	set_appdata = NULL;
+	cfgpath_cache_invalidate();
+	RUN_TEST("", "fails with missing FOLDERID_RoamingAppData.");
+	set_appdata = "C:\\Users\\test-win\\AppData\\Roaming";
+	RUN_TEST("C:\\Users\\test-win\\AppData\\Roaming\\test-win\\",
+		"does not remember failures.");
+
+#undef TEST_FUNC
+
+	/* Known folders are not limited to MAX_PATH */
+	char long_local[400];
+	char long_path[512];
+	memset(long_local, 'x', sizeof(long_local));
+	memcpy(long_local, "C:\\", 3);
+	long_local[sizeof(long_local) - 1] = 0;
+	set_appdata_local = long_local;
+	cfgpath_cache_invalidate();
+	test_mkdir_calls = 0;
+	len = cfgpath_get(CFGPATH_CACHE_FOLDER, long_path, sizeof(long_path), "test-win");
+	if ((len != (int)sizeof(long_local) - 1 + 10) || (strlen(long_path) != (size_t)len)
+		|| strcmp(long_path + len - 10, "\\test-win\\")
+	) {
+		printf("FAIL: %s:%d long path not returned, got length %d.\n", __FILE__,
+			__LINE__, len);
+		return 1;
+	}
+	char expected[1024];
+	snprintf(expected, sizeof(expected), "\\\\?\\%s\\test-win", long_local);
+	if ((test_mkdir_calls != 0) || strcmp(test_mkdir_wide, expected)) {
+		printf("FAIL: %s:%d long folder created with mkdir() %d times, "
+			"CreateDirectoryW(\"%s\").\n", __FILE__, __LINE__, test_mkdir_calls,
+			test_mkdir_wide);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() creates folders longer than MAX_PATH.\n");
+
+	memcpy(long_local, "\\\\server\\", 9);
+	cfgpath_cache_invalidate();
+	cfgpath_get(CFGPATH_CACHE_FOLDER, long_path, sizeof(long_path), "test-win");
+	snprintf(expected, sizeof(expected), "\\\\?\\UNC%s\\test-win", long_local + 1);
+	if (strcmp(test_mkdir_wide, expected)) {
+		printf("FAIL: %s:%d long network folder created as \"%s\".\n", __FILE__,
+			__LINE__, test_mkdir_wide);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() creates network folders longer than MAX_PATH.\n");
+	get_user_cache_folder(buffer, sizeof(buffer), "test-win");
+	if (buffer[0] != 0) {
+		printf("FAIL: %s:%d long path returned in a short buffer.\n", __FILE__,
+			__LINE__);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() returns known folders longer than MAX_PATH.\n");
+
+	/* A folder the ANSI code page can't hold must not become a different one */
+	set_appdata = "C:\\Users\\J\xf6rg\\AppData\\Roaming";
+	cfgpath_cache_invalidate();
+	len = cfgpath_get(CFGPATH_CONFIG_FOLDER, buffer, sizeof(buffer), "test-win");
+	if ((len != CFGPATH_ERR_INVALID) || (buffer[0] != 0)) {
+		printf("FAIL: %s:%d unrepresentable folder returned %d \"%s\".\n",
+			__FILE__, __LINE__, len, buffer);
+		return 1;
+	}
+	printf("PASS: cfgpath_get() refuses a folder the ANSI code page can't hold.\n");
+	set_appdata = "C:\\Users\\test-win\\AppData\\Roaming";
+	set_appdata_local = NULL;
+	cfgpath_cache_invalidate();
+
+/*
+ * cfgpath_builder_*()
+ */
+
+#define TEST_FUNC cfgpath_builder_push
+
+	struct cfgpath_builder builder;
+	cfgpath_builder_init_folder(&builder, buffer, sizeof(buffer), "C:\\Games");
+	CHECK_RESULT("C:\\Games\\", "adds a missing backslash.");
+	cfgpath_builder_push(&builder, "test-win");
+	cfgpath_builder_file(&builder, "save.dat");
+	CHECK_RESULT("C:\\Games\\test-win\\save.dat", "joins with backslashes.");
+	if ((cfgpath_builder_file(&builder, "..\\save.dat") != CFGPATH_ERR_INVALID)
+		|| (cfgpath_builder_file(&builder, "../save.dat") != CFGPATH_ERR_INVALID)
+	) {
+		printf("FAIL: %s:%d accepted a name that leaves the folder.\n", __FILE__,
+			__LINE__);
+		return 1;
+	}
+	CHECK_RESULT("C:\\Games\\test-win\\", "rejects either separator.");
+
+#undef TEST_FUNC
+
 	printf("All tests passed for platform: Windows.\n");
 	return 0;
 }
@@ -0,0 +1,27 @@
+/**
+ * @file  test.h
+ * @brief Helpers shared by the test programs for the companion headers.
+ *
+ * Copyright (C) 2013 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This code is placed in the public domain.  You are free to use it for any
+ * purpose.  If you add new platform support, please contribute a patch!
+ */
+
+#ifndef CFGPATH_TEST_H_
+#define CFGPATH_TEST_H_
+
+#include <stdio.h>
+
+/* Report whether cond holds, and return from main() if it doesn't.  msg must
+ * be a string literal, written as a sentence about what is being checked,
+ * e.g. "cfgpath_map_file() reads a small file into the buffer." */
+#define CHECK(cond, msg) \
+	if (!(cond)) { \
+		printf("FAIL: %s:%d " msg "\n", __FILE__, __LINE__); \
+		return 1; \
+	} else { \
+		printf("PASS: " msg "\n"); \
+	}
+
+#endif /* CFGPATH_TEST_H_ */